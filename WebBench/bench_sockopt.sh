@@ -0,0 +1,21 @@
+#!/bin/sh
+# 在同样的负载下依次比较各个socket调优profile
+# 用法: ./bench_sockopt.sh [秒数] [客户端数] [URL]
+# KEEP=1 时使用长连接测试
+TIME=${1:-30}
+CLIENTS=${2:-500}
+URL=${3:-http://127.0.0.1:8888/index.html}
+KEEP_OPT=""
+if [ "$KEEP" = "1" ]; then
+    KEEP_OPT="-k"
+fi
+
+for profile in none latency throughput default
+do
+    (cd ../src && ./myserver -s $profile > /dev/null 2>&1 &)
+    sleep 1
+    echo "== profile: $profile"
+    ./bin/webbench -t $TIME -c $CLIENTS -2 $KEEP_OPT --get $URL | grep -E "Speed|Requests"
+    pkill -x myserver
+    sleep 2
+done
@@ -0,0 +1,211 @@
+// 空闲keep-alive连接的内存占用：建立N个连接，每个连接完成一次请求后保持空闲，
+// 统计服务器进程RSS的增量，得到每个空闲连接在用户态占用的字节数(不含内核的socket内存)。
+// 增量中包括各种池预热的固定开销，连接数较大时看相邻两档之间的边际值
+// 用法: ./idle_bench <服务器pid> [连接数...]，默认100000和1000000
+// 服务器要用-n指定足够大的最大连接数。一个进程打开的描述符不够时分给多个子进程，
+// 本机端口不够时连接分散到127.0.0.0/8中的多个源地址
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+#include <sys/resource.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <vector>
+
+static const int PORT = 8888;
+// 每个源地址最多用的端口数，留一些给别的连接
+static const int CONNS_PER_SOURCE = 25000;
+// 一批先全部发出请求再逐个读响应，不超过服务器的监听队列
+static const int BATCH = 512;
+// 每个子进程留给自己的描述符
+static const int FD_RESERVE = 64;
+
+static const char REQUEST[] = "GET /index.html HTTP/1.1\r\nHost: bench\r\nConnection: keep-alive\r\n\r\n";
+
+static long rssKb(int pid)
+{
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/%d/status", pid);
+    FILE *f = fopen(path, "r");
+    if (f == NULL)
+        return -1;
+    char line[256];
+    long kb = -1;
+    while (fgets(line, sizeof(line), f))
+    {
+        if (strncmp(line, "VmRSS:", 6) == 0)
+        {
+            kb = atol(line + 6);
+            break;
+        }
+    }
+    fclose(f);
+    return kb;
+}
+
+// 读完一个响应(头部和Content-length字节的body)，失败返回-1
+static int readResponse(int fd)
+{
+    char buf[4096];
+    size_t used = 0;
+    while (used < sizeof(buf))
+    {
+        ssize_t n = recv(fd, buf + used, sizeof(buf) - used, 0);
+        if (n <= 0)
+            return -1;
+        used += n;
+        char *end = static_cast<char*>(memmem(buf, used, "\r\n\r\n", 4));
+        if (end == NULL)
+            continue;
+        const char *cl = static_cast<const char*>(memmem(buf, end - buf, "Content-length: ", 16));
+        size_t body = cl ? atol(cl + 16) : 0;
+        if (used >= static_cast<size_t>(end + 4 - buf) + body)
+            return 0;
+    }
+    return -1;
+}
+
+// 用source开始的源地址建立count个空闲连接，返回成功的个数
+static int openConns(int count, int source, std::vector<int> &fds)
+{
+    struct sockaddr_in server;
+    memset(&server, 0, sizeof(server));
+    server.sin_family = AF_INET;
+    server.sin_port = htons(PORT);
+    server.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    int opened = 0;
+    while (opened < count)
+    {
+        int batch = count - opened < BATCH ? count - opened : BATCH;
+        size_t first = fds.size();
+        for (int i = 0; i < batch; ++i)
+        {
+            int fd = socket(AF_INET, SOCK_STREAM, 0);
+            if (fd < 0)
+                return opened;
+            struct sockaddr_in local;
+            memset(&local, 0, sizeof(local));
+            local.sin_family = AF_INET;
+            // 127.0.0.2开始，每个地址CONNS_PER_SOURCE个连接
+            int k = source + (opened + i) / CONNS_PER_SOURCE;
+            local.sin_addr.s_addr = htonl((127u << 24) | (2 + k));
+            if (bind(fd, (struct sockaddr*)&local, sizeof(local)) < 0 ||
+                connect(fd, (struct sockaddr*)&server, sizeof(server)) < 0 ||
+                send(fd, REQUEST, sizeof(REQUEST) - 1, 0) != static_cast<ssize_t>(sizeof(REQUEST) - 1))
+            {
+                fprintf(stderr, "connect: %s\n", strerror(errno));
+                close(fd);
+                return opened;
+            }
+            fds.push_back(fd);
+        }
+        for (size_t i = first; i < fds.size(); ++i)
+        {
+            if (readResponse(fds[i]) < 0)
+            {
+                fprintf(stderr, "no response on connection %zu\n", i);
+                return opened;
+            }
+        }
+        opened += batch;
+    }
+    return opened;
+}
+
+// 子进程建立连接后把个数写进管道，然后一直持有连接直到被杀掉
+static pid_t spawn(int count, int source, int pipeFd)
+{
+    pid_t pid = fork();
+    if (pid != 0)
+        return pid;
+    std::vector<int> fds;
+    fds.reserve(count);
+    int opened = openConns(count, source, fds);
+    if (write(pipeFd, &opened, sizeof(opened)) != sizeof(opened))
+        _exit(1);
+    while (true)
+        pause();
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc < 2)
+    {
+        printf("Usage: %s server_pid [connections...]\n", argv[0]);
+        return 1;
+    }
+    int serverPid = atoi(argv[1]);
+    std::vector<int> levels;
+    for (int i = 2; i < argc; ++i)
+        levels.push_back(atoi(argv[i]));
+    if (levels.empty())
+    {
+        levels.push_back(100000);
+        levels.push_back(1000000);
+    }
+    struct rlimit rl;
+    getrlimit(RLIMIT_NOFILE, &rl);
+    rl.rlim_cur = rl.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &rl);
+    int perChild = static_cast<int>(rl.rlim_cur) - FD_RESERVE;
+    // 每个子进程的源地址不和别的子进程重叠
+    int sourcesPerChild = (perChild + CONNS_PER_SOURCE - 1) / CONNS_PER_SOURCE;
+    int pipes[2];
+    if (pipe(pipes) < 0)
+        return 1;
+
+    long base = rssKb(serverPid);
+    if (base < 0)
+    {
+        printf("cannot read rss of pid %d\n", serverPid);
+        return 1;
+    }
+    printf("server pid %d, baseline rss %ld KB, %d connections per client process\n", serverPid, base, perChild);
+    printf("%-12s %-12s %-12s %-12s %s\n", "conns", "rss(KB)", "delta(KB)", "bytes/conn", "marginal");
+    std::vector<pid_t> children;
+    int total = 0, prevTotal = 0;
+    long prevRss = base;
+    for (size_t l = 0; l < levels.size(); ++l)
+    {
+        int want = levels[l];
+        int spawned = 0;
+        while (total + spawned * perChild < want)
+        {
+            int n = want - total - spawned * perChild;
+            n = n < perChild ? n : perChild;
+            children.push_back(spawn(n, static_cast<int>(children.size()) * sourcesPerChild, pipes[1]));
+            ++spawned;
+        }
+        bool failed = false;
+        for (int i = 0; i < spawned; ++i)
+        {
+            int opened = 0;
+            if (read(pipes[0], &opened, sizeof(opened)) != sizeof(opened))
+                failed = true;
+            total += opened;
+        }
+        // 等服务器把最后一批连接降级成空闲记录
+        sleep(1);
+        long rss = rssKb(serverPid);
+        printf("%-12d %-12ld %-12ld %-12.1f %.1f\n", total, rss, rss - base, total > 0 ? (rss - base) * 1024.0 / total : 0.0,
+            total > prevTotal ? (rss - prevRss) * 1024.0 / (total - prevTotal) : 0.0);
+        prevTotal = total;
+        prevRss = rss;
+        if (failed || total < want)
+        {
+            printf("only %d of %d connections established, stopping\n", total, want);
+            break;
+        }
+    }
+    for (size_t i = 0; i < children.size(); ++i)
+        kill(children[i], SIGKILL);
+    for (size_t i = 0; i < children.size(); ++i)
+        waitpid(children[i], NULL, 0);
+    return 0;
+}
@@ -0,0 +1,93 @@
+// 拼接吞吐量测试：用随机纹理生成一张大场景，切成N张相邻重叠40%的图片，
+// 统计不同图片数量和分辨率下每秒完成的拼接次数
+// 用法: ./stitch_bench [compute线程数] [每组重复次数]
+#include "../src/ImageStitcher.h"
+#include "../src/Compute.h"
+#include <opencv2/imgproc/imgproc.hpp>
+#include <opencv2/opencv.hpp>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/time.h>
+#include <vector>
+
+using namespace cv;
+
+static double nowSec()
+{
+    struct timeval now;
+    gettimeofday(&now, NULL);
+    return now.tv_sec + now.tv_usec / 1e6;
+}
+
+// 带结构的随机纹理，保证ORB能找到足够的特征点
+static Mat makeScene(int width, int height)
+{
+    Mat noise(height, width, CV_8UC3);
+    randu(noise, Scalar::all(0), Scalar::all(255));
+    Mat scene;
+    GaussianBlur(noise, scene, Size(0, 0), 3.0);
+    RNG rng(12345);
+    for (int i = 0; i < width * height / 4000; ++i)
+    {
+        Point p(rng.uniform(0, width), rng.uniform(0, height));
+        Scalar color(rng.uniform(0, 255), rng.uniform(0, 255), rng.uniform(0, 255));
+        if (i % 2)
+            rectangle(scene, Rect(p.x, p.y, rng.uniform(5, 60), rng.uniform(5, 60)), color, -1);
+        else
+            circle(scene, p, rng.uniform(3, 30), color, 2);
+    }
+    return scene;
+}
+
+static std::vector<Mat> makeViews(const Mat &scene, int count, Size size)
+{
+    // 相邻两张重叠40%
+    double step = size.width * 0.6;
+    std::vector<Mat> views;
+    for (int i = 0; i < count; ++i)
+    {
+        Rect roi(static_cast<int>(i * step), 0, size.width, size.height);
+        views.push_back(scene(roi).clone());
+    }
+    return views;
+}
+
+int main(int argc, char *argv[])
+{
+    int threads = argc > 1 ? atoi(argv[1]) : 4;
+    int repeat = argc > 2 ? atoi(argv[2]) : 10;
+    if (threads > 0 && Compute::init(threads) < 0)
+    {
+        printf("Compute threads create failed\n");
+        return 1;
+    }
+    const Size sizes[] = { Size(640, 480), Size(1280, 720), Size(1920, 1080) };
+    const int counts[] = { 2, 3, 4, 6 };
+    printf("compute threads: %d, repeat: %d\n", threads, repeat);
+    printf("%-12s %-8s %-12s %-12s %s\n", "resolution", "images", "stitches/s", "ms/stitch", "pano");
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); ++s)
+    {
+        for (size_t c = 0; c < sizeof(counts) / sizeof(counts[0]); ++c)
+        {
+            Size size = sizes[s];
+            int count = counts[c];
+            Mat scene = makeScene(static_cast<int>(size.width * (0.6 * (count - 1) + 1)) + 1, size.height);
+            std::vector<Mat> views = makeViews(scene, count, size);
+            Mat pano;
+            // 预热一次，同时检查能否拼接成功
+            int ret = ImageStitcher::stitch(views, pano);
+            if (ret != STITCH_OK)
+            {
+                printf("%4dx%-7d %-8d failed: %s\n", size.width, size.height, count, ImageStitcher::error(ret));
+                continue;
+            }
+            double start = nowSec();
+            for (int i = 0; i < repeat; ++i)
+                ImageStitcher::stitch(views, pano);
+            double cost = nowSec() - start;
+            printf("%4dx%-7d %-8d %-12.2f %-12.1f %dx%d\n", size.width, size.height, count,
+                repeat / cost, cost * 1000 / repeat, pano.cols, pano.rows);
+        }
+    }
+    return 0;
+}
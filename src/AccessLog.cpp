@@ -0,0 +1,315 @@
+#include "AccessLog.h"
+#include "Logger.h"
+#include <pthread.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <arpa/inet.h>
+
+// 后台线程每次攒起来一起处理的最大字节数
+static const size_t ACCESS_FLUSH_BYTES = 1024 * 1024;
+
+struct AccessLog::Stage
+{
+    char data[ACCESS_STAGE_BYTES];
+    // 生产者和消费者各自的下标放在不同的缓存行
+    std::atomic<size_t> head;
+    char pad1[64];
+    std::atomic<size_t> tail;
+    char pad2[64];
+    Stage *next;
+};
+
+std::atomic<bool> AccessLog::running(false);
+int AccessLog::format = ACCESS_LOG_CLF;
+std::string AccessLog::path;
+size_t AccessLog::rotateBytes = 0;
+int AccessLog::fd = -1;
+size_t AccessLog::written = 0;
+std::atomic<unsigned long> AccessLog::dropped(0);
+std::atomic<AccessLog::Stage*> AccessLog::stages(NULL);
+
+namespace
+{
+const char *methods[] = { "-", "POST", "GET", "HEAD", "DELETE" };
+const char *months[] = { "Jan", "Feb", "Mar", "Apr", "May", "Jun", "Jul", "Aug", "Sep", "Oct", "Nov", "Dec" };
+pthread_t flusher;
+
+void writeAll(int fd, const char *data, size_t len)
+{
+    while (len > 0)
+    {
+        ssize_t n = ::write(fd, data, len);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return;
+        }
+        data += n;
+        len -= n;
+    }
+}
+
+// out至少要有len * 4的空间，返回写入的长度
+size_t escapeUri(const char *uri, size_t len, char *out)
+{
+    static const char hex[] = "0123456789ABCDEF";
+    size_t n = 0;
+    for (size_t i = 0; i < len; ++i)
+    {
+        unsigned char c = uri[i];
+        if (c == '"' || c == '\\' || c < 0x20 || c == 0x7f)
+        {
+            out[n++] = '\\';
+            out[n++] = 'x';
+            out[n++] = hex[c >> 4];
+            out[n++] = hex[c & 0xf];
+        }
+        else
+            out[n++] = c;
+    }
+    return n;
+}
+}
+
+AccessLog::Stage *AccessLog::stage()
+{
+    static thread_local Stage *s = NULL;
+    if (s == NULL)
+    {
+        s = new Stage();
+        s->head.store(0, std::memory_order_relaxed);
+        s->tail.store(0, std::memory_order_relaxed);
+        Stage *old = stages.load(std::memory_order_relaxed);
+        do
+        {
+            s->next = old;
+        } while (!stages.compare_exchange_weak(old, s, std::memory_order_release, std::memory_order_relaxed));
+    }
+    return s;
+}
+
+int AccessLog::openFile()
+{
+    int f = open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (f < 0)
+        return -1;
+    off_t size = lseek(f, 0, SEEK_END);
+    written = size > 0 ? size : 0;
+    // 新的二进制文件先写标记，接着已有的文件追加时不重复写
+    if (format == ACCESS_LOG_BINARY && written == 0)
+    {
+        writeAll(f, ACCESS_LOG_MAGIC, sizeof(ACCESS_LOG_MAGIC));
+        written = sizeof(ACCESS_LOG_MAGIC);
+    }
+    fd = f;
+    return 0;
+}
+
+void AccessLog::rotate()
+{
+    close(fd);
+    fd = -1;
+    // path.(N-1) -> path.N, ..., path -> path.1，最旧的被覆盖
+    for (int i = ACCESS_LOG_KEEP - 1; i >= 1; --i)
+    {
+        std::string from = path + "." + std::to_string(i);
+        std::string to = path + "." + std::to_string(i + 1);
+        rename(from.c_str(), to.c_str());
+    }
+    if (rename(path.c_str(), (path + ".1").c_str()) < 0)
+        LOG_WARN("access log rotate %s: %m", path.c_str());
+    if (openFile() < 0)
+        LOG_ERROR("access log reopen %s: %m", path.c_str());
+}
+
+int AccessLog::start(const std::string &path_, int format_, size_t rotateBytes_)
+{
+    if (path_.empty())
+        return 0;
+    path = path_;
+    format = format_;
+    rotateBytes = rotateBytes_;
+    if (openFile() < 0)
+        return -1;
+    running = true;
+    if (pthread_create(&flusher, NULL, threadRun, NULL) != 0)
+    {
+        running = false;
+        return -1;
+    }
+    return 0;
+}
+
+void AccessLog::stop()
+{
+    if (!running.exchange(false))
+        return;
+    pthread_join(flusher, NULL);
+}
+
+void AccessLog::append(const AccessRecord &record, const char *uri)
+{
+    Stage *s = stage();
+    size_t uriLen = record.uriLen < ACCESS_URI_MAX ? record.uriLen : ACCESS_URI_MAX;
+    size_t n = sizeof(AccessRecord) + uriLen;
+    size_t h = s->head.load(std::memory_order_relaxed);
+    size_t t = s->tail.load(std::memory_order_acquire);
+    if (ACCESS_STAGE_BYTES - (h - t) < n)
+    {
+        dropped.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    AccessRecord r = record;
+    r.size = static_cast<uint16_t>(n);
+    r.uriLen = static_cast<uint16_t>(uriLen);
+    size_t idx = h & (ACCESS_STAGE_BYTES - 1);
+    // 记录可能跨过环形缓冲区的末尾，分两段拷贝
+    const char *parts[2] = { reinterpret_cast<const char*>(&r), uri };
+    size_t lens[2] = { sizeof(AccessRecord), uriLen };
+    for (int i = 0; i < 2; ++i)
+    {
+        size_t first = ACCESS_STAGE_BYTES - idx < lens[i] ? ACCESS_STAGE_BYTES - idx : lens[i];
+        memcpy(s->data + idx, parts[i], first);
+        memcpy(s->data, parts[i] + first, lens[i] - first);
+        idx = (idx + lens[i]) & (ACCESS_STAGE_BYTES - 1);
+    }
+    s->head.store(h + n, std::memory_order_release);
+}
+
+size_t AccessLog::drain(char *out, size_t cap)
+{
+    size_t used = 0;
+    for (Stage *s = stages.load(std::memory_order_acquire); s; s = s->next)
+    {
+        size_t h = s->head.load(std::memory_order_acquire);
+        size_t t = s->tail.load(std::memory_order_relaxed);
+        size_t avail = h - t;
+        // 只整段取走，保证一条记录不会被拆开
+        if (avail == 0 || avail > cap - used)
+            continue;
+        size_t idx = t & (ACCESS_STAGE_BYTES - 1);
+        size_t first = ACCESS_STAGE_BYTES - idx < avail ? ACCESS_STAGE_BYTES - idx : avail;
+        memcpy(out + used, s->data + idx, first);
+        memcpy(out + used + first, s->data, avail - first);
+        used += avail;
+        s->tail.store(h, std::memory_order_release);
+    }
+    return used;
+}
+
+void AccessLog::output(const char *data, size_t len)
+{
+    if (fd < 0)
+        return;
+    writeAll(fd, data, len);
+    written += len;
+    if (rotateBytes > 0 && written >= rotateBytes)
+        rotate();
+}
+
+void *AccessLog::threadRun(void *args)
+{
+    char *buf = new char[ACCESS_FLUSH_BYTES];
+    char *text = NULL;
+    if (format == ACCESS_LOG_CLF)
+        text = new char[ACCESS_FLUSH_BYTES + ACCESS_LINE_MAX];
+    unsigned long reported = 0;
+    bool last = false;
+    while (!last)
+    {
+        // 停止后再取一遍，把剩下的写完
+        last = !running.load();
+        if (!last)
+            usleep(ACCESS_FLUSH_INTERVAL_MS * 1000);
+        size_t n;
+        while ((n = drain(buf, ACCESS_FLUSH_BYTES)) > 0)
+        {
+            if (text == NULL)
+            {
+                output(buf, n);
+                continue;
+            }
+            // 文本格式在这里才格式化，工作线程上只拷贝定长记录
+            size_t len = 0;
+            for (size_t off = 0; off + sizeof(AccessRecord) <= n;)
+            {
+                AccessRecord r;
+                memcpy(&r, buf + off, sizeof(r));
+                len += formatClf(r, buf + off + sizeof(r), text + len, ACCESS_LINE_MAX);
+                off += r.size;
+                if (len >= ACCESS_FLUSH_BYTES)
+                {
+                    output(text, len);
+                    len = 0;
+                }
+            }
+            output(text, len);
+        }
+        unsigned long d = dropped.load(std::memory_order_relaxed);
+        if (d != reported)
+        {
+            LOG_WARN("access log: %lu records dropped", d - reported);
+            reported = d;
+        }
+    }
+    delete[] text;
+    delete[] buf;
+    if (fd >= 0)
+        close(fd);
+    fd = -1;
+    return NULL;
+}
+
+int AccessLog::formatClf(const AccessRecord &record, const char *uri, char *out, size_t cap)
+{
+    char addr[INET_ADDRSTRLEN];
+    struct in_addr in;
+    in.s_addr = record.addr;
+    if (inet_ntop(AF_INET, &in, addr, sizeof(addr)) == NULL)
+        strcpy(addr, "-");
+    time_t sec = record.time / 1000000;
+    struct tm tm;
+    gmtime_r(&sec, &tm);
+    const char *method = record.method < sizeof(methods) / sizeof(methods[0]) ? methods[record.method] : "-";
+    char uriText[ACCESS_URI_MAX * 4];
+    size_t uriLen = escapeUri(uri, record.uriLen < ACCESS_URI_MAX ? record.uriLen : ACCESS_URI_MAX, uriText);
+    // 没有请求行(例如请求行就解析失败了)时按CLF的习惯写"-"
+    int n;
+    if (record.uriLen == 0)
+        n = snprintf(out, cap, "%s - - [%02d/%s/%04d:%02d:%02d:%02d +0000] \"-\" %u %llu\n", addr, tm.tm_mday,
+            months[tm.tm_mon], tm.tm_year + 1900, tm.tm_hour, tm.tm_min, tm.tm_sec, record.status,
+            static_cast<unsigned long long>(record.bytes));
+    else
+        n = snprintf(out, cap, "%s - - [%02d/%s/%04d:%02d:%02d:%02d +0000] \"%s %.*s HTTP/1.%d\" %u %llu\n", addr,
+            tm.tm_mday, months[tm.tm_mon], tm.tm_year + 1900, tm.tm_hour, tm.tm_min, tm.tm_sec, method,
+            static_cast<int>(uriLen), uriText, record.version == 1 ? 0 : 1, record.status,
+            static_cast<unsigned long long>(record.bytes));
+    if (n < 0)
+        return 0;
+    if (static_cast<size_t>(n) >= cap)
+    {
+        n = cap - 1;
+        out[n - 1] = '\n';
+    }
+    return n;
+}
+
+int AccessLog::formatOf(const char *name)
+{
+    if (strcasecmp(name, "clf") == 0)
+        return ACCESS_LOG_CLF;
+    if (strcasecmp(name, "binary") == 0)
+        return ACCESS_LOG_BINARY;
+    return -1;
+}
+
+unsigned long AccessLog::droppedRecords()
+{
+    return dropped.load(std::memory_order_relaxed);
+}
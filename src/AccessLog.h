@@ -0,0 +1,85 @@
+#pragma once
+#include <atomic>
+#include <string>
+#include <stddef.h>
+#include <stdint.h>
+
+const int ACCESS_LOG_CLF = 0;
+const int ACCESS_LOG_BINARY = 1;
+
+// 每个线程暂存区的大小(2的幂)，满了之后新的记录直接丢弃并计数
+const size_t ACCESS_STAGE_BYTES = 256 * 1024;
+// 记录中URI的最大长度，超过的截断
+const size_t ACCESS_URI_MAX = 2048;
+// CLF一行的最大长度，URI转义后最多变成4倍
+const size_t ACCESS_LINE_MAX = ACCESS_URI_MAX * 4 + 256;
+// 后台线程把暂存区写出去的间隔
+const int ACCESS_FLUSH_INTERVAL_MS = 200;
+// 轮转时保留的旧文件数：path.1(最新)到path.N
+const int ACCESS_LOG_KEEP = 5;
+// 二进制文件开头的标记
+const char ACCESS_LOG_MAGIC[8] = { 'S', 'X', 'A', 'L', 'O', 'G', '1', '\n' };
+
+// 二进制格式的一条记录，按本机字节序原样写出，后面紧跟uriLen字节的URI。
+// 字段按自然对齐排列，没有填充
+struct AccessRecord
+{
+    // 整条记录的字节数，包括URI
+    uint16_t size;
+    uint16_t status;
+    // 客户端IPv4地址，网络字节序
+    uint32_t addr;
+    // 收到请求的UTC时间，微秒
+    uint64_t time;
+    // 从收到请求到响应发完，微秒
+    uint32_t duration;
+    // 同RequestData的METHOD_*
+    uint8_t method;
+    // 同RequestData的HTTP_10/HTTP_11
+    uint8_t version;
+    uint16_t uriLen;
+    // 响应的字节数，包括头部
+    uint64_t bytes;
+};
+
+// 访问日志。工作线程只把定长的二进制记录拷贝进自己的无锁暂存区(和Logger一样的单生产者单消费者环形缓冲)，
+// 后台线程定期取出，按格式原样写出或者格式化成CLF文本，攒成一块一次write；
+// 文件按大小轮转也在后台线程上完成，不影响工作线程
+class AccessLog
+{
+private:
+    struct Stage;
+    static std::atomic<bool> running;
+    static int format;
+    static std::string path;
+    static size_t rotateBytes;
+    static int fd;
+    // 当前文件已经写了多少字节
+    static size_t written;
+    static std::atomic<unsigned long> dropped;
+    static std::atomic<Stage*> stages;
+    AccessLog();
+    AccessLog(const AccessLog &a);
+
+    static Stage *stage();
+    static void *threadRun(void *args);
+    static size_t drain(char *out, size_t cap);
+    static int openFile();
+    static void rotate();
+    static void output(const char *data, size_t len);
+
+public:
+    // path为空时不记录；rotateBytes为0表示不轮转
+    static int start(const std::string &path_, int format_, size_t rotateBytes_);
+    static void stop();
+    static bool enabled()
+    {
+        return running.load(std::memory_order_relaxed);
+    }
+    static void append(const AccessRecord &record, const char *uri);
+    // 把一条二进制记录格式化成CLF文本(包括换行)，返回长度。
+    // URI中的引号、反斜杠和控制字符写成\xHH(同nginx)，客户端不能伪造字段或者整行
+    static int formatClf(const AccessRecord &record, const char *uri, char *out, size_t cap);
+    static int formatOf(const char *name);
+    static unsigned long droppedRecords();
+};
@@ -0,0 +1,45 @@
+#include "Arena.h"
+#include <string.h>
+
+Arena::Arena():
+    head(NULL)
+{
+}
+
+Arena::~Arena()
+{
+    reset();
+}
+
+void *Arena::alloc(size_t n)
+{
+    size_t idx = head ? (head->writeIdx + 7) & ~static_cast<size_t>(7) : 0;
+    if (head == NULL || idx + n > head->capacity)
+    {
+        // 当前块剩余的空间直接放弃，超过标准块大小的单独申请
+        BufferChunk *chunk = ChunkPool::getLarge(n);
+        chunk->next = head;
+        head = chunk;
+        idx = 0;
+    }
+    head->writeIdx = idx + n;
+    return head->data + idx;
+}
+
+StrView Arena::dup(const char *data, size_t n)
+{
+    char *p = static_cast<char*>(alloc(n + 1));
+    memcpy(p, data, n);
+    p[n] = '\0';
+    return StrView(p, n);
+}
+
+void Arena::reset()
+{
+    while (head)
+    {
+        BufferChunk *next = head->next;
+        ChunkPool::put(head);
+        head = next;
+    }
+}
@@ -0,0 +1,24 @@
+#pragma once
+#include "Buffer.h"
+#include "StrView.h"
+#include "nocopyable.h"
+#include <stddef.h>
+
+// 请求级的单调分配器：解析请求和生成响应时的临时数据(URI、头部等)从这里分配，
+// 只分配不释放，请求结束时整体归还。内存块来自本线程的ChunkPool，稳态下不调用malloc
+class Arena: noncopyable
+{
+private:
+    // 当前块在链表头部，writeIdx是下一个可用位置
+    BufferChunk *head;
+
+public:
+    Arena();
+    ~Arena();
+    // 按8字节对齐
+    void *alloc(size_t n);
+    // 拷贝一份，末尾补'\0'，可以直接传给需要C字符串的系统调用
+    StrView dup(const char *data, size_t n);
+    // 所有块还给块池，之前分配的内存全部失效
+    void reset();
+};
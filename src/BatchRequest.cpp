@@ -0,0 +1,208 @@
+#include "BatchRequest.h"
+#include "RequestData.h"
+#include "ImageService.h"
+#include "Compute.h"
+#include "TaskLane.h"
+#include <stdio.h>
+#include <string.h>
+#include <random>
+using namespace std;
+
+BatchRequest::BatchRequest(const std::string &boundary_, const EncodeOptions &enc_, int width_, int height_):
+    parser(boundary_, this),
+    enc(enc_),
+    width(width_),
+    height(height_),
+    parts(0),
+    tooLarge(false),
+    failed(false),
+    finished(0),
+    ended(false),
+    responding(false),
+    cancelled(false)
+{
+    static thread_local mt19937_64 gen(random_device{}());
+    char buf[32];
+    snprintf(buf, sizeof(buf), "batch%016llx", static_cast<unsigned long long>(gen()));
+    boundary = buf;
+}
+
+BatchRequest::PartData::~PartData()
+{
+    BodyBudget::release(charged);
+}
+
+void BatchRequest::PartData::append(const char *data_, size_t len)
+{
+    if (spool.active())
+    {
+        spool.append(data_, len);
+        return;
+    }
+    if (bytes.size() + len > BodyBudget::spoolThreshold() && spool.open(BATCH_MAX_PART_BYTES) == 0)
+    {
+        // 映射按part的上限建立，文件是稀疏的，只有写过的部分占磁盘
+        spool.append(bytes.data(), bytes.size());
+        spool.append(data_, len);
+        string().swap(bytes);
+        BodyBudget::release(charged);
+        charged = 0;
+        return;
+    }
+    bytes.append(data_, len);
+    // 只在容量增长时记账，不是每块数据都加锁
+    if (bytes.capacity() > charged)
+    {
+        BodyBudget::charge(bytes.capacity() - charged);
+        charged = bytes.capacity();
+    }
+}
+
+int BatchRequest::onBody(const char *data_, size_t len)
+{
+    int n = parser.feed(data_, len);
+    return failed || n < 0 ? BODY_ERROR : n;
+}
+
+int BatchRequest::onBodyEnd()
+{
+    return parser.done() ? 0 : BODY_ERROR;
+}
+
+void BatchRequest::onPartBegin(const HeaderMap &headers)
+{
+    if (++parts > BATCH_MAX_PARTS)
+        failed = true;
+    data.reset(new PartData());
+    tooLarge = false;
+    auto it = headers.find("Content-Disposition");
+    disposition = it == headers.end() ? string() : it->second;
+}
+
+void BatchRequest::onPartData(const char *data_, size_t len)
+{
+    if (failed || tooLarge)
+        return;
+    if (data->size() + len > BATCH_MAX_PART_BYTES)
+    {
+        tooLarge = true;
+        data.reset(new PartData());
+        return;
+    }
+    data->append(data_, len);
+}
+
+void BatchRequest::onPartEnd()
+{
+    if (failed)
+        return;
+    int index = parts - 1;
+    if (tooLarge)
+    {
+        string msg = "Payload Too Large";
+        complete(index, disposition, 413, "text/plain", msg.data(), msg.size());
+        return;
+    }
+    // 上传还在继续时前面的part已经开始计算
+    shared_ptr<BatchRequest> self(shared_from_this());
+    shared_ptr<PartData> part(data);
+    string disp(disposition);
+    data.reset();
+    int ret = Compute::post([self, index, disp, part]() { self->process(index, disp, part); });
+    if (ret == LANE_NOT_STARTED)
+        process(index, disp, part);
+    else if (ret < 0)
+    {
+        string msg = "Service Unavailable";
+        complete(index, disp, 503, "text/plain", msg.data(), msg.size());
+    }
+}
+
+void BatchRequest::process(int index, const std::string &disposition_, std::shared_ptr<PartData> data_)
+{
+    if (cancelled)
+    {
+        complete(index, disposition_, HTTP_CLIENT_CLOSED, "text/plain", NULL, 0);
+        return;
+    }
+    ResultCache::resultPtr r = ImageService::transform(data_->data(), data_->size(), width, height, enc);
+    data_.reset();
+    if (r->code == 200)
+        complete(index, disposition_, 200, ImageEncoder::mime(enc.format),
+            reinterpret_cast<const char*>(r->data.data()), r->data.size(), r);
+    else
+        complete(index, disposition_, r->code, "text/plain", r->msg.data(), r->msg.size());
+}
+
+void BatchRequest::complete(int index, const std::string &disposition_, int code, const std::string &type,
+    const char *body, size_t len, const std::shared_ptr<const void> &owner)
+{
+    string head = "--" + boundary + "\r\n";
+    head += "Content-Type: " + type + "\r\n";
+    if (!disposition_.empty())
+        head += "Content-Disposition: " + disposition_ + "\r\n";
+    head += "X-Part-Index: " + to_string(index) + "\r\n";
+    head += "X-Part-Status: " + to_string(code) + "\r\n";
+    head += "Content-Length: " + to_string(len) + "\r\n\r\n";
+    // 一个part编码成一个chunk
+    char size[32];
+    snprintf(size, sizeof(size), "%zx\r\n", head.size() + len + 2);
+    Part part;
+    part.head.reserve(strlen(size) + head.size() + (owner ? 0 : len + 4));
+    part.head += size;
+    part.head += head;
+    part.owner = owner;
+    part.body = body;
+    part.len = len;
+    if (!owner)
+    {
+        part.head.append(body, len);
+        part.head += "\r\n\r\n";
+    }
+    reqPtr w;
+    {
+        MutexLockGuard guard(lock);
+        ready.push_back(std::move(part));
+        ++finished;
+        w.swap(waiter);
+    }
+    if (w)
+        RequestData::resumeWrite(std::move(w));
+}
+
+string BatchRequest::respond()
+{
+    MutexLockGuard guard(lock);
+    responding = true;
+    return "multipart/mixed; boundary=" + boundary;
+}
+
+int BatchRequest::take(Buffer &out, reqPtr &self)
+{
+    MutexLockGuard guard(lock);
+    if (!ready.empty())
+    {
+        for (size_t i = 0; i < ready.size(); ++i)
+        {
+            out.append(ready[i].head);
+            if (ready[i].owner)
+            {
+                out.appendRef(ready[i].owner, ready[i].body, ready[i].len);
+                out.append("\r\n\r\n", 4);
+            }
+        }
+        ready.clear();
+        return BATCH_MORE;
+    }
+    if (finished == parts && !ended)
+    {
+        ended = true;
+        string tail = "--" + boundary + "--\r\n";
+        char size[32];
+        snprintf(size, sizeof(size), "%zx\r\n", tail.size());
+        out.append(size + tail + "\r\n0\r\n\r\n");
+        return BATCH_DONE;
+    }
+    waiter = std::move(self);
+    return BATCH_PARKED;
+}
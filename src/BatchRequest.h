@@ -0,0 +1,118 @@
+#pragma once
+#include "MultipartParser.h"
+#include "BodyHandler.h"
+#include "ImageEncoder.h"
+#include "MutexLock.h"
+#include "Buffer.h"
+#include "RequestPtr.h"
+#include "nocopyable.h"
+#include "BodySpool.h"
+#include <string>
+#include <deque>
+#include <memory>
+#include <atomic>
+
+// 一个批量请求最多的图片数
+const int BATCH_MAX_PARTS = 256;
+// 单张图片的最大字节数，超过的part返回413
+const size_t BATCH_MAX_PART_BYTES = 32 * 1024 * 1024;
+
+const int BATCH_MORE = 0;
+const int BATCH_PARKED = 1;
+const int BATCH_DONE = 2;
+
+// POST /batch：multipart/form-data上传多张图片，边接收边解析，
+// 每个part接收完就提交到compute lane处理，结果按完成顺序以chunked的multipart/mixed流式返回。
+class BatchRequest: public BodyHandler, public MultipartHandler, public std::enable_shared_from_this<BatchRequest>
+{
+private:
+    MultipartParser parser;
+    EncodeOptions enc;
+    int width;
+    int height;
+    // 响应的multipart/mixed分隔符
+    std::string boundary;
+
+    // 一个part的数据。小的放在内存里，按申请的容量计入body内存预算；
+    // 超过body的落盘阈值后搬到临时文件映射，和大body一样不占预算。
+    // 计算线程处理完就释放，连接关闭时还没开始的part也随最后一个引用释放
+    struct PartData: noncopyable
+    {
+        std::string bytes;
+        BodySpool spool;
+        size_t charged;
+        PartData(): charged(0) {}
+        ~PartData();
+        void append(const char *data_, size_t len);
+        const char *data() const
+        {
+            return spool.active() ? spool.data() : bytes.data();
+        }
+        size_t size() const
+        {
+            return spool.active() ? spool.size() : bytes.size();
+        }
+    };
+
+    // 正在接收的part，只在连接的处理线程上访问
+    int parts;
+    std::shared_ptr<PartData> data;
+    std::string disposition;
+    bool tooLarge;
+    bool failed;
+
+    // 已经按chunked编码好、等待发送的结果。
+    // 图片数据不拷贝，由owner持有，发送时挂到输出缓冲区上
+    struct Part
+    {
+        std::string head;
+        std::shared_ptr<const void> owner;
+        const char *body;
+        size_t len;
+    };
+
+    MutexLock lock;
+    std::deque<Part> ready;
+    int finished;
+    bool ended;
+    bool responding;
+    // 没有结果可发时挂起的连接，下一个结果完成时唤醒
+    reqPtr waiter;
+    std::atomic<bool> cancelled;
+
+    void process(int index, const std::string &disposition_, std::shared_ptr<PartData> data_);
+    // owner为空时拷贝body
+    void complete(int index, const std::string &disposition_, int code, const std::string &type,
+        const char *body, size_t len, const std::shared_ptr<const void> &owner = std::shared_ptr<const void>());
+
+public:
+    BatchRequest(const std::string &boundary_, const EncodeOptions &enc_, int width_, int height_);
+
+    // 接收阶段：body交给multipart解析器，每个part接收完就提交计算
+    int onBody(const char *data_, size_t len);
+    int onBodyEnd();
+    // body接收完，开始发送响应，返回响应的Content-Type
+    std::string respond();
+    bool isResponding()
+    {
+        MutexLockGuard guard(lock);
+        return responding;
+    }
+    // 把已完成的结果追加到out。没有结果时拿走self的所有权挂起并返回BATCH_PARKED，
+    // 全部发完时追加结束标记并返回BATCH_DONE
+    int take(Buffer &out, reqPtr &self);
+    // 正在接收、还没交给计算线程的part占用的预算
+    size_t heldBudget() const
+    {
+        return data ? data->charged : 0;
+    }
+    // 连接关闭，还没开始的计算直接跳过
+    void cancel()
+    {
+        cancelled = true;
+    }
+
+    void onPartBegin(const HeaderMap &headers);
+    void onPartData(const char *data_, size_t len);
+    void onPartEnd();
+};
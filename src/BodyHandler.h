@@ -0,0 +1,18 @@
+#pragma once
+#include <stddef.h>
+
+const int BODY_ERROR = -1;
+
+// 流式接收请求body：数据一到就交给handler(可以边收边哈希、解码或者转发)，
+// 不需要等整个body收完。Content-length和chunked编码的body都经过这里，
+// handler看到的始终是去掉分块框架之后的数据
+class BodyHandler
+{
+public:
+    virtual ~BodyHandler() {}
+    // 返回消费的字节数；数据不够解析时可以少消费，剩下的和之后到达的数据一起再交给handler。
+    // 出错返回BODY_ERROR
+    virtual int onBody(const char *data, size_t len) = 0;
+    // body全部到达，内容不完整时返回BODY_ERROR
+    virtual int onBodyEnd() = 0;
+};
@@ -0,0 +1,217 @@
+#include "BodySpool.h"
+#include "Logger.h"
+#include "RequestData.h"
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <vector>
+
+#ifndef O_TMPFILE
+#define O_TMPFILE (020000000 | O_DIRECTORY)
+#endif
+
+BodySpool::BodySpool():
+    fd(-1),
+    map(NULL),
+    length(0),
+    received(0),
+    flushed(0)
+{
+}
+
+BodySpool::~BodySpool()
+{
+    close();
+}
+
+int BodySpool::open(size_t length_)
+{
+    close();
+    fd = ::open(BODY_SPOOL_DIR, O_TMPFILE | O_RDWR | O_CLOEXEC, 0600);
+    if (fd < 0)
+    {
+        // 文件系统不支持O_TMPFILE，建好后立即删除
+        std::string tmpl = std::string(BODY_SPOOL_DIR) + "/body-XXXXXX";
+        std::vector<char> path(tmpl.begin(), tmpl.end());
+        path.push_back('\0');
+        fd = mkstemp(&path[0]);
+        if (fd < 0)
+        {
+            LOG_ERROR("spool mkstemp: %m");
+            return -1;
+        }
+        unlink(&path[0]);
+    }
+    if (ftruncate(fd, length_) < 0)
+    {
+        LOG_ERROR("spool ftruncate: %m");
+        close();
+        return -1;
+    }
+    void *p = mmap(NULL, length_, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (p == MAP_FAILED)
+    {
+        LOG_ERROR("spool mmap: %m");
+        close();
+        return -1;
+    }
+    map = static_cast<char*>(p);
+    length = length_;
+    received = flushed = 0;
+    return 0;
+}
+
+void BodySpool::close()
+{
+    if (map != NULL)
+        munmap(map, length);
+    if (fd >= 0)
+        ::close(fd);
+    fd = -1;
+    map = NULL;
+    length = received = flushed = 0;
+}
+
+void BodySpool::flush()
+{
+    if (received - flushed >= BODY_SPOOL_FLUSH || (received == length && received > flushed))
+    {
+        sync_file_range(fd, flushed, received - flushed, SYNC_FILE_RANGE_WRITE);
+        flushed = received;
+    }
+}
+
+void BodySpool::append(const char *data_, size_t len)
+{
+    if (len > length - received)
+        len = length - received;
+    memcpy(map + received, data_, len);
+    received += len;
+    flush();
+}
+
+ssize_t BodySpool::readFd(int sock)
+{
+    ssize_t readSum = 0;
+    while (received < length)
+    {
+        ssize_t n = read(sock, map + received, length - received);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            else if (errno == EAGAIN)
+                break;
+            LOG_DEBUG("spool read fd %d: %m", sock);
+            return -1;
+        }
+        else if (n == 0)
+            break;
+        received += n;
+        readSum += n;
+        flush();
+    }
+    return readSum;
+}
+
+MutexLock BodyBudget::lock;
+std::deque<BodyBudget::Waiter> BodyBudget::waiters;
+size_t BodyBudget::budget = BODY_BUDGET_BYTES;
+size_t BodyBudget::inFlight = 0;
+size_t BodyBudget::parkedHeld = 0;
+size_t BodyBudget::maxBody = BODY_MAX_BYTES;
+
+void BodyBudget::setLimits(size_t maxBody_, size_t budget_)
+{
+    MutexLockGuard guard(lock);
+    maxBody = maxBody_ < BODY_MAX_LIMIT ? maxBody_ : BODY_MAX_LIMIT;
+    budget = budget_;
+}
+
+size_t BodyBudget::getMaxBody()
+{
+    return maxBody;
+}
+
+size_t BodyBudget::spoolThreshold()
+{
+    return budget < BODY_SPOOL_BYTES ? budget : BODY_SPOOL_BYTES;
+}
+
+bool BodyBudget::acquire(size_t bytes, reqPtr &req, size_t held)
+{
+    {
+        MutexLockGuard guard(lock);
+        // 有人在排队时不插队；没有别的body在内存中时总是放行，单个body不会永远等下去
+        if (waiters.empty() && (inFlight == held || inFlight + bytes <= budget))
+        {
+            inFlight += bytes;
+            return true;
+        }
+    }
+    Waiter w;
+    w.bytes = bytes;
+    w.held = held;
+    w.req = std::move(req);
+    std::vector<Waiter> ready;
+    {
+        MutexLockGuard guard(lock);
+        parkedHeld += held;
+        waiters.push_back(std::move(w));
+        // 在途的可能全是排队连接占着的，没有别人会再调用release
+        admit(ready);
+    }
+    for (size_t i = 0; i < ready.size(); ++i)
+        RequestData::resumeBody(std::move(ready[i].req), ready[i].bytes);
+    return false;
+}
+
+void BodyBudget::admit(std::vector<Waiter> &ready)
+{
+    // 在途的只剩排队连接占着的部分时放行队首
+    while (!waiters.empty() && (inFlight == parkedHeld || inFlight + waiters.front().bytes <= budget))
+    {
+        inFlight += waiters.front().bytes;
+        parkedHeld -= waiters.front().held;
+        ready.push_back(std::move(waiters.front()));
+        waiters.pop_front();
+    }
+}
+
+void BodyBudget::charge(size_t bytes)
+{
+    if (bytes == 0)
+        return;
+    MutexLockGuard guard(lock);
+    inFlight += bytes;
+}
+
+bool BodyBudget::overBudget()
+{
+    MutexLockGuard guard(lock);
+    return !waiters.empty() || inFlight > budget;
+}
+
+void BodyBudget::release(size_t bytes)
+{
+    if (bytes == 0)
+        return;
+    std::vector<Waiter> ready;
+    {
+        MutexLockGuard guard(lock);
+        inFlight -= bytes;
+        admit(ready);
+    }
+    for (size_t i = 0; i < ready.size(); ++i)
+        RequestData::resumeBody(std::move(ready[i].req), ready[i].bytes);
+}
+
+size_t BodyBudget::used()
+{
+    MutexLockGuard guard(lock);
+    return inFlight;
+}
@@ -0,0 +1,107 @@
+#pragma once
+#include "nocopyable.h"
+#include "MutexLock.h"
+#include "RequestPtr.h"
+#include <string>
+#include <deque>
+#include <vector>
+#include <memory>
+#include <sys/types.h>
+#include <limits.h>
+
+// 默认单个请求body的上限，超过返回413
+const size_t BODY_MAX_BYTES = 256 * 1024 * 1024;
+// 图像处理按int记长度，-b不能超过这个值
+const size_t BODY_MAX_LIMIT = INT_MAX;
+// 默认所有连接放在内存里的body总量上限
+const size_t BODY_BUDGET_BYTES = 128 * 1024 * 1024;
+// body超过这个大小就写到临时文件，不占用内存预算
+const size_t BODY_SPOOL_BYTES = 8 * 1024 * 1024;
+// 临时文件的目录，需要在磁盘上(tmpfs的页没有地方回写)
+const char BODY_SPOOL_DIR[] = "/var/tmp";
+// 临时文件每写这么多就开始异步回写，脏页不会越积越多
+const size_t BODY_SPOOL_FLUSH = 4 * 1024 * 1024;
+
+class RequestData;
+
+// 大的请求body：映射一个已删除的临时文件，socket数据直接读进映射区，
+// 处理时当作一块连续内存使用。文件页可以回写和回收，不计入常驻的匿名内存
+class BodySpool: noncopyable
+{
+private:
+    int fd;
+    char *map;
+    size_t length;
+    size_t received;
+    size_t flushed;
+
+    void flush();
+
+public:
+    BodySpool();
+    ~BodySpool();
+
+    // 建立length字节的临时文件映射，失败返回-1
+    int open(size_t length_);
+    void close();
+    bool active() const
+    {
+        return map != NULL;
+    }
+    const char *data() const
+    {
+        return map;
+    }
+    size_t size() const
+    {
+        return received;
+    }
+    bool full() const
+    {
+        return received == length;
+    }
+    // 已经读进缓冲区的那部分body
+    void append(const char *data_, size_t len);
+    // 从socket读到映射区，读满或者EAGAIN为止，语义同readn
+    ssize_t readFd(int sock);
+};
+
+// 内存中body的全局预算。超过预算时连接暂停读(不在epoll中，也没有定时器)，
+// 按先来先到排队，有body释放时由释放的线程唤醒
+class BodyBudget
+{
+private:
+    struct Waiter
+    {
+        size_t bytes;
+        // 挂起时仍然占着的预算(接收到一半的批量part)
+        size_t held;
+        reqPtr req;
+    };
+    static MutexLock lock;
+    static std::deque<Waiter> waiters;
+    static size_t budget;
+    static size_t inFlight;
+    // 排队的连接占着的预算，在途的全是这部分时队首总能放行，挂起的连接不会互相等
+    static size_t parkedHeld;
+    static size_t maxBody;
+    BodyBudget();
+    BodyBudget(const BodyBudget &b);
+    // 持有lock时调用，把可以放行的排队连接移到ready，解锁后再唤醒
+    static void admit(std::vector<Waiter> &ready);
+
+public:
+    static void setLimits(size_t maxBody_, size_t budget_);
+    static size_t getMaxBody();
+    // 超过这个大小的body写临时文件，不超过预算
+    static size_t spoolThreshold();
+    // 预算足够时记账并返回true；否则拿走req的所有权挂到队尾，轮到时调用RequestData::resumeBody
+    // held是连接挂起期间仍然占着的预算
+    static bool acquire(size_t bytes, reqPtr &req, size_t held = 0);
+    // 不等待直接记账，用于边接收边缓存的数据(批量上传的part)，调用方用overBudget决定是否暂停读
+    static void charge(size_t bytes);
+    static void release(size_t bytes);
+    // 超过预算或者有连接在排队
+    static bool overBudget();
+    static size_t used();
+};
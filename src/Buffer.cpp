@@ -0,0 +1,346 @@
+#include "Buffer.h"
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/uio.h>
+
+thread_local BufferChunk *ChunkPool::freeList = NULL;
+thread_local size_t ChunkPool::freeCount = 0;
+
+static BufferChunk *newChunk(size_t capacity, bool pooled)
+{
+    // 块头和数据区一次申请
+    BufferChunk *chunk = static_cast<BufferChunk*>(malloc(sizeof(BufferChunk) + capacity));
+    if (chunk == NULL)
+        abort();
+    chunk->next = NULL;
+    chunk->data = reinterpret_cast<char*>(chunk + 1);
+    chunk->capacity = capacity;
+    chunk->readIdx = chunk->writeIdx = 0;
+    chunk->pooled = pooled;
+    chunk->owner = NULL;
+    return chunk;
+}
+
+BufferChunk *ChunkPool::get()
+{
+    if (freeList == NULL)
+        return newChunk(BUFFER_CHUNK_SIZE, true);
+    BufferChunk *chunk = freeList;
+    freeList = chunk->next;
+    --freeCount;
+    chunk->next = NULL;
+    chunk->readIdx = chunk->writeIdx = 0;
+    return chunk;
+}
+
+BufferChunk *ChunkPool::getLarge(size_t capacity)
+{
+    if (capacity <= BUFFER_CHUNK_SIZE)
+        return get();
+    return newChunk(capacity, false);
+}
+
+void ChunkPool::put(BufferChunk *chunk)
+{
+    if (chunk->owner)
+        delete chunk->owner;
+    if (!chunk->pooled || freeCount >= BUFFER_POOL_MAX_CHUNKS)
+    {
+        free(chunk);
+        return;
+    }
+    chunk->next = freeList;
+    freeList = chunk;
+    ++freeCount;
+}
+
+Buffer::Buffer():
+    head(NULL),
+    tail(NULL),
+    readable(0)
+{
+}
+
+Buffer::~Buffer()
+{
+    clear();
+}
+
+void Buffer::pushBack(BufferChunk *chunk)
+{
+    chunk->next = NULL;
+    if (tail)
+        tail->next = chunk;
+    else
+        head = chunk;
+    tail = chunk;
+}
+
+const char *Buffer::peek() const
+{
+    if (head == NULL)
+        return NULL;
+    return head->data + head->readIdx;
+}
+
+size_t Buffer::contiguousSize() const
+{
+    if (head == NULL)
+        return 0;
+    return head->writeIdx - head->readIdx;
+}
+
+const char *Buffer::linearize(size_t n)
+{
+    if (n > readable)
+        n = readable;
+    if (n == 0 || contiguousSize() >= n)
+        return peek();
+    if (n <= head->capacity && head->owner == NULL)
+    {
+        // 首块放得下，把首块数据挪到开头，再从后面的块搬数据过来
+        size_t len = head->writeIdx - head->readIdx;
+        memmove(head->data, head->data + head->readIdx, len);
+        head->readIdx = 0;
+        head->writeIdx = len;
+        while (head->writeIdx < n)
+        {
+            BufferChunk *next = head->next;
+            size_t m = next->writeIdx - next->readIdx;
+            if (m > n - head->writeIdx)
+                m = n - head->writeIdx;
+            memcpy(head->data + head->writeIdx, next->data + next->readIdx, m);
+            head->writeIdx += m;
+            next->readIdx += m;
+            if (next->readIdx == next->writeIdx)
+            {
+                head->next = next->next;
+                if (tail == next)
+                    tail = head;
+                ChunkPool::put(next);
+            }
+        }
+        return peek();
+    }
+    // 首块放不下，申请一个能容纳n个字节的块放到最前面
+    BufferChunk *chunk = ChunkPool::getLarge(n);
+    size_t copied = 0;
+    while (copied < n)
+    {
+        size_t m = head->writeIdx - head->readIdx;
+        if (m > n - copied)
+            m = n - copied;
+        memcpy(chunk->data + copied, head->data + head->readIdx, m);
+        copied += m;
+        head->readIdx += m;
+        if (head->readIdx == head->writeIdx)
+        {
+            BufferChunk *next = head->next;
+            ChunkPool::put(head);
+            head = next;
+        }
+    }
+    chunk->writeIdx = n;
+    chunk->next = head;
+    if (head == NULL)
+        tail = chunk;
+    head = chunk;
+    return peek();
+}
+
+void Buffer::reserve(size_t n)
+{
+    if (n <= readable)
+    {
+        linearize(n);
+        return;
+    }
+    if (head != NULL && head == tail && head->capacity >= n && head->owner == NULL)
+    {
+        if (head->capacity - head->readIdx < n)
+        {
+            size_t len = head->writeIdx - head->readIdx;
+            memmove(head->data, head->data + head->readIdx, len);
+            head->readIdx = 0;
+            head->writeIdx = len;
+        }
+        return;
+    }
+    // 已经收到的部分搬到新块的开头，剩下的由readFd直接读进来
+    BufferChunk *chunk = ChunkPool::getLarge(n);
+    size_t len = readable;
+    size_t copied = 0;
+    for (BufferChunk *p = head; p; p = p->next)
+    {
+        memcpy(chunk->data + copied, p->data + p->readIdx, p->writeIdx - p->readIdx);
+        copied += p->writeIdx - p->readIdx;
+    }
+    clear();
+    chunk->writeIdx = len;
+    pushBack(chunk);
+    readable = len;
+}
+
+int Buffer::find(char c, size_t from) const
+{
+    size_t base = 0;
+    for (BufferChunk *chunk = head; chunk; chunk = chunk->next)
+    {
+        size_t len = chunk->writeIdx - chunk->readIdx;
+        if (from < base + len)
+        {
+            size_t off = from > base ? from - base : 0;
+            const char *begin = chunk->data + chunk->readIdx;
+            const void *p = memchr(begin + off, c, len - off);
+            if (p)
+                return static_cast<int>(base + (static_cast<const char*>(p) - begin));
+        }
+        base += len;
+    }
+    return -1;
+}
+
+void Buffer::retrieve(size_t n)
+{
+    if (n >= readable)
+    {
+        clear();
+        return;
+    }
+    readable -= n;
+    while (n > 0)
+    {
+        size_t len = head->writeIdx - head->readIdx;
+        if (n < len)
+        {
+            head->readIdx += n;
+            break;
+        }
+        n -= len;
+        BufferChunk *next = head->next;
+        ChunkPool::put(head);
+        head = next;
+    }
+    if (head == NULL)
+        tail = NULL;
+}
+
+void Buffer::clear()
+{
+    while (head)
+    {
+        BufferChunk *next = head->next;
+        ChunkPool::put(head);
+        head = next;
+    }
+    tail = NULL;
+    readable = 0;
+}
+
+void Buffer::append(const char *data, size_t len)
+{
+    readable += len;
+    while (len > 0)
+    {
+        if (tail == NULL || tail->writeIdx == tail->capacity)
+            pushBack(ChunkPool::get());
+        size_t m = tail->capacity - tail->writeIdx;
+        if (m > len)
+            m = len;
+        memcpy(tail->data + tail->writeIdx, data, m);
+        tail->writeIdx += m;
+        data += m;
+        len -= m;
+    }
+}
+
+void Buffer::append(const std::string &str)
+{
+    append(str.data(), str.size());
+}
+
+void Buffer::append(const char *str)
+{
+    append(str, strlen(str));
+}
+
+void Buffer::appendRef(const std::shared_ptr<const void> &owner, const char *data, size_t len)
+{
+    if (len < BUFFER_REF_MIN)
+    {
+        append(data, len);
+        return;
+    }
+    // 只申请块头，capacity等于writeIdx，之后的append不会写进外部数据
+    BufferChunk *chunk = newChunk(0, false);
+    chunk->data = const_cast<char*>(data);
+    chunk->capacity = chunk->writeIdx = len;
+    chunk->owner = new std::shared_ptr<const void>(owner);
+    pushBack(chunk);
+    readable += len;
+}
+
+ssize_t Buffer::readFd(int fd, int *savedErrno)
+{
+    struct iovec vec[2];
+    int cnt = 0;
+    size_t writable = tail ? tail->capacity - tail->writeIdx : 0;
+    if (writable > 0)
+    {
+        vec[cnt].iov_base = tail->data + tail->writeIdx;
+        vec[cnt].iov_len = writable;
+        ++cnt;
+    }
+    BufferChunk *extra = ChunkPool::get();
+    vec[cnt].iov_base = extra->data;
+    vec[cnt].iov_len = extra->capacity;
+    ++cnt;
+    ssize_t n = readv(fd, vec, cnt);
+    if (n < 0)
+    {
+        *savedErrno = errno;
+        ChunkPool::put(extra);
+        return n;
+    }
+    if (n == 0)
+        ChunkPool::put(extra);
+    else if (static_cast<size_t>(n) <= writable)
+    {
+        tail->writeIdx += n;
+        ChunkPool::put(extra);
+    }
+    else
+    {
+        if (writable > 0)
+            tail->writeIdx = tail->capacity;
+        extra->writeIdx = n - writable;
+        pushBack(extra);
+    }
+    readable += n;
+    return n;
+}
+
+ssize_t Buffer::writeFd(int fd, int *savedErrno)
+{
+    const int MAX_IOV = 64;
+    struct iovec vec[MAX_IOV];
+    int cnt = 0;
+    for (BufferChunk *chunk = head; chunk && cnt < MAX_IOV; chunk = chunk->next)
+    {
+        vec[cnt].iov_base = chunk->data + chunk->readIdx;
+        vec[cnt].iov_len = chunk->writeIdx - chunk->readIdx;
+        ++cnt;
+    }
+    if (cnt == 0)
+        return 0;
+    ssize_t n = writev(fd, vec, cnt);
+    if (n < 0)
+    {
+        *savedErrno = errno;
+        return n;
+    }
+    retrieve(n);
+    return n;
+}
@@ -0,0 +1,87 @@
+#pragma once
+#include "nocopyable.h"
+#include <string>
+#include <memory>
+#include <sys/types.h>
+
+// 缓冲区按固定大小的块组织，块来自每个线程自己的空闲链表
+const size_t BUFFER_CHUNK_SIZE = 16 * 1024;
+// 每个线程最多缓存的空闲块数，超过的直接释放
+const size_t BUFFER_POOL_MAX_CHUNKS = 256;
+// appendRef引用外部数据的下限，更小的直接拷贝
+const size_t BUFFER_REF_MIN = 4096;
+
+struct BufferChunk
+{
+    BufferChunk *next;
+    char *data;
+    size_t capacity;
+    size_t readIdx;
+    size_t writeIdx;
+    // 标准大小的块可以回收到池中，linearize申请的大块用完直接释放
+    bool pooled;
+    // 非空时data指向外部只读数据，块释放时才放开owner
+    std::shared_ptr<const void> *owner;
+};
+
+class ChunkPool
+{
+private:
+    static thread_local BufferChunk *freeList;
+    static thread_local size_t freeCount;
+    ChunkPool();
+    ChunkPool(const ChunkPool &c);
+
+public:
+    static BufferChunk *get();
+    static BufferChunk *getLarge(size_t capacity);
+    static void put(BufferChunk *chunk);
+};
+
+class Buffer: noncopyable
+{
+private:
+    BufferChunk *head;
+    BufferChunk *tail;
+    size_t readable;
+
+    void pushBack(BufferChunk *chunk);
+
+public:
+    Buffer();
+    ~Buffer();
+
+    size_t size() const
+    {
+        return readable;
+    }
+    bool empty() const
+    {
+        return readable == 0;
+    }
+    // 可读数据的起始位置，只保证第一个块内的contiguousSize()个字节连续
+    const char *peek() const;
+    size_t contiguousSize() const;
+    // 保证前n个字节连续存放并返回起始地址
+    const char *linearize(size_t n);
+    // 预留空间，保证从peek()开始的n个字节(包括之后读入的)连续存放，
+    // 已知body长度时调用，之后readFd直接读进这块连续内存
+    void reserve(size_t n);
+    // 在可读数据中查找字符，返回相对peek()的偏移，找不到返回-1
+    int find(char c, size_t from = 0) const;
+    // 消费n个字节，只移动下标，读空的块还给池
+    void retrieve(size_t n);
+    void clear();
+
+    void append(const char *data, size_t len);
+    void append(const std::string &str);
+    // 字面量不用先构造std::string
+    void append(const char *str);
+    // 不拷贝，直接引用owner持有的数据，发送完之前owner不会释放
+    void appendRef(const std::shared_ptr<const void> &owner, const char *data, size_t len);
+
+    // readv直接读到尾块的空闲空间，不够时溢出到新取的块
+    ssize_t readFd(int fd, int *savedErrno);
+    // writev一次发送多个块
+    ssize_t writeFd(int fd, int *savedErrno);
+};
@@ -0,0 +1,124 @@
+#include "ChunkedDecoder.h"
+
+ChunkedDecoder::ChunkedDecoder()
+{
+    reset();
+}
+
+void ChunkedDecoder::reset()
+{
+    state = sSize;
+    remaining = 0;
+    lineLen = 0;
+    digits = false;
+}
+
+static int hexValue(char c)
+{
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    if (c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F')
+        return c - 'A' + 10;
+    return -1;
+}
+
+int ChunkedDecoder::step(char c)
+{
+    if (++lineLen > CHUNKED_MAX_LINE)
+        return -1;
+    switch (state)
+    {
+        case sSize:
+        {
+            int v = hexValue(c);
+            if (v >= 0)
+            {
+                // 块大小不超过2^40，避免溢出
+                if (remaining >> 40)
+                    return -1;
+                remaining = remaining * 16 + v;
+                digits = true;
+            }
+            else if (!digits)
+                return -1;
+            else if (c == ';' || c == ' ' || c == '\t')
+                state = sExt;
+            else if (c == '\r')
+                state = sSizeLF;
+            else
+                return -1;
+            break;
+        }
+        case sExt:
+            // 块扩展直接忽略
+            if (c == '\r')
+                state = sSizeLF;
+            break;
+        case sSizeLF:
+            if (c != '\n')
+                return -1;
+            lineLen = 0;
+            state = remaining == 0 ? sTrailer : sData;
+            break;
+        case sDataCR:
+            if (c != '\r')
+                return -1;
+            state = sDataLF;
+            break;
+        case sDataLF:
+            if (c != '\n')
+                return -1;
+            lineLen = 0;
+            digits = false;
+            state = sSize;
+            break;
+        case sTrailer:
+            state = c == '\r' ? sEndLF : sTrailerLine;
+            break;
+        case sTrailerLine:
+            // trailer头部不使用
+            if (c == '\n')
+            {
+                lineLen = 0;
+                state = sTrailer;
+            }
+            break;
+        case sEndLF:
+            if (c != '\n')
+                return -1;
+            state = sDone;
+            break;
+        default:
+            return -1;
+    }
+    return 0;
+}
+
+int ChunkedDecoder::decode(Buffer &in, Buffer &out)
+{
+    while (!in.empty() && state != sDone)
+    {
+        const char *p = in.peek();
+        size_t len = in.contiguousSize();
+        if (state == sData)
+        {
+            size_t m = len < remaining ? len : remaining;
+            out.append(p, m);
+            in.retrieve(m);
+            remaining -= m;
+            if (remaining == 0)
+                state = sDataCR;
+            continue;
+        }
+        size_t i = 0;
+        while (i < len && state != sData && state != sDone)
+        {
+            if (step(p[i++]) < 0)
+                return -1;
+        }
+        in.retrieve(i);
+    }
+    return 0;
+}
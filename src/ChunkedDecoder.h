@@ -0,0 +1,42 @@
+#pragma once
+#include "Buffer.h"
+#include <stddef.h>
+
+// 块大小行、trailer行的最大长度
+const size_t CHUNKED_MAX_LINE = 1024;
+
+// Transfer-Encoding: chunked的请求body解码，数据到多少解码多少
+class ChunkedDecoder
+{
+private:
+    enum State
+    {
+        sSize = 0,
+        sExt,
+        sSizeLF,
+        sData,
+        sDataCR,
+        sDataLF,
+        sTrailer,
+        sTrailerLine,
+        sEndLF,
+        sDone
+    };
+    State state;
+    size_t remaining;
+    size_t lineLen;
+    bool digits;
+
+    int step(char c);
+
+public:
+    ChunkedDecoder();
+    void reset();
+    // 从in中去掉块框架，块数据追加到out，出错返回-1
+    int decode(Buffer &in, Buffer &out);
+    // 最后一个块和trailer都已经解析完
+    bool done() const
+    {
+        return state == sDone;
+    }
+};
@@ -0,0 +1,90 @@
+#include "Compute.h"
+#include "MutexLock.h"
+#include "Condition.h"
+#include <atomic>
+#include <memory>
+
+TaskLane Compute::lane("compute");
+int Compute::thread_count = 0;
+
+int Compute::init(int thread_count_)
+{
+    if (lane.start(thread_count_, COMPUTE_QUEUE_SIZE) < 0)
+        return -1;
+    thread_count = thread_count_;
+    return 0;
+}
+
+int Compute::threads()
+{
+    return thread_count;
+}
+
+int Compute::post(const std::function<void()> &task)
+{
+    return lane.add(task);
+}
+
+namespace
+{
+struct ParallelState
+{
+    ParallelState(int n_, const std::function<void(int)> &fn_):
+        next(0),
+        n(n_),
+        finished(0),
+        fn(fn_),
+        cond(lock)
+    {
+    }
+    std::atomic<int> next;
+    int n;
+    int finished;
+    std::function<void(int)> fn;
+    MutexLock lock;
+    Condition cond;
+};
+
+// 不断领取下标执行，直到全部领完
+void drain(ParallelState &state)
+{
+    int done = 0;
+    int i;
+    while ((i = state.next.fetch_add(1)) < state.n)
+    {
+        state.fn(i);
+        ++done;
+    }
+    if (done > 0)
+    {
+        MutexLockGuard locker(state.lock);
+        state.finished += done;
+        if (state.finished == state.n)
+            state.cond.notifyAll();
+    }
+}
+}
+
+void Compute::parallelFor(int n, const std::function<void(int)> &fn)
+{
+    if (n <= 0)
+        return;
+    if (n == 1 || thread_count == 0)
+    {
+        for (int i = 0; i < n; ++i)
+            fn(i);
+        return;
+    }
+    std::shared_ptr<ParallelState> state(new ParallelState(n, fn));
+    int helpers = n - 1 < thread_count ? n - 1 : thread_count;
+    for (int i = 0; i < helpers; ++i)
+    {
+        // 排队很久才被执行的helper领不到下标会直接返回
+        if (lane.add([state]() { drain(*state); }) < 0)
+            break;
+    }
+    drain(*state);
+    MutexLockGuard locker(state->lock);
+    while (state->finished < state->n)
+        state->cond.wait();
+}
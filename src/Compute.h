@@ -0,0 +1,24 @@
+#pragma once
+#include "TaskLane.h"
+#include <functional>
+
+const int COMPUTE_QUEUE_SIZE = 4096;
+
+// 图像计算用的线程(compute lane)，和处理连接的ThreadPool分开
+class Compute
+{
+private:
+    static TaskLane lane;
+    static int thread_count;
+    Compute();
+    Compute(const Compute &c);
+
+public:
+    static int init(int thread_count_);
+    static int threads();
+    // 并行执行fn(0) ... fn(n - 1)并等待全部完成，调用线程也参与执行，
+    // 计算线程忙或者没有启动时退化为在调用线程上顺序执行
+    static void parallelFor(int n, const std::function<void(int)> &fn);
+    // 提交一个异步任务
+    static int post(const std::function<void()> &task);
+};
@@ -1,6 +1,6 @@
 #pragma once
-#include "nocopyable.hpp"
-#include "mutexLock.hpp"
+#include "nocopyable.h"
+#include "MutexLock.h"
 #include <pthread.h>
 
 class Condition: noncopyable
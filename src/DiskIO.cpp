@@ -0,0 +1,118 @@
+#include "DiskIO.h"
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <errno.h>
+#include <stdint.h>
+#include <atomic>
+#include <vector>
+
+#ifndef __NR_cachestat
+#define __NR_cachestat 451
+#endif
+
+TaskLane DiskIO::lane("disk");
+
+namespace
+{
+struct CacheStatRange
+{
+    uint64_t off;
+    uint64_t len;
+};
+
+struct CacheStat
+{
+    uint64_t nrCache;
+    uint64_t nrDirty;
+    uint64_t nrWriteback;
+    uint64_t nrEvicted;
+    uint64_t nrRecentlyEvicted;
+};
+
+// 内核不支持cachestat时记下来，以后直接走mincore
+std::atomic<bool> noCachestat(false);
+
+bool residentMincore(int fd, off_t offset, size_t len)
+{
+    static const long page_size = sysconf(_SC_PAGESIZE);
+    off_t start = offset & ~(page_size - 1);
+    size_t map_len = len + (offset - start);
+    void *addr = mmap(NULL, map_len, PROT_READ, MAP_SHARED, fd, start);
+    if (addr == MAP_FAILED)
+        return true;
+    size_t pages = (map_len + page_size - 1) / page_size;
+    // 单个窗口最多256页，放在栈上
+    unsigned char vec[DISK_WARM_WINDOW / 4096 + 2];
+    bool ret = true;
+    if (pages > sizeof(vec) || mincore(addr, map_len, vec) < 0)
+        ret = true;
+    else
+    {
+        for (size_t i = 0; i < pages; ++i)
+        {
+            if (!(vec[i] & 1))
+            {
+                ret = false;
+                break;
+            }
+        }
+    }
+    munmap(addr, map_len);
+    return ret;
+}
+}
+
+int DiskIO::init(int thread_count)
+{
+    return lane.start(thread_count, DISK_QUEUE_SIZE);
+}
+
+bool DiskIO::resident(int fd, off_t offset, size_t len)
+{
+    if (len < DISK_RESIDENT_MIN)
+        return true;
+    if (!noCachestat.load(std::memory_order_relaxed))
+    {
+        static const long page_size = sysconf(_SC_PAGESIZE);
+        CacheStatRange range = { static_cast<uint64_t>(offset), len };
+        CacheStat cs;
+        if (syscall(__NR_cachestat, fd, &range, &cs, 0) == 0)
+        {
+            uint64_t pages = (offset + len - 1) / page_size - offset / page_size + 1;
+            return cs.nrCache >= pages;
+        }
+        if (errno != ENOSYS)
+            return true;
+        noCachestat.store(true, std::memory_order_relaxed);
+    }
+    return residentMincore(fd, offset, len);
+}
+
+int DiskIO::warm(int fd, off_t offset, size_t len, const std::function<void()> &done)
+{
+    return lane.add([fd, offset, len, done]()
+    {
+        // 先发出异步预读，再顺序读一遍，读完时页一定已经在page cache中
+        posix_fadvise(fd, offset, len, POSIX_FADV_WILLNEED);
+        static thread_local std::vector<char> scratch(128 * 1024);
+        off_t pos = offset;
+        size_t left = len;
+        while (left > 0)
+        {
+            size_t n = left < scratch.size() ? left : scratch.size();
+            ssize_t nread = pread(fd, &scratch[0], n, pos);
+            if (nread <= 0)
+                break;
+            pos += nread;
+            left -= nread;
+        }
+        done();
+    });
+}
+
+int DiskIO::post(const std::function<void()> &task)
+{
+    return lane.add(task);
+}
@@ -0,0 +1,30 @@
+#pragma once
+#include "TaskLane.h"
+#include <functional>
+#include <sys/types.h>
+
+// 每次检查/预读的文件区间大小
+const size_t DISK_WARM_WINDOW = 1024 * 1024;
+// 比这小的区间不检查，直接sendfile：热的小文件(index.html等)不多付系统调用，冷的也只是一次小的读
+const size_t DISK_RESIDENT_MIN = 64 * 1024;
+const int DISK_QUEUE_SIZE = 4096;
+
+// 冷文件的页不在page cache中时，sendfile会在工作线程上等磁盘，
+// 这里先检查区间是否驻留，不驻留就交给磁盘线程把它读进page cache
+class DiskIO
+{
+private:
+    static TaskLane lane;
+    DiskIO();
+    DiskIO(const DiskIO &d);
+
+public:
+    static int init(int thread_count);
+    // [offset, offset + len) 的页是否全部在page cache中。
+    // 优先用cachestat(2)，一次系统调用，不映射文件；老内核上退回mmap + mincore
+    static bool resident(int fd, off_t offset, size_t len);
+    // 在磁盘线程上读入区间，完成后在磁盘线程上调用done；返回非0表示没有提交成功
+    static int warm(int fd, off_t offset, size_t len, const std::function<void()> &done);
+    // 其它需要写磁盘的零散工作(调试转储等)
+    static int post(const std::function<void()> &task);
+};
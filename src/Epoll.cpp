@@ -1,34 +1,51 @@
 #include "Epoll.h"
+#include "Logger.h"
+#include "Metrics.h"
+#include "Trace.h"
+#include "Probes.h"
 #include "ThreadPool.h"
 #include "util.h"
+#include "SocketOpt.h"
+#include "JobStore.h"
+#include "RequestPool.h"
 #include <sys/epoll.h>
 #include <errno.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <string.h>
+#include <fcntl.h>
 #include <queue>
 #include <deque>
 #include <arpa/inet.h>
-#include <iostream>
 using namespace std;
 
 int TIMER_TIME_OUT = 500;
 
+int Epoll::maxFds = 0;
 epoll_event *Epoll::events;
-Epoll::reqPtr Epoll::requests[MAXFDS];
+reqPtr *Epoll::requests;
+IdleConn *Epoll::idle;
+std::atomic<int> Epoll::idleCount(0);
+MutexLock Epoll::idleLock;
+int Epoll::idleHead = -1;
+int Epoll::idleTail = -1;
 int Epoll::epoll_fd = 0;
 const std::string Epoll::path = "/";
+TimerManager *Epoll::timer_manager;
 
-TimerManager Epoll::timer_manager;
 
-
-int Epoll::epollInit(int max_events, int listen_num)
+int Epoll::epollInit(int max_events, int listen_num, int max_conns)
 {
     epoll_fd = epoll_create(listen_num + 1);
     if(epoll_fd == -1)
         return -1;
 
     events = new epoll_event[max_events];
+    // 描述符表在进程生命周期内一直存在，不释放
+    maxFds = max_conns;
+    timer_manager = new TimerManager(maxFds);
+    requests = new reqPtr[maxFds];
+    idle = new IdleConn[maxFds]();
     return 0;
 }
 
@@ -38,32 +55,157 @@ int Epoll::epollAdd(int fd, reqPtr request_, __uint32_t events)
     struct epoll_event event;
     event.data.fd = fd;
     event.events = events;
-    requests[fd] = request_;
+    requests[fd] = std::move(request_);
     if(epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event) < 0)
     {
-        perror("epoll_add error");
+        LOG_ERROR("epoll_add fd %d: %m", fd);
+        requests[fd].reset();
         return -1;
     }
     return 0;
 }
 
 // 修改描述符状态
-int Epoll::epollMod(int fd, reqPtr request_, __uint32_t events)
+int Epoll::epollMod(int fd, reqPtr &request_, __uint32_t events)
 {
-    
     struct epoll_event event;
     event.data.fd = fd;
     event.events = events;
-    requests[fd] = request_;
+    // 先放进requests再激活，事件一到主线程就能取到
+    requests[fd] = std::move(request_);
     if(epoll_ctl(epoll_fd, EPOLL_CTL_MOD, fd, &event) < 0)
     {
-        perror("epoll_mod error");
-        requests[fd].reset();
+        LOG_ERROR("epoll_mod fd %d: %m", fd);
+        request_ = std::move(requests[fd]);
         return -1;
     }
     return 0;
 }
 
+int Epoll::park(int op, int fd, uint32_t addr, __uint32_t events)
+{
+    struct epoll_event event;
+    event.data.fd = fd;
+    event.events = events;
+    MutexLockGuard locker(idleLock);
+    // 先记下再激活，事件一到主线程就能重建
+    idle[fd].addr = addr;
+    idle[fd].parked = true;
+    idle[fd].prev = idleTail;
+    idle[fd].next = -1;
+    if (idleTail >= 0)
+        idle[idleTail].next = fd;
+    else
+        idleHead = fd;
+    idleTail = fd;
+    if (epoll_ctl(epoll_fd, op, fd, &event) < 0)
+    {
+        LOG_ERROR("epoll park fd %d: %m", fd);
+        unlinkIdle(fd);
+        return -1;
+    }
+    idleCount.fetch_add(1, std::memory_order_relaxed);
+    return 0;
+}
+
+// 调用方持有idleLock
+void Epoll::unlinkIdle(int fd)
+{
+    if (idle[fd].prev >= 0)
+        idle[idle[fd].prev].next = idle[fd].next;
+    else
+        idleHead = idle[fd].next;
+    if (idle[fd].next >= 0)
+        idle[idle[fd].next].prev = idle[fd].prev;
+    else
+        idleTail = idle[fd].prev;
+    idle[fd].parked = false;
+}
+
+int Epoll::epollPark(int fd, uint32_t addr, __uint32_t events)
+{
+    return park(EPOLL_CTL_MOD, fd, addr, events);
+}
+
+void Epoll::rehydrate(int fd)
+{
+    // 对象从池中取，稳态下不申请内存；连接每次从空闲到处理只在这里改一次引用计数
+    reqPtr req(RequestPool::get(epoll_fd, fd, path));
+    {
+        MutexLockGuard locker(idleLock);
+        req->setPeer(idle[fd].addr);
+        unlinkIdle(fd);
+    }
+    idleCount.fetch_sub(1, std::memory_order_relaxed);
+    requests[fd] = std::move(req);
+}
+
+void Epoll::closeIdle(int fd)
+{
+    struct epoll_event event;
+    event.data.fd = fd;
+    event.events = 0;
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, &event) < 0)
+        LOG_ERROR("epoll_del fd %d: %m", fd);
+    {
+        MutexLockGuard locker(idleLock);
+        unlinkIdle(fd);
+    }
+    idleCount.fetch_sub(1, std::memory_order_relaxed);
+    timer_manager->cancelTimer(fd);
+    LOG_DEBUG("fd %d idle connection closed", fd);
+    KeepAlive::closed();
+    Metrics::add(METRIC_CLOSED);
+    SERVER_PROBE1(conn_close, fd);
+    close(fd);
+}
+
+void Epoll::evictIdle()
+{
+    // 只有主线程从链表上摘连接，取到的表头在关闭之前不会变
+    for (int n = KeepAlive::excess(); n > 0; --n)
+    {
+        int fd;
+        {
+            MutexLockGuard locker(idleLock);
+            fd = idleHead;
+        }
+        if (fd < 0)
+            break;
+        closeIdle(fd);
+        Metrics::add(METRIC_EVICTED);
+    }
+}
+
+int Epoll::relocate(int fd)
+{
+    // accept总是返回最小的空闲描述符，走到这里说明表内已经满了，先腾出一个位置
+    int victim;
+    {
+        MutexLockGuard locker(idleLock);
+        victim = idleHead;
+    }
+    if (victim >= 0)
+    {
+        closeIdle(victim);
+        Metrics::add(METRIC_EVICTED);
+    }
+    // 腾出的位置可能已被工作线程打开的文件占用，这时只能拒绝
+    int new_fd = fcntl(fd, F_DUPFD, 0);
+    close(fd);
+    if (new_fd >= maxFds)
+    {
+        close(new_fd);
+        return -1;
+    }
+    return new_fd;
+}
+
+int Epoll::idleConns()
+{
+    return idleCount.load(std::memory_order_relaxed);
+}
+
 // 从epoll中删除描述符
 int Epoll::epollDel(int fd, __uint32_t events)
 {
@@ -72,32 +214,74 @@ int Epoll::epollDel(int fd, __uint32_t events)
     event.events = events;
     if(epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, &event) < 0)
     {
-        perror("epoll_del error");
+        LOG_ERROR("epoll_del fd %d: %m", fd);
         return -1;
     }
     requests[fd].reset();
     return 0;
 }
 
+bool Epoll::closeConn(int fd)
+{
+    if (fd < 0 || fd >= maxFds)
+        return false;
+    if (idle[fd].parked)
+    {
+        closeIdle(fd);
+        return true;
+    }
+    if (!requests[fd])
+        return false;
+    struct epoll_event event;
+    event.data.fd = fd;
+    event.events = 0;
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, &event) < 0)
+        LOG_ERROR("epoll_del fd %d: %m", fd);
+    // 析构时关闭描述符
+    requests[fd].reset();
+    return true;
+}
+
+bool Epoll::expireConn(int fd)
+{
+    // 响应已经全部交给内核，完成通知要等对端确认，不能按普通请求的超时切断
+    if (fd >= 0 && fd < maxFds && requests[fd] && requests[fd]->isZeroCopyWaiting() &&
+        !requests[fd]->isZeroCopyStalled())
+    {
+        timer_manager->addTimer(fd, REQUEST_TIMEOUT_MS);
+        return false;
+    }
+    return closeConn(fd);
+}
+
 // 返回活跃事件数
 void Epoll::epollWait(int listen_fd, int max_events, int timeout)
 {
     int event_count = epoll_wait(epoll_fd, events, max_events, timeout);
-    if (event_count < 0)
-        perror("epoll wait error");
-    std::vector<reqPtr> req_data = getEvents(listen_fd, event_count, path);
+    if (event_count < 0 && errno != EINTR)
+        LOG_ERROR("epoll_wait: %m");
+    // 只在主线程上调用，每轮复用同一个数组，不再申请内存
+    static std::vector<reqPtr> req_data;
+    getEvents(listen_fd, event_count, path, req_data);
     if (req_data.size() > 0)
     {
         for (auto &req: req_data)
         {
+            req->traceMark(TRACE_ENQUEUE);
             if (ThreadPool::ThreadPoolAdd(req) < 0)
             {
                 // 线程池满了或者关闭了等原因，抛弃本次监听到的请求。
                 break;
             }
         }
+        // 没能入队的连接在这里关闭
+        req_data.clear();
     }
-    timer_manager.handleEvent();
+    timer_manager->handleEvent();
+    // 和超时一样放在处理完本轮事件之后，关掉的描述符不会和本轮中的事件混淆
+    evictIdle();
+    JobStore::expire();
+    Tracer::poll();
 }
 
 void Epoll::acceptConn(int listen_fd, int epoll_fd, const std::string path)
@@ -108,37 +292,42 @@ void Epoll::acceptConn(int listen_fd, int epoll_fd, const std::string path)
     int accept_fd = 0;
     while((accept_fd = accept(listen_fd, (struct sockaddr*)&client_addr, &client_addr_len)) > 0)
     {
-        cout << inet_ntoa(client_addr.sin_addr) << endl;
-        cout << ntohs(client_addr.sin_port) << endl;
-        // 限制服务器的最大并发连接数
-        if (accept_fd >= MAXFDS)
-        {
-            close(accept_fd);
+        LOG_DEBUG("accept fd %d from %s:%d", accept_fd, inet_ntoa(client_addr.sin_addr), ntohs(client_addr.sin_port));
+        // 描述符表被占满时用最久空闲的连接换新连接
+        if (accept_fd >= maxFds && (accept_fd = relocate(accept_fd)) < 0)
             continue;
-        }
 
         // 设为非阻塞模式
         int ret = setNonBlocking(accept_fd);
         if (ret < 0)
         {
-            perror("Set non block failed!");
+            LOG_ERROR("set fd %d non block: %m", accept_fd);
             return;
         }
+        if (SocketOpt::tuneConn(accept_fd) < 0)
+            LOG_WARN("tune fd %d: %m", accept_fd);
 
-        reqPtr req_info(new RequestData(epoll_fd, accept_fd, path));
+        Metrics::add(METRIC_ACCEPTED);
+        KeepAlive::opened();
+        SERVER_PROBE2(conn_accept, accept_fd, client_addr.sin_addr.s_addr);
 
+        // 新增时间信息，注册之后连接就归epoll了。数据到达之前只是一条空闲记录，不取RequestData
+        timer_manager->addTimer(accept_fd, TIMER_TIME_OUT);
         // 文件描述符可以读，边缘触发(Edge Triggered)模式，EPOLLONESHOT 保证一个socket连接在任一时刻只被一个线程处理
         __uint32_t _epo_event = EPOLLIN | EPOLLET | EPOLLONESHOT;
-        Epoll::epollAdd(accept_fd, req_info, _epo_event);
-        // 新增时间信息
-        timer_manager.addTimer(req_info, TIMER_TIME_OUT);
+        if (park(EPOLL_CTL_ADD, accept_fd, client_addr.sin_addr.s_addr, _epo_event) < 0)
+        {
+            Metrics::add(METRIC_CLOSED);
+            KeepAlive::closed();
+            timer_manager->cancelTimer(accept_fd);
+            close(accept_fd);
+        }
     }
 }
 
 // 分发处理函数
-std::vector<std::shared_ptr<RequestData>> Epoll::getEvents(int listen_fd, int events_num, const std::string path)
+void Epoll::getEvents(int listen_fd, int events_num, const std::string path, std::vector<reqPtr> &req_data)
 {
-    std::vector<reqPtr> req_data;
     for(int i = 0; i < events_num; ++i)
     {
         // 获取有事件产生的描述符
@@ -152,47 +341,58 @@ std::vector<std::shared_ptr<RequestData>> Epoll::getEvents(int listen_fd, int ev
         }
         else if (fd < 3)
         {
-            printf("fd < 3\n");
+            LOG_ERROR("unexpected fd %d", fd);
             break;
         }
         else
         {
+            // 零拷贝的完成通知通过EPOLLERR报告，不是连接出错
+            bool reap = (events[i].events & EPOLLERR) && !(events[i].events & EPOLLHUP) &&
+                requests[fd] && requests[fd]->isZeroCopyWaiting();
             // 排除错误事件
-            if ((events[i].events & EPOLLERR) || (events[i].events & EPOLLHUP))
+            if (!reap && ((events[i].events & EPOLLERR) || (events[i].events & EPOLLHUP)))
             {
-                printf("error event\n");
-                if (requests[fd])
-                    requests[fd]->seperateTimer();
-                requests[fd].reset();
+                LOG_DEBUG("fd %d error event 0x%x", fd, events[i].events);
+                closeConn(fd);
                 continue;
             }
+            // 空闲连接有数据了，重建RequestData
+            if (!requests[fd] && idle[fd].parked)
+                rehydrate(fd);
             // 将请求任务加入到线程池中
             // 加入线程池之前将Timer和request分离
 
-            reqPtr cur_req = requests[fd];
-            
-            if (cur_req)
+            if (requests[fd])
             {
-                if ((events[i].events & EPOLLIN) || (events[i].events & EPOLLPRI))
+                RequestData *cur_req = requests[fd].get();
+                if (reap)
+                    cur_req->enableReap();
+                else if ((events[i].events & EPOLLIN) || (events[i].events & EPOLLPRI))
+                {
                     cur_req->enableRead();
+                    cur_req->traceWake();
+                }
                 else
                     cur_req->enableWrite();
                 
                 // 加入到任务队列之前，首先将当前RequestData对象与Timer分离
                 cur_req->seperateTimer();
-                req_data.push_back(cur_req);
-                requests[fd].reset();
+                req_data.push_back(std::move(requests[fd]));
             }
             else
             {
-                cout << "SP cur_req is invalid" << endl;
+                LOG_DEBUG("fd %d has no request", fd);
             }
         }
     }
-    return req_data;
 }
 
-void Epoll::addTimer(shared_ptr<RequestData> request_data_, int timeout)
+void Epoll::addTimer(RequestData *request_data_, int timeout)
+{
+    timer_manager->addTimer(request_data_->getFd(), timeout);
+}
+
+void Epoll::cancelTimer(int fd)
 {
-    timer_manager.addTimer(request_data_, timeout);
+    timer_manager->cancelTimer(fd);
 }
\ No newline at end of file
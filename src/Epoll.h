@@ -1,31 +1,77 @@
 #pragma once
 #include "RequestData.h"
+#include "RequestPtr.h"
 #include "Timer.h"
+#include "KeepAlive.h"
+#include "MutexLock.h"
 #include <vector>
 #include <unordered_map>
 #include <sys/epoll.h>
 #include <memory>
+#include <atomic>
+#include <stdint.h>
 
+// 空闲连接(刚接受还没有数据，或者keep-alive的响应已经发完)的紧凑表示：
+// 没有RequestData，缓冲区都已经还给块池，只记下重建连接需要的信息，定时器节点在时间轮里
+struct IdleConn
+{
+    // 客户端IPv4地址，网络字节序
+    uint32_t addr;
+    // 按空闲开始的先后串成链表，表头是最久空闲的连接
+    int prev;
+    int next;
+    bool parked;
+};
+
+// 连接注册在epoll中时由requests持有，有事件时连同所有权一起交给线程池。
+// 关闭只有两条路：主线程上的closeConn，或者处理连接的线程不再重新注册，最后一个持有者放手。
+// 空闲连接不占用RequestData，只在idle中留一条记录，下次可读时主线程从池中取一个对象重建
 class Epoll
 {
-public:
-    typedef std::shared_ptr<RequestData> reqPtr;
 private:
-    static const int MAXFDS = 1000;
+    static int maxFds;
     static epoll_event *events;
-    static reqPtr requests[MAXFDS];
+    // 以下按描述符索引，大小为maxFds
+    static reqPtr *requests;
+    static IdleConn *idle;
+    static std::atomic<int> idleCount;
+    // 空闲链表由工作线程追加、主线程摘除，激活描述符也在锁内完成，
+    // 这样主线程在链表上看到的连接一定已经注册好了
+    static MutexLock idleLock;
+    static int idleHead;
+    static int idleTail;
     static int epoll_fd;
     static const std::string path;
 
-    static TimerManager timer_manager;
+    static TimerManager *timer_manager;
+
+    static int park(int op, int fd, uint32_t addr, __uint32_t events);
+    static void rehydrate(int fd);
+    static void unlinkIdle(int fd);
+    static void closeIdle(int fd);
+    // 连接数超过驱逐水位时关闭最久空闲的连接
+    static void evictIdle();
+    // 新连接的描述符超出描述符表时，关闭最久空闲的连接把它挪进表内，挪不进去返回-1
+    static int relocate(int fd);
 public:
-    static int epollInit(int max_events, int listen_num);
+    static int epollInit(int max_events, int listen_num, int max_conns);
     static int epollAdd(int fd, reqPtr request_, __uint32_t events);
-    static int epollMod(int fd, reqPtr request_, __uint32_t events);
+    // 成功时request_的所有权转给epoll，之后调用方不能再访问连接；失败时原样留在request_中
+    static int epollMod(int fd, reqPtr &request_, __uint32_t events);
     static int epollDel(int fd, __uint32_t events = (EPOLLIN | EPOLLET | EPOLLONESHOT));
+    // 连接降级成空闲记录后重新激活，成功后描述符归epoll，调用方的RequestData不能再关闭它
+    static int epollPark(int fd, uint32_t addr, __uint32_t events);
     static void epollWait(int listen_fd, int max_events, int timeout);
     static void acceptConn(int listen_fd, int epoll_fd, const std::string path_);
-    static std::vector<reqPtr> getEvents(int listen_fd, int events_num, const std::string path_);
+    // 有事件的连接连同所有权追加到req_data
+    static void getEvents(int listen_fd, int events_num, const std::string path_, std::vector<reqPtr> &req_data);
+
+    // 主线程上关闭注册在epoll中的连接(包括空闲记录)，连接不在epoll中时返回false
+    static bool closeConn(int fd);
+    // 定时器到期时调用：只等零拷贝完成通知、对端仍在确认数据的连接延长定时器，其余同closeConn
+    static bool expireConn(int fd);
+    static int idleConns();
 
-    static void addTimer(reqPtr request_data_, int timeout);
+    static void addTimer(RequestData *request_data_, int timeout);
+    static void cancelTimer(int fd);
 };
\ No newline at end of file
@@ -0,0 +1,148 @@
+#include "FileCache.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+using namespace std;
+
+void FileCache::getInfo(const struct stat &sbuf, FileInfo &info)
+{
+    // 全部由stat的结果算出，每次现算比查共享的表便宜，也不用加锁和清理删掉的文件
+    info.dev = sbuf.st_dev;
+    info.ino = sbuf.st_ino;
+    info.size = sbuf.st_size;
+    info.mtime = sbuf.st_mtim.tv_sec;
+    info.mtime_nsec = sbuf.st_mtim.tv_nsec;
+    snprintf(info.etag, sizeof(info.etag), "\"%lx-%lx-%lx%05lx\"",
+        (unsigned long)sbuf.st_ino, (unsigned long)sbuf.st_size,
+        (unsigned long)sbuf.st_mtim.tv_sec, (unsigned long)(sbuf.st_mtim.tv_nsec / 10000));
+    httpDate(sbuf.st_mtim.tv_sec, info.lastModified, sizeof(info.lastModified));
+}
+
+// 弱比较，忽略 W/ 前缀
+static bool etagMatch(StrView list, StrView etag)
+{
+    size_t pos = 0;
+    while (pos < list.size())
+    {
+        size_t end = list.find(',', pos);
+        if (end == StrView::npos)
+            end = list.size();
+        size_t b = pos, e = end;
+        while (b < e && list[b] == ' ')
+            ++b;
+        while (e > b && list[e - 1] == ' ')
+            --e;
+        StrView tag = list.substr(b, e - b);
+        if (tag == "*")
+            return true;
+        if (tag.size() > 2 && tag.startsWith("W/"))
+            tag = tag.substr(2);
+        if (tag == etag)
+            return true;
+        pos = end + 1;
+    }
+    return false;
+}
+
+bool FileCache::notModified(const FileInfo &info, const HeaderList &headers)
+{
+    // If-None-Match 优先于 If-Modified-Since
+    StrView val;
+    if (headers.get("If-None-Match", val))
+        return etagMatch(val, info.etag);
+    if (headers.get("If-Modified-Since", val))
+    {
+        time_t since;
+        if (parseHttpDate(val.data(), since))
+            return info.mtime <= since;
+    }
+    return false;
+}
+
+bool FileCache::rangeApplies(const FileInfo &info, const HeaderList &headers)
+{
+    StrView val;
+    if (!headers.get("If-Range", val))
+        return true;
+    if (!val.empty() && val[0] == '"')
+        return val == info.etag;
+    time_t t;
+    if (parseHttpDate(val.data(), t))
+        return info.mtime <= t;
+    return false;
+}
+
+// 全是数字(可以为空)时返回true
+static bool parseDigits(StrView s, off_t &n)
+{
+    n = 0;
+    for (size_t i = 0; i < s.size(); ++i)
+    {
+        if (s[i] < '0' || s[i] > '9')
+            return false;
+        n = n * 10 + (s[i] - '0');
+    }
+    return true;
+}
+
+int FileCache::parseRange(StrView range, off_t size, off_t &start, off_t &len)
+{
+    if (!range.startsWith("bytes="))
+        return RANGE_NONE;
+    StrView spec = range.substr(6);
+    if (spec.find(',') != StrView::npos)
+        return RANGE_NONE;
+    size_t dash = spec.find('-');
+    if (dash == StrView::npos)
+        return RANGE_NONE;
+    StrView first = spec.substr(0, dash), last = spec.substr(dash + 1);
+    off_t s, e;
+    if (!parseDigits(first, s) || !parseDigits(last, e))
+        return RANGE_NONE;
+    if (first.empty())
+    {
+        // bytes=-n 取最后n个字节
+        if (last.empty())
+            return RANGE_NONE;
+        off_t suffix = e;
+        if (suffix <= 0 || size == 0)
+            return RANGE_UNSATISFIABLE;
+        if (suffix > size)
+            suffix = size;
+        start = size - suffix;
+        len = suffix;
+        return RANGE_OK;
+    }
+    if (s >= size)
+        return RANGE_UNSATISFIABLE;
+    if (last.empty())
+        e = size - 1;
+    else
+    {
+        if (e < s)
+            return RANGE_NONE;
+        if (e >= size)
+            e = size - 1;
+    }
+    start = s;
+    len = e - s + 1;
+    return RANGE_OK;
+}
+
+void FileCache::httpDate(time_t t, char *buf, size_t len)
+{
+    struct tm tm;
+    gmtime_r(&t, &tm);
+    strftime(buf, len, "%a, %d %b %Y %H:%M:%S GMT", &tm);
+}
+
+bool FileCache::parseHttpDate(const char *str, time_t &t)
+{
+    struct tm tm;
+    memset(&tm, 0, sizeof(tm));
+    const char *end = strptime(str, "%a, %d %b %Y %H:%M:%S GMT", &tm);
+    if (end == NULL)
+        return false;
+    t = timegm(&tm);
+    return true;
+}
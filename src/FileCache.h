@@ -0,0 +1,48 @@
+#pragma once
+#include "HeaderMap.h"
+#include "StrView.h"
+#include <string>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <time.h>
+
+const int RANGE_NONE = 0;
+const int RANGE_OK = 1;
+const int RANGE_UNSATISFIABLE = -1;
+
+// ETag最长的情况：源文件的ETag加上图片变体的参数
+const size_t FILE_ETAG_MAX = 128;
+const size_t FILE_DATE_MAX = 32;
+
+// 静态文件的版本信息，ETag和Last-Modified由(inode, 大小, 修改时间)生成。
+// 定长数组，拷贝时不申请内存
+struct FileInfo
+{
+    dev_t dev;
+    ino_t ino;
+    off_t size;
+    time_t mtime;
+    long mtime_nsec;
+    char etag[FILE_ETAG_MAX];
+    char lastModified[FILE_DATE_MAX];
+};
+
+class FileCache
+{
+private:
+    FileCache();
+    FileCache(const FileCache &f);
+
+public:
+    // 根据stat结果生成文件版本信息
+    static void getInfo(const struct stat &sbuf, FileInfo &info);
+    // If-None-Match / If-Modified-Since 判断客户端缓存是否仍然有效
+    static bool notModified(const FileInfo &info, const HeaderList &headers);
+    // If-Range 不匹配时忽略Range，回送完整文件
+    static bool rangeApplies(const FileInfo &info, const HeaderList &headers);
+    // 解析单个字节区间 "bytes=a-b" / "bytes=a-" / "bytes=-n"，多区间按RANGE_NONE处理
+    static int parseRange(StrView range, off_t size, off_t &start, off_t &len);
+
+    static void httpDate(time_t t, char *buf, size_t len);
+    static bool parseHttpDate(const char *str, time_t &t);
+};
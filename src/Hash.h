@@ -0,0 +1,15 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+
+// XXH64算法：4条独立的64位累加流水线每次处理32字节，
+// 没有跨流水线的依赖，编译器可以向量化，也能充分利用多发射
+class Hash
+{
+private:
+    Hash();
+    Hash(const Hash &h);
+
+public:
+    static uint64_t hash64(const void *data, size_t len, uint64_t seed = 0);
+};
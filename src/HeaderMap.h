@@ -0,0 +1,108 @@
+#pragma once
+#include "Arena.h"
+#include "StrView.h"
+#include "nocopyable.h"
+#include <string>
+#include <unordered_map>
+#include <ctype.h>
+#include <stddef.h>
+
+// HTTP头部的名字不区分大小写，客户端发来的Content-Length和Content-length是同一个头部
+struct HeaderHash
+{
+    size_t operator()(const std::string &key) const
+    {
+        size_t h = 0;
+        for (size_t i = 0; i < key.size(); ++i)
+            h = h * 31 + tolower(static_cast<unsigned char>(key[i]));
+        return h;
+    }
+};
+
+struct HeaderEqual
+{
+    bool operator()(const std::string &lhs, const std::string &rhs) const
+    {
+        if (lhs.size() != rhs.size())
+            return false;
+        for (size_t i = 0; i < lhs.size(); ++i)
+        {
+            if (tolower(static_cast<unsigned char>(lhs[i])) != tolower(static_cast<unsigned char>(rhs[i])))
+                return false;
+        }
+        return true;
+    }
+};
+
+typedef std::unordered_map<std::string, std::string, HeaderHash, HeaderEqual> HeaderMap;
+
+const size_t HEADER_LIST_INIT = 16;
+
+struct HeaderField
+{
+    StrView key;
+    StrView value;
+};
+
+// 请求头部：名字和值都拷贝在请求的Arena里，数量不多，顺序查找比哈希表快，也不用为每个节点申请内存。
+// 请求结束时先clear再重置Arena
+class HeaderList: noncopyable
+{
+private:
+    HeaderField *fields;
+    size_t count;
+    size_t cap;
+
+public:
+    HeaderList(): fields(NULL), count(0), cap(0) {}
+    // 同名的头部后出现的覆盖前面的
+    void set(Arena &arena, StrView key, StrView value)
+    {
+        StrView v = arena.dup(value.data(), value.size());
+        for (size_t i = 0; i < count; ++i)
+        {
+            if (fields[i].key.caseEqual(key))
+            {
+                fields[i].value = v;
+                return;
+            }
+        }
+        if (count == cap)
+        {
+            // 旧的数组留在Arena里，请求结束时一起回收
+            size_t n = cap ? cap * 2 : HEADER_LIST_INIT;
+            HeaderField *f = static_cast<HeaderField*>(arena.alloc(n * sizeof(HeaderField)));
+            for (size_t i = 0; i < count; ++i)
+                f[i] = fields[i];
+            fields = f;
+            cap = n;
+        }
+        fields[count].key = arena.dup(key.data(), key.size());
+        fields[count].value = v;
+        ++count;
+    }
+    // 找到时value指向以'\0'结尾的值
+    bool get(StrView name, StrView &value) const
+    {
+        for (size_t i = 0; i < count; ++i)
+        {
+            if (fields[i].key.caseEqual(name))
+            {
+                value = fields[i].value;
+                return true;
+            }
+        }
+        return false;
+    }
+    bool has(StrView name) const
+    {
+        StrView v;
+        return get(name, v);
+    }
+    void clear()
+    {
+        fields = NULL;
+        count = 0;
+        cap = 0;
+    }
+};
@@ -0,0 +1,36 @@
+#include "ImageDump.h"
+#include "Logger.h"
+#include "DiskIO.h"
+#include <unistd.h>
+#include <stdio.h>
+#include <opencv2/highgui/highgui.hpp>
+#include <opencv2/opencv.hpp>
+
+unsigned long ImageDump::every = 0;
+std::string ImageDump::dir = "dump";
+std::atomic<unsigned long> ImageDump::counter(0);
+
+void ImageDump::setSampling(unsigned long every_, const std::string &dir_)
+{
+    every = every_;
+    dir = dir_;
+}
+
+void ImageDump::sample(const cv::Mat &img)
+{
+    if (every == 0 || img.empty())
+        return;
+    unsigned long seq = counter.fetch_add(1, std::memory_order_relaxed);
+    if (seq % every != 0)
+        return;
+    // 每个请求一个文件，Mat按引用计数共享数据，不需要拷贝
+    char path[256];
+    snprintf(path, sizeof(path), "%s/receive-%d-%lu.bmp", dir.c_str(), static_cast<int>(getpid()), seq);
+    std::string file(path);
+    cv::Mat copy = img;
+    DiskIO::post([file, copy]()
+    {
+        if (!cv::imwrite(file, copy))
+            LOG_WARN("dump %s failed", file.c_str());
+    });
+}
@@ -0,0 +1,20 @@
+#pragma once
+#include <string>
+#include <atomic>
+#include <opencv2/core/core.hpp>
+
+// 按采样把收到的图片转储到磁盘，用于调试；写文件在磁盘线程上完成
+class ImageDump
+{
+private:
+    // 每N张图片保存一张，0表示关闭
+    static unsigned long every;
+    static std::string dir;
+    static std::atomic<unsigned long> counter;
+    ImageDump();
+    ImageDump(const ImageDump &d);
+
+public:
+    static void setSampling(unsigned long every_, const std::string &dir_);
+    static void sample(const cv::Mat &img);
+};
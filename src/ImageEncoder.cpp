@@ -0,0 +1,185 @@
+#include "ImageEncoder.h"
+#include "ImagePool.h"
+#include <opencv2/highgui/highgui.hpp>
+#include <opencv2/opencv.hpp>
+#include <time.h>
+#include <stdlib.h>
+#include <stdio.h>
+using namespace std;
+
+ImageEncoder::Stats ImageEncoder::stats[ENCODE_FORMATS];
+
+namespace
+{
+const char *names[ENCODE_FORMATS] = { "png", "jpeg", "webp" };
+const char *mimes[ENCODE_FORMATS] = { "image/png", "image/jpeg", "image/webp" };
+const char *exts[ENCODE_FORMATS] = { ".png", ".jpg", ".webp" };
+
+unsigned long long nowMicros()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+string trim(const string &s)
+{
+    size_t b = s.find_first_not_of(" \t");
+    if (b == string::npos)
+        return string();
+    size_t e = s.find_last_not_of(" \t");
+    return s.substr(b, e - b + 1);
+}
+}
+
+int ImageEncoder::formatOf(const std::string &name)
+{
+    if (name == "png" || name == "image/png")
+        return ENCODE_PNG;
+    if (name == "jpeg" || name == "jpg" || name == "image/jpeg")
+        return ENCODE_JPEG;
+    if (name == "webp" || name == "image/webp")
+        return ENCODE_WEBP;
+    return -1;
+}
+
+bool ImageEncoder::negotiate(const std::string &accept, const std::string &format,
+    const std::string &quality, EncodeOptions &opts, int fallback)
+{
+    opts.format = -1;
+    if (!format.empty())
+    {
+        // 查询参数优先于Accept
+        opts.format = formatOf(format);
+        if (opts.format < 0)
+            return false;
+    }
+    else if (accept.empty())
+        opts.format = fallback;
+    else
+    {
+        // 取q值最大的格式，q值相同时取先出现的；image/*和*/*对应fallback
+        double best = 0;
+        size_t pos = 0;
+        while (pos <= accept.size())
+        {
+            size_t end = accept.find(',', pos);
+            if (end == string::npos)
+                end = accept.size();
+            string item = accept.substr(pos, end - pos);
+            pos = end + 1;
+            double q = 1.0;
+            size_t semi = item.find(';');
+            if (semi != string::npos)
+            {
+                size_t qpos = item.find("q=", semi);
+                if (qpos != string::npos)
+                    q = atof(item.c_str() + qpos + 2);
+                item = item.substr(0, semi);
+            }
+            item = trim(item);
+            int f = formatOf(item);
+            if (f < 0 && (item == "image/*" || item == "*/*"))
+                f = fallback;
+            if (f >= 0 && q > best)
+            {
+                best = q;
+                opts.format = f;
+            }
+        }
+        if (opts.format < 0)
+            return false;
+    }
+    if (opts.format == ENCODE_PNG)
+        opts.level = ENCODE_PNG_LEVEL;
+    else if (opts.format == ENCODE_JPEG)
+        opts.level = ENCODE_JPEG_QUALITY;
+    else
+        opts.level = ENCODE_WEBP_QUALITY;
+    if (!quality.empty())
+    {
+        int level = atoi(quality.c_str());
+        if (opts.format == ENCODE_PNG)
+            opts.level = level < 0 ? 0 : (level > 9 ? 9 : level);
+        else
+            opts.level = level < 1 ? 1 : (level > 100 ? 100 : level);
+    }
+    return true;
+}
+
+bool ImageEncoder::encode(const cv::Mat &img, const EncodeOptions &opts, std::vector<unsigned char> &out)
+{
+    vector<int> params;
+    if (opts.format == ENCODE_PNG)
+        params.push_back(cv::IMWRITE_PNG_COMPRESSION);
+    else if (opts.format == ENCODE_JPEG)
+        params.push_back(cv::IMWRITE_JPEG_QUALITY);
+    else
+        params.push_back(cv::IMWRITE_WEBP_QUALITY);
+    params.push_back(opts.level);
+    // JPEG只支持8位1/3通道
+    cv::Mat src = img;
+    if (opts.format == ENCODE_JPEG && src.depth() != CV_8U)
+        src.convertTo(src, CV_8U, src.depth() == CV_16U ? 1.0 / 256 : 1.0);
+    if (opts.format == ENCODE_JPEG && src.channels() == 4)
+        cv::cvtColor(src, src, cv::COLOR_BGRA2BGR);
+    Stats &s = stats[opts.format];
+    unsigned long long start = nowMicros();
+    bool ok = false;
+    EncodePool::get(out);
+    try
+    {
+        ok = cv::imencode(exts[opts.format], src, out, params);
+    }
+    catch (const cv::Exception &)
+    {
+        // 例如OpenCV编译时没有带WebP
+        ok = false;
+    }
+    unsigned long long cost = nowMicros() - start;
+    if (!ok)
+    {
+        ++s.failures;
+        return false;
+    }
+    EncodePool::observe(out.size());
+    ++s.count;
+    s.bytes += out.size();
+    s.pixels += img.total();
+    s.micros += cost;
+    unsigned long long prev = s.maxMicros;
+    while (cost > prev && !s.maxMicros.compare_exchange_weak(prev, cost))
+        ;
+    return true;
+}
+
+const char *ImageEncoder::mime(int format)
+{
+    return mimes[format];
+}
+
+string ImageEncoder::describe(const EncodeOptions &opts)
+{
+    return string(names[opts.format]) + to_string(opts.level);
+}
+
+string ImageEncoder::statsJson()
+{
+    string json = "{";
+    for (int i = 0; i < ENCODE_FORMATS; ++i)
+    {
+        unsigned long count = stats[i].count;
+        unsigned long long bytes = stats[i].bytes, pixels = stats[i].pixels, micros = stats[i].micros;
+        char buf[512];
+        snprintf(buf, sizeof(buf),
+            "%s\"%s\":{\"count\":%lu,\"failures\":%lu,\"bytes\":%llu,\"micros\":%llu,\"max_micros\":%llu,"
+            "\"avg_micros\":%.1f,\"avg_bytes\":%.1f,\"bytes_per_pixel\":%.4f}",
+            i == 0 ? "" : ",", names[i], count, stats[i].failures.load(), bytes, micros, stats[i].maxMicros.load(),
+            count ? static_cast<double>(micros) / count : 0.0,
+            count ? static_cast<double>(bytes) / count : 0.0,
+            pixels ? static_cast<double>(bytes) / pixels : 0.0);
+        json += buf;
+    }
+    json += "}\n";
+    return json;
+}
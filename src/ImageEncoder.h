@@ -0,0 +1,56 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <atomic>
+#include <opencv2/core/core.hpp>
+
+const int ENCODE_PNG = 0;
+const int ENCODE_JPEG = 1;
+const int ENCODE_WEBP = 2;
+const int ENCODE_FORMATS = 3;
+
+// 没有指定时的编码参数：PNG压缩级别(0-9)，JPEG/WebP质量(1-100)
+const int ENCODE_PNG_LEVEL = 1;
+const int ENCODE_JPEG_QUALITY = 90;
+const int ENCODE_WEBP_QUALITY = 80;
+
+struct EncodeOptions
+{
+    int format;
+    // PNG为压缩级别，JPEG/WebP为质量
+    int level;
+};
+
+// 响应图片的编码：按Accept头部和format/quality参数选择格式，
+// 统计每种格式的编码耗时和输出大小，用来按客户端权衡CPU和带宽
+class ImageEncoder
+{
+private:
+    struct Stats
+    {
+        std::atomic<unsigned long> count;
+        std::atomic<unsigned long> failures;
+        std::atomic<unsigned long long> bytes;
+        std::atomic<unsigned long long> pixels;
+        std::atomic<unsigned long long> micros;
+        std::atomic<unsigned long long> maxMicros;
+    };
+    static Stats stats[ENCODE_FORMATS];
+    ImageEncoder();
+    ImageEncoder(const ImageEncoder &e);
+
+public:
+    // 格式名、扩展名或者MIME类型对应的格式，不支持时返回-1
+    static int formatOf(const std::string &name);
+    // format和quality来自查询参数，可以为空；没有Accept或者只有通配符时用fallback，
+    // Accept里没有可用的格式时返回false(406)
+    static bool negotiate(const std::string &accept, const std::string &format,
+        const std::string &quality, EncodeOptions &opts, int fallback = ENCODE_PNG);
+    // out换成EncodePool里的缓冲区，用完由调用方放回
+    static bool encode(const cv::Mat &img, const EncodeOptions &opts, std::vector<unsigned char> &out);
+    static const char *mime(int format);
+    // 用于结果缓存的key，例如"png1"、"jpeg90"
+    static std::string describe(const EncodeOptions &opts);
+    // 各格式的编码统计，JSON格式
+    static std::string statsJson();
+};
@@ -0,0 +1,62 @@
+#include "ImagePool.h"
+using namespace std;
+
+thread_local vector<cv::Mat> *MatPool::mats = NULL;
+thread_local vector<vector<unsigned char> > *EncodePool::buffers = NULL;
+thread_local size_t EncodePool::average = 0;
+
+cv::Mat MatPool::get()
+{
+    if (mats == NULL)
+        mats = new vector<cv::Mat>();
+    if (mats->empty())
+        return cv::Mat();
+    cv::Mat m = mats->back();
+    mats->pop_back();
+    return m;
+}
+
+void MatPool::put(cv::Mat &m)
+{
+    // 池子随线程存在，线程退出时不回收
+    if (mats != NULL && mats->size() < MAT_POOL_MAX && m.u != NULL && m.u->refcount == 1 &&
+        m.isContinuous() && m.total() * m.elemSize() <= MAT_POOL_MAX_BYTES)
+        mats->push_back(m);
+    m.release();
+}
+
+void EncodePool::get(std::vector<unsigned char> &out)
+{
+    if (buffers == NULL)
+        buffers = new vector<vector<unsigned char> >();
+    out.clear();
+    if (!buffers->empty())
+    {
+        out.swap(buffers->back());
+        buffers->pop_back();
+        out.clear();
+    }
+    // 多留四分之一，大多数结果一次放下
+    size_t want = average + average / 4;
+    if (out.capacity() < want)
+        out.reserve(want);
+}
+
+void EncodePool::observe(size_t bytes)
+{
+    if (average == 0)
+        average = bytes;
+    else
+        average = (average * 7 + bytes) / 8;
+}
+
+void EncodePool::put(std::vector<unsigned char> &buf)
+{
+    if (buffers != NULL && buffers->size() < ENCODE_POOL_MAX &&
+        buf.capacity() > 0 && buf.capacity() <= ENCODE_POOL_MAX_BYTES)
+    {
+        buffers->push_back(vector<unsigned char>());
+        buffers->back().swap(buf);
+    }
+    vector<unsigned char>().swap(buf);
+}
@@ -0,0 +1,48 @@
+#pragma once
+#include <vector>
+#include <opencv2/core/core.hpp>
+
+// 每个线程最多缓存的Mat个数
+const size_t MAT_POOL_MAX = 4;
+// 超过这个大小的Mat不缓存
+const size_t MAT_POOL_MAX_BYTES = 64 * 1024 * 1024;
+// 每个线程最多缓存的编码缓冲区个数
+const size_t ENCODE_POOL_MAX = 4;
+// 超过这个容量的编码缓冲区不缓存
+const size_t ENCODE_POOL_MAX_BYTES = 32 * 1024 * 1024;
+
+// 解码和结果图片的Mat池，每个线程一个，不加锁。
+// 相同尺寸的图片连续到来时create直接复用已有的像素内存
+class MatPool
+{
+private:
+    static thread_local std::vector<cv::Mat> *mats;
+    MatPool();
+    MatPool(const MatPool &m);
+
+public:
+    // 取出最近放回的Mat，池空时返回空Mat
+    static cv::Mat get();
+    // 像素内存只被m引用时放回池中，否则只释放m(例如还在转储队列里)
+    static void put(cv::Mat &m);
+};
+
+// 编码输出缓冲区池，每个线程一个，不加锁。
+// 新缓冲区按这个线程最近的编码结果大小预留，imencode追加时不再反复扩容
+class EncodePool
+{
+private:
+    static thread_local std::vector<std::vector<unsigned char> > *buffers;
+    // 最近编码结果大小的滑动平均
+    static thread_local size_t average;
+    EncodePool();
+    EncodePool(const EncodePool &e);
+
+public:
+    // out换成一个空的缓冲区，容量尽量够放下一次编码结果
+    static void get(std::vector<unsigned char> &out);
+    // 记录一次编码结果的大小
+    static void observe(size_t bytes);
+    // 缓冲区放回池中，只有调用过get的线程才缓存，其余线程直接释放
+    static void put(std::vector<unsigned char> &buf);
+};
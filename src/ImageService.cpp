@@ -0,0 +1,231 @@
+#include "ImageService.h"
+#include "ImageStitcher.h"
+#include "ImageDump.h"
+#include "Compute.h"
+#include "ResultCache.h"
+#include "ImagePool.h"
+#include <stdlib.h>
+#include <opencv2/highgui/highgui.hpp>
+#include <opencv2/opencv.hpp>
+using namespace cv;
+using namespace std;
+
+MutexLock ImageService::sourceLock;
+std::list<std::pair<std::string, cv::Mat> > ImageService::sources;
+size_t ImageService::sourceBytes = 0;
+
+bool ImageService::parseLengths(const std::string &header, size_t length, std::vector<int> &lengths)
+{
+    lengths.clear();
+    if (header.empty())
+    {
+        lengths.push_back(static_cast<int>(length));
+        return length > 0;
+    }
+    size_t pos = 0, sum = 0;
+    while (pos < header.size())
+    {
+        size_t end = header.find(',', pos);
+        if (end == string::npos)
+            end = header.size();
+        int len = atoi(header.substr(pos, end - pos).c_str());
+        if (len <= 0)
+            return false;
+        lengths.push_back(len);
+        sum += len;
+        pos = end + 1;
+    }
+    return !lengths.empty() && sum == length;
+}
+
+ResultCache::resultPtr ImageService::process(const char *body, const std::vector<int> &lengths,
+    const EncodeOptions &enc, const CancelFn &cancelled)
+{
+    // 操作和每张图片的长度都是key的一部分
+    string op = "stitch." + ImageEncoder::describe(enc) + ":";
+    size_t total = 0;
+    for (size_t i = 0; i < lengths.size(); ++i)
+    {
+        op += to_string(lengths[i]) + ",";
+        total += lengths[i];
+    }
+    return ResultCache::get(ResultCache::key(op, body, total), [&]()
+    {
+        shared_ptr<CachedResult> res(new CachedResult());
+        compute(body, lengths, enc, *res, cancelled);
+        return ResultCache::resultPtr(res);
+    });
+}
+
+void ImageService::compute(const char *body, const std::vector<int> &lengths, const EncodeOptions &enc,
+    CachedResult &res, const CancelFn &cancelled)
+{
+    // 每张图片用Mat头直接指向body，在compute lane上并行解码到池里的Mat。
+    // Mat在当前线程取出和放回，worker线程只写像素
+    vector<Mat> images(lengths.size());
+    vector<int> offsets(lengths.size(), 0);
+    for (size_t i = 0; i < lengths.size(); ++i)
+    {
+        images[i] = MatPool::get();
+        if (i > 0)
+            offsets[i] = offsets[i - 1] + lengths[i - 1];
+    }
+    Compute::parallelFor(static_cast<int>(lengths.size()), [&](int i)
+    {
+        Mat data(1, lengths[i], CV_8UC1, const_cast<char*>(body + offsets[i]));
+        imdecode(data, CV_LOAD_IMAGE_ANYDEPTH|CV_LOAD_IMAGE_ANYCOLOR, &images[i]);
+    });
+    Mat pano = MatPool::get();
+    res.code = stitchAndEncode(images, pano, enc, res, cancelled);
+    // 结果可能和某张输入共享像素，先放回结果，输入才能成为唯一引用
+    MatPool::put(pano);
+    for (size_t i = 0; i < images.size(); ++i)
+        MatPool::put(images[i]);
+}
+
+int ImageService::stitchAndEncode(const std::vector<Mat> &images, Mat &pano, const EncodeOptions &enc,
+    CachedResult &res, const CancelFn &cancelled)
+{
+    for (size_t i = 0; i < images.size(); ++i)
+    {
+        if (images[i].empty())
+        {
+            res.msg = "Bad Request: Bad image data";
+            return 400;
+        }
+        ImageDump::sample(images[i]);
+    }
+    int ret = ImageStitcher::stitch(images, pano, cancelled);
+    if (ret == STITCH_CANCELLED)
+    {
+        res.msg = ImageStitcher::error(ret);
+        return HTTP_CLIENT_CLOSED;
+    }
+    else if (ret == STITCH_TOO_LARGE)
+    {
+        res.msg = ImageStitcher::error(ret);
+        return 413;
+    }
+    else if (ret != STITCH_OK)
+    {
+        res.msg = ImageStitcher::error(ret);
+        return 422;
+    }
+    if (cancelled && cancelled())
+    {
+        res.msg = "Cancelled";
+        return HTTP_CLIENT_CLOSED;
+    }
+    if (!ImageEncoder::encode(pano, enc, res.data))
+    {
+        res.msg = "Encode failed";
+        return 500;
+    }
+    return 200;
+}
+
+Mat ImageService::loadSource(const std::string &path, const std::string &version)
+{
+    string key = path + version;
+    {
+        MutexLockGuard guard(sourceLock);
+        for (auto it = sources.begin(); it != sources.end(); ++it)
+        {
+            if (it->first == key)
+            {
+                sources.splice(sources.begin(), sources, it);
+                return it->second;
+            }
+        }
+    }
+    Mat img = imread(path, IMREAD_UNCHANGED);
+    size_t size = img.total() * img.elemSize();
+    if (img.empty() || size > RESIZE_SOURCE_BYTES)
+        return img;
+    MutexLockGuard guard(sourceLock);
+    while (!sources.empty() && sourceBytes + size > RESIZE_SOURCE_BYTES)
+    {
+        const Mat &old = sources.back().second;
+        sourceBytes -= old.total() * old.elemSize();
+        sources.pop_back();
+    }
+    // Mat按引用计数共享，缓存中的源图只读
+    sources.push_front(make_pair(key, img));
+    sourceBytes += size;
+    return img;
+}
+
+ResultCache::resultPtr ImageService::resize(const std::string &path, const std::string &version,
+    int width, int height, const EncodeOptions &enc)
+{
+    string key = "resize:" + path + version + ":" + to_string(width) + "x" + to_string(height) + ":" + ImageEncoder::describe(enc);
+    return ResultCache::get(key, [&]()
+    {
+        shared_ptr<CachedResult> res(new CachedResult());
+        Mat src = loadSource(path, version);
+        if (src.empty())
+        {
+            res->code = 415;
+            res->msg = "Unsupported Media Type";
+            return ResultCache::resultPtr(res);
+        }
+        scaleAndEncode(src, width, height, enc, *res);
+        return ResultCache::resultPtr(res);
+    });
+}
+
+ResultCache::resultPtr ImageService::transform(const char *data, size_t len,
+    int width, int height, const EncodeOptions &enc)
+{
+    string op = "transform:" + to_string(width) + "x" + to_string(height) + ":" + ImageEncoder::describe(enc);
+    return ResultCache::get(ResultCache::key(op, data, len), [&]()
+    {
+        shared_ptr<CachedResult> res(new CachedResult());
+        Mat buf(1, static_cast<int>(len), CV_8UC1, const_cast<char*>(data));
+        Mat img = MatPool::get();
+        imdecode(buf, CV_LOAD_IMAGE_ANYDEPTH|CV_LOAD_IMAGE_ANYCOLOR, &img);
+        if (img.empty())
+        {
+            res->code = 400;
+            res->msg = "Bad Request: Bad image data";
+        }
+        else
+        {
+            ImageDump::sample(img);
+            scaleAndEncode(img, width, height, enc, *res);
+        }
+        MatPool::put(img);
+        return ResultCache::resultPtr(res);
+    });
+}
+
+void ImageService::scaleAndEncode(const Mat &src, int width, int height, const EncodeOptions &enc, CachedResult &res)
+{
+    double scale = 1.0;
+    if (width > 0)
+        scale = min(scale, static_cast<double>(width) / src.cols);
+    if (height > 0)
+        scale = min(scale, static_cast<double>(height) / src.rows);
+    if (scale >= 1.0)
+    {
+        encodeInto(src, enc, res);
+        return;
+    }
+    Size size(max(1, cvRound(src.cols * scale)), max(1, cvRound(src.rows * scale)));
+    Mat dst = MatPool::get();
+    // INTER_AREA缩小不产生摩尔纹，OpenCV对它有SIMD实现
+    cv::resize(src, dst, size, 0, 0, INTER_AREA);
+    encodeInto(dst, enc, res);
+    MatPool::put(dst);
+}
+
+void ImageService::encodeInto(const Mat &img, const EncodeOptions &enc, CachedResult &res)
+{
+    if (!ImageEncoder::encode(img, enc, res.data))
+    {
+        res.code = 500;
+        res.msg = "Encode failed";
+        return;
+    }
+    res.code = 200;
+}
@@ -0,0 +1,54 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <functional>
+#include <list>
+#include "ImageEncoder.h"
+#include "ResultCache.h"
+#include "MutexLock.h"
+
+// 客户端在处理完成之前断开(nginx的约定)
+const int HTTP_CLIENT_CLOSED = 499;
+
+// 缩放结果的宽高上限
+const int RESIZE_MAX_DIM = 4096;
+// 解码后的源图缓存上限，同一张图的多个尺寸只解码一次
+const size_t RESIZE_SOURCE_BYTES = 64 * 1024 * 1024;
+
+// POST图片处理流程：解码 -> 拼接 -> 编码，同步请求和异步任务共用；
+// 以及静态图片的缩放变体
+class ImageService
+{
+private:
+    ImageService();
+    ImageService(const ImageService &s);
+
+    static MutexLock sourceLock;
+    // (路径和版本, 解码后的图片)，最近使用的在前
+    static std::list<std::pair<std::string, cv::Mat> > sources;
+    static size_t sourceBytes;
+
+    static void compute(const char *body, const std::vector<int> &lengths, const EncodeOptions &enc,
+        CachedResult &res, const std::function<bool()> &cancelled);
+    static cv::Mat loadSource(const std::string &path, const std::string &version);
+    static int stitchAndEncode(const std::vector<cv::Mat> &images, cv::Mat &pano, const EncodeOptions &enc,
+        CachedResult &res, const std::function<bool()> &cancelled);
+    static void scaleAndEncode(const cv::Mat &src, int width, int height, const EncodeOptions &enc, CachedResult &res);
+    static void encodeInto(const cv::Mat &img, const EncodeOptions &enc, CachedResult &res);
+
+public:
+    typedef std::function<bool()> CancelFn;
+    // 解析X-Image-Lengths，总和必须等于body长度；header为空时整个body是一张图片
+    static bool parseLengths(const std::string &header, size_t length, std::vector<int> &lengths);
+    // 结果的code为HTTP状态码，成功时data为按enc编码的图片，失败时msg给出原因。
+    // 结果按body和参数缓存，相同的并发请求只计算一次；结果只读，发送时直接引用不拷贝
+    static ResultCache::resultPtr process(const char *body, const std::vector<int> &lengths,
+        const EncodeOptions &enc, const CancelFn &cancelled = CancelFn());
+    // 把静态图片缩放到宽不超过width、高不超过height(0表示不限制)，保持比例，不放大。
+    // version是源文件的ETag，源文件变化后旧的变体不再命中
+    static ResultCache::resultPtr resize(const std::string &path, const std::string &version,
+        int width, int height, const EncodeOptions &enc);
+    // 解码一张上传的图片后按同样的规则缩放(width和height都为0时不缩放)并编码，结果按内容缓存
+    static ResultCache::resultPtr transform(const char *data, size_t len,
+        int width, int height, const EncodeOptions &enc);
+};
@@ -0,0 +1,239 @@
+#include "ImageStitcher.h"
+#include "Compute.h"
+#include <opencv2/imgproc/imgproc.hpp>
+#include <opencv2/features2d/features2d.hpp>
+#include <opencv2/calib3d/calib3d.hpp>
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+using cv::Mat;
+
+struct ImageStitcher::Features
+{
+    // 关键点坐标已经换算回原图
+    std::vector<cv::KeyPoint> keypoints;
+    Mat descriptors;
+};
+
+void ImageStitcher::normalize(const Mat &src, Mat &dst)
+{
+    Mat img = src;
+    if (img.depth() != CV_8U)
+    {
+        double scale = 1.0;
+        if (img.depth() == CV_16U)
+            scale = 1.0 / 256;
+        else if (img.depth() == CV_32F || img.depth() == CV_64F)
+            scale = 255.0;
+        Mat tmp;
+        img.convertTo(tmp, CV_8U, scale);
+        img = tmp;
+    }
+    if (img.channels() == 1)
+        cv::cvtColor(img, dst, cv::COLOR_GRAY2BGR);
+    else if (img.channels() == 4)
+        cv::cvtColor(img, dst, cv::COLOR_BGRA2BGR);
+    else
+        dst = img;
+}
+
+void ImageStitcher::detect(const Mat &img, Features &features)
+{
+    Mat gray;
+    cv::cvtColor(img, gray, cv::COLOR_BGR2GRAY);
+    // 大图缩小后再检测，速度和特征数量都够用
+    double scale = std::min(1.0, std::sqrt(STITCH_WORK_MEGAPIX * 1e6 / img.total()));
+    if (scale < 1.0)
+        cv::resize(gray, gray, cv::Size(), scale, scale, cv::INTER_AREA);
+    cv::Ptr<cv::ORB> orb = cv::ORB::create(STITCH_FEATURES);
+    orb->detectAndCompute(gray, cv::noArray(), features.keypoints, features.descriptors);
+    float inv = static_cast<float>(1.0 / scale);
+    for (size_t i = 0; i < features.keypoints.size(); ++i)
+        features.keypoints[i].pt *= inv;
+}
+
+// 求把rhs映射到lhs的单应矩阵
+bool ImageStitcher::match(const Features &lhs, const Features &rhs, Mat &H)
+{
+    if (lhs.descriptors.empty() || rhs.descriptors.empty())
+        return false;
+    cv::BFMatcher matcher(cv::NORM_HAMMING);
+    std::vector<std::vector<cv::DMatch> > knn;
+    matcher.knnMatch(rhs.descriptors, lhs.descriptors, knn, 2);
+    std::vector<cv::Point2f> src, dst;
+    for (size_t i = 0; i < knn.size(); ++i)
+    {
+        // 比值检验去掉有歧义的匹配
+        if (knn[i].size() == 2 && knn[i][0].distance < 0.75f * knn[i][1].distance)
+        {
+            src.push_back(rhs.keypoints[knn[i][0].queryIdx].pt);
+            dst.push_back(lhs.keypoints[knn[i][0].trainIdx].pt);
+        }
+    }
+    if (static_cast<int>(src.size()) < STITCH_MIN_INLIERS)
+        return false;
+    Mat inliers;
+    H = cv::findHomography(src, dst, cv::RANSAC, 4.0, inliers);
+    return !H.empty() && cv::countNonZero(inliers) >= STITCH_MIN_INLIERS;
+}
+
+int ImageStitcher::stitch(const std::vector<Mat> &images, Mat &pano, const CancelFn &cancelled)
+{
+    int n = static_cast<int>(images.size());
+    if (n == 0)
+        return STITCH_NO_IMAGE;
+    std::vector<Mat> imgs(n);
+    Compute::parallelFor(n, [&](int i) { normalize(images[i], imgs[i]); });
+    for (int i = 0; i < n; ++i)
+    {
+        if (imgs[i].empty())
+            return STITCH_NO_IMAGE;
+    }
+    if (n == 1)
+    {
+        pano = imgs[0];
+        return STITCH_OK;
+    }
+
+    if (cancelled && cancelled())
+        return STITCH_CANCELLED;
+    // 1. 每张图片并行提取特征
+    std::vector<Features> features(n);
+    Compute::parallelFor(n, [&](int i) { detect(imgs[i], features[i]); });
+
+    if (cancelled && cancelled())
+        return STITCH_CANCELLED;
+    // 2. 相邻图片并行匹配，pairH[i]把第i+1张映射到第i张
+    std::vector<Mat> pairH(n - 1);
+    std::vector<char> matched(n - 1, 0);
+    Compute::parallelFor(n - 1, [&](int i) { matched[i] = match(features[i], features[i + 1], pairH[i]); });
+    for (int i = 0; i < n - 1; ++i)
+    {
+        if (!matched[i])
+            return STITCH_NOT_ENOUGH_MATCHES;
+    }
+
+    // 3. 以中间的图片为参考平面，串起每张图片到参考平面的变换
+    int ref = n / 2;
+    std::vector<Mat> T(n);
+    T[ref] = Mat::eye(3, 3, CV_64F);
+    for (int i = ref + 1; i < n; ++i)
+        T[i] = T[i - 1] * pairH[i - 1];
+    for (int i = ref - 1; i >= 0; --i)
+        T[i] = T[i + 1] * pairH[i].inv();
+
+    // 4. 画布范围
+    double minx = std::numeric_limits<double>::max(), miny = minx;
+    double maxx = -minx, maxy = -minx;
+    std::vector<std::vector<cv::Point2f> > warpedCorners(n);
+    for (int i = 0; i < n; ++i)
+    {
+        float w = static_cast<float>(imgs[i].cols), h = static_cast<float>(imgs[i].rows);
+        std::vector<cv::Point2f> corners;
+        corners.push_back(cv::Point2f(0, 0));
+        corners.push_back(cv::Point2f(w, 0));
+        corners.push_back(cv::Point2f(w, h));
+        corners.push_back(cv::Point2f(0, h));
+        cv::perspectiveTransform(corners, warpedCorners[i], T[i]);
+        for (size_t k = 0; k < warpedCorners[i].size(); ++k)
+        {
+            const cv::Point2f &p = warpedCorners[i][k];
+            if (!std::isfinite(p.x) || !std::isfinite(p.y))
+                return STITCH_BAD_HOMOGRAPHY;
+            minx = std::min(minx, static_cast<double>(p.x));
+            miny = std::min(miny, static_cast<double>(p.y));
+            maxx = std::max(maxx, static_cast<double>(p.x));
+            maxy = std::max(maxy, static_cast<double>(p.y));
+        }
+    }
+    if (maxx - minx > STITCH_MAX_CANVAS || maxy - miny > STITCH_MAX_CANVAS)
+        return STITCH_BAD_HOMOGRAPHY;
+    cv::Size canvas(static_cast<int>(std::ceil(maxx - minx)), static_cast<int>(std::ceil(maxy - miny)));
+    // 按面积限制，一次上传不能要求任意大的画布
+    if (static_cast<size_t>(canvas.width) * canvas.height > STITCH_MAX_CANVAS_PIXELS)
+        return STITCH_TOO_LARGE;
+    Mat shift = (cv::Mat_<double>(3, 3) << 1, 0, -minx, 0, 1, -miny, 0, 0, 1);
+    std::vector<cv::Rect> boxes(n);
+    for (int i = 0; i < n; ++i)
+    {
+        T[i] = shift * T[i];
+        for (size_t k = 0; k < warpedCorners[i].size(); ++k)
+        {
+            warpedCorners[i][k].x -= static_cast<float>(minx);
+            warpedCorners[i][k].y -= static_cast<float>(miny);
+        }
+        boxes[i] = cv::boundingRect(warpedCorners[i]) & cv::Rect(0, 0, canvas.width, canvas.height);
+    }
+
+    if (cancelled && cancelled())
+        return STITCH_CANCELLED;
+    // 5. 羽化权重，离图片边缘越远权重越大，重叠区域平滑过渡
+    std::vector<Mat> weights(n);
+    Compute::parallelFor(n, [&](int i)
+    {
+        Mat mask(imgs[i].size(), CV_8U, cv::Scalar(255));
+        cv::rectangle(mask, cv::Rect(0, 0, mask.cols, mask.rows), cv::Scalar(0), 1);
+        cv::distanceTransform(mask, weights[i], cv::DIST_L2, 3);
+    });
+
+    // 6. 画布按行分块，每块只变形与它相交的图片，并行融合
+    pano.create(canvas, CV_8UC3);
+    int tileRows = std::max(1, std::min(STITCH_TILE_ROWS, STITCH_TILE_PIXELS / canvas.width));
+    int tiles = (canvas.height + tileRows - 1) / tileRows;
+    Compute::parallelFor(tiles, [&](int t)
+    {
+        int y0 = t * tileRows;
+        int rows = std::min(tileRows, canvas.height - y0);
+        cv::Rect tile(0, y0, canvas.width, rows);
+        Mat acc(rows, canvas.width, CV_32FC3, cv::Scalar::all(0));
+        Mat wsum(rows, canvas.width, CV_32F, cv::Scalar::all(0));
+        for (int i = 0; i < n; ++i)
+        {
+            cv::Rect roi = boxes[i] & tile;
+            if (roi.area() == 0)
+                continue;
+            Mat M = (cv::Mat_<double>(3, 3) << 1, 0, -roi.x, 0, 1, -roi.y, 0, 0, 1) * T[i];
+            Mat warped, w, wf, w3;
+            cv::warpPerspective(imgs[i], warped, M, roi.size(), cv::INTER_LINEAR, cv::BORDER_CONSTANT);
+            cv::warpPerspective(weights[i], w, M, roi.size(), cv::INTER_LINEAR, cv::BORDER_CONSTANT);
+            warped.convertTo(wf, CV_32FC3);
+            Mat ch[] = { w, w, w };
+            cv::merge(ch, 3, w3);
+            cv::Rect local(roi.x, roi.y - y0, roi.width, roi.height);
+            Mat accRoi = acc(local);
+            Mat wsumRoi = wsum(local);
+            accRoi += wf.mul(w3);
+            wsumRoi += w;
+        }
+        cv::max(wsum, 1e-6, wsum);
+        Mat ch[] = { wsum, wsum, wsum };
+        Mat w3, out;
+        cv::merge(ch, 3, w3);
+        cv::divide(acc, w3, out);
+        Mat dst = pano(tile);
+        out.convertTo(dst, CV_8U);
+    });
+    return STITCH_OK;
+}
+
+const char *ImageStitcher::error(int code)
+{
+    switch (code)
+    {
+        case STITCH_OK:
+            return "OK";
+        case STITCH_NO_IMAGE:
+            return "Bad image data";
+        case STITCH_NOT_ENOUGH_MATCHES:
+            return "Not enough matches between adjacent images";
+        case STITCH_BAD_HOMOGRAPHY:
+            return "Degenerate homography";
+        case STITCH_CANCELLED:
+            return "Cancelled";
+        case STITCH_TOO_LARGE:
+            return "Panorama too large";
+        default:
+            return "Stitch failed";
+    }
+}
@@ -0,0 +1,47 @@
+#pragma once
+#include <vector>
+#include <functional>
+#include <opencv2/core/core.hpp>
+
+const int STITCH_OK = 0;
+const int STITCH_NO_IMAGE = -1;
+const int STITCH_NOT_ENOUGH_MATCHES = -2;
+const int STITCH_BAD_HOMOGRAPHY = -3;
+const int STITCH_CANCELLED = -4;
+const int STITCH_TOO_LARGE = -5;
+
+// 特征检测时把图片缩到大约这么多像素
+const double STITCH_WORK_MEGAPIX = 0.6;
+// 每张图片提取的ORB特征点数
+const int STITCH_FEATURES = 2000;
+// 相邻两张图片至少要有这么多RANSAC内点
+const int STITCH_MIN_INLIERS = 12;
+// 变形和融合按这么多行一块并行处理
+const int STITCH_TILE_ROWS = 128;
+// 每块的累加缓冲区(每像素16字节)不超过这么多像素，画布很宽时少取几行
+const int STITCH_TILE_PIXELS = 1024 * 1024;
+// 结果画布的边长上限，超过说明单应矩阵退化
+const int STITCH_MAX_CANVAS = 16384;
+// 结果画布的像素上限：8位3通道约48MB，不超过Mat池缓存的单块上限，也远小于body的内存预算
+const size_t STITCH_MAX_CANVAS_PIXELS = 16 * 1024 * 1024;
+
+// 多张按从左到右(或从上到下)顺序给出、相邻两张有重叠的图片拼接成一张全景图。
+// 特征检测、相邻图片匹配、变形融合都在compute lane上并行执行。
+class ImageStitcher
+{
+private:
+    struct Features;
+    ImageStitcher();
+    ImageStitcher(const ImageStitcher &s);
+
+    static void normalize(const cv::Mat &src, cv::Mat &dst);
+    static void detect(const cv::Mat &img, Features &features);
+    static bool match(const Features &lhs, const Features &rhs, cv::Mat &H);
+
+public:
+    typedef std::function<bool()> CancelFn;
+    // 输入图片统一转成8位3通道，返回STITCH_OK或错误码；
+    // 每个阶段之间检查cancelled，请求方已经离开时提前结束
+    static int stitch(const std::vector<cv::Mat> &images, cv::Mat &pano, const CancelFn &cancelled = CancelFn());
+    static const char *error(int code);
+};
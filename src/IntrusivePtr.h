@@ -0,0 +1,67 @@
+#pragma once
+#include <stddef.h>
+
+// 侵入式引用计数的智能指针：计数放在对象自己身上，没有单独的控制块，
+// 加减计数由intrusivePtrAddRef/intrusivePtrRelease(按参数类型查找)完成，对象类型可以是不完整的。
+// 所有权交接时用移动，不改计数
+template <typename T>
+class IntrusivePtr
+{
+private:
+    T *ptr;
+
+public:
+    IntrusivePtr(): ptr(NULL) {}
+    explicit IntrusivePtr(T *p): ptr(p)
+    {
+        if (ptr)
+            intrusivePtrAddRef(ptr);
+    }
+    IntrusivePtr(const IntrusivePtr &other): ptr(other.ptr)
+    {
+        if (ptr)
+            intrusivePtrAddRef(ptr);
+    }
+    // noexcept，vector扩容时才会移动而不是拷贝
+    IntrusivePtr(IntrusivePtr &&other) noexcept: ptr(other.ptr)
+    {
+        other.ptr = NULL;
+    }
+    ~IntrusivePtr()
+    {
+        if (ptr)
+            intrusivePtrRelease(ptr);
+    }
+    // 按值传参，拷贝和移动赋值共用
+    IntrusivePtr &operator=(IntrusivePtr other)
+    {
+        swap(other);
+        return *this;
+    }
+    void swap(IntrusivePtr &other) noexcept
+    {
+        T *tmp = ptr;
+        ptr = other.ptr;
+        other.ptr = tmp;
+    }
+    void reset()
+    {
+        IntrusivePtr().swap(*this);
+    }
+    T *get() const
+    {
+        return ptr;
+    }
+    T *operator->() const
+    {
+        return ptr;
+    }
+    T &operator*() const
+    {
+        return *ptr;
+    }
+    explicit operator bool() const
+    {
+        return ptr != NULL;
+    }
+};
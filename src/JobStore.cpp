@@ -0,0 +1,224 @@
+#include "JobStore.h"
+#include "RequestData.h"
+#include "ImageService.h"
+#include "Compute.h"
+#include "TaskLane.h"
+#include <sys/time.h>
+#include <stdio.h>
+#include <random>
+using namespace std;
+
+MutexLock JobStore::lock;
+std::unordered_map<std::string, JobStore::jobPtr> JobStore::jobs;
+size_t JobStore::bytes = 0;
+size_t JobStore::nextSweep = 0;
+
+size_t JobStore::now()
+{
+    struct timeval now;
+    gettimeofday(&now, NULL);
+    return (now.tv_sec * 1000) + (now.tv_usec / 1000);
+}
+
+// 调用方持有lock
+string JobStore::newId()
+{
+    static mt19937_64 gen(random_device{}());
+    char buf[17];
+    string id;
+    do
+    {
+        snprintf(buf, sizeof(buf), "%016llx", static_cast<unsigned long long>(gen()));
+        id = buf;
+    } while (jobs.find(id) != jobs.end());
+    return id;
+}
+
+// 调用方持有lock
+void JobStore::dropBody(Job &job)
+{
+    if (job.computing)
+        return;
+    bytes -= job.body.size();
+    string().swap(job.body);
+}
+
+int JobStore::submit(const char *body, size_t length, const std::vector<int> &lengths,
+    const EncodeOptions &enc, jobPtr &job)
+{
+    job.reset(new Job());
+    {
+        MutexLockGuard guard(lock);
+        if (jobs.size() >= JOB_MAX || bytes + length > JOB_MAX_BYTES)
+            return JOB_STORE_FULL;
+        job->id = newId();
+        job->body.assign(body, length);
+        job->lengths = lengths;
+        job->enc = enc;
+        job->lastSeen = now();
+        bytes += length;
+        jobs[job->id] = job;
+    }
+    jobPtr j(job);
+    int ret = Compute::post([j]() { JobStore::run(j); });
+    if (ret == LANE_NOT_STARTED)
+    {
+        // 没有计算线程，在当前线程上算完，客户端照常轮询
+        run(job);
+        return JOB_OK;
+    }
+    if (ret < 0)
+    {
+        cancel(job->id);
+        return JOB_QUEUE_FULL;
+    }
+    return JOB_OK;
+}
+
+void JobStore::run(jobPtr job)
+{
+    {
+        MutexLockGuard guard(lock);
+        if (job->state != JOB_PENDING)
+            return;
+        job->state = JOB_RUNNING;
+        job->computing = true;
+    }
+    ResultCache::resultPtr result = ImageService::process(job->body.data(), job->lengths, job->enc,
+        [job]() { return job->cancelled.load(); });
+    finish(job, result);
+}
+
+void JobStore::finish(jobPtr job, const ResultCache::resultPtr &result)
+{
+    reqPtr waiter;
+    {
+        MutexLockGuard guard(lock);
+        job->computing = false;
+        dropBody(*job);
+        if (job->state == JOB_CANCELLED)
+            return;
+        if (job->cancelled)
+            job->state = JOB_CANCELLED;
+        else if (result->code == 200)
+        {
+            // 和结果缓存共享同一份数据
+            job->state = JOB_DONE;
+            job->result = result;
+            bytes += result->data.size();
+        }
+        else
+            job->state = JOB_FAILED;
+        job->code = result->code;
+        job->error = result->msg;
+        job->expire = now() + JOB_RESULT_TTL;
+        waiter.swap(job->waiter);
+    }
+    if (waiter)
+        RequestData::resumeJob(std::move(waiter), job);
+}
+
+JobStore::jobPtr JobStore::find(const std::string &id)
+{
+    MutexLockGuard guard(lock);
+    auto it = jobs.find(id);
+    if (it == jobs.end())
+        return jobPtr();
+    it->second->lastSeen = now();
+    return it->second;
+}
+
+JobStore::Status JobStore::status(const jobPtr &job)
+{
+    MutexLockGuard guard(lock);
+    Status s;
+    s.state = job->state;
+    s.code = job->code;
+    s.error = job->error;
+    return s;
+}
+
+bool JobStore::cancel(const std::string &id)
+{
+    jobPtr job;
+    reqPtr waiter;
+    {
+        MutexLockGuard guard(lock);
+        auto it = jobs.find(id);
+        if (it == jobs.end())
+            return false;
+        job = it->second;
+        jobs.erase(it);
+        job->cancelled = true;
+        if (job->state == JOB_PENDING || job->state == JOB_RUNNING)
+        {
+            job->state = JOB_CANCELLED;
+            job->error = "Cancelled";
+        }
+        // 正在计算的任务由finish释放body
+        dropBody(*job);
+        if (job->result)
+            bytes -= job->result->data.size();
+        waiter.swap(job->waiter);
+    }
+    if (waiter)
+        RequestData::resumeJob(std::move(waiter), job);
+    return true;
+}
+
+bool JobStore::wait(const jobPtr &job, reqPtr &waiter, int timeout)
+{
+    MutexLockGuard guard(lock);
+    if (job->state != JOB_PENDING && job->state != JOB_RUNNING)
+        return false;
+    // 同一个任务只挂起一个连接，后来的直接返回当前状态
+    if (job->waiter)
+        return false;
+    job->lastSeen = now();
+    job->waiter = std::move(waiter);
+    job->waitDeadline = job->lastSeen + timeout;
+    return true;
+}
+
+void JobStore::expire()
+{
+    size_t cur = now();
+    vector<pair<jobPtr, reqPtr> > woken;
+    {
+        MutexLockGuard guard(lock);
+        if (cur < nextSweep)
+            return;
+        nextSweep = cur + JOB_SWEEP_INTERVAL;
+        for (auto it = jobs.begin(); it != jobs.end(); )
+        {
+            Job &job = *it->second;
+            bool active = job.state == JOB_PENDING || job.state == JOB_RUNNING;
+            if (active && job.waiter && cur >= job.waitDeadline)
+            {
+                woken.push_back(make_pair(it->second, reqPtr()));
+                woken.back().second.swap(job.waiter);
+                job.lastSeen = cur;
+            }
+            if (active && !job.waiter && cur - job.lastSeen > static_cast<size_t>(JOB_IDLE_TTL))
+            {
+                // 提交方不再查询，停止计算，结果也不会有人取
+                job.cancelled = true;
+                job.state = JOB_CANCELLED;
+                job.error = "Abandoned";
+                job.expire = cur + JOB_RESULT_TTL;
+                ++it;
+            }
+            else if (!active && cur >= job.expire)
+            {
+                dropBody(job);
+                if (job.result)
+                    bytes -= job.result->data.size();
+                it = jobs.erase(it);
+            }
+            else
+                ++it;
+        }
+    }
+    for (size_t i = 0; i < woken.size(); ++i)
+        RequestData::resumeJob(std::move(woken[i].second), woken[i].first);
+}
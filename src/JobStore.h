@@ -0,0 +1,102 @@
+#pragma once
+#include "MutexLock.h"
+#include "ImageEncoder.h"
+#include "ResultCache.h"
+#include "RequestPtr.h"
+#include <string>
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <unordered_map>
+
+
+const int JOB_PENDING = 0;
+const int JOB_RUNNING = 1;
+const int JOB_DONE = 2;
+const int JOB_FAILED = 3;
+const int JOB_CANCELLED = 4;
+
+// 任务数上限
+const size_t JOB_MAX = 1024;
+// 所有任务的body和结果占用的内存上限
+const size_t JOB_MAX_BYTES = 512 * 1024 * 1024;
+// 结束的任务保留这么久(ms)等待取结果
+const int JOB_RESULT_TTL = 60 * 1000;
+// 未结束的任务这么久(ms)没有被查询，认为提交方已经离开，取消计算
+const int JOB_IDLE_TTL = 30 * 1000;
+// 长轮询最多挂起这么久(ms)
+const int JOB_WAIT_MAX = 30 * 1000;
+// 清理过期任务的间隔(ms)
+const int JOB_SWEEP_INTERVAL = 200;
+
+const int JOB_OK = 0;
+const int JOB_STORE_FULL = -1;
+const int JOB_QUEUE_FULL = -2;
+
+struct Job
+{
+    std::string id;
+    int state;
+    // 计算过程中检查，取消后尽快结束
+    std::atomic<bool> cancelled;
+    // 计算线程正在读body，这期间body不能释放
+    bool computing;
+    std::string body;
+    std::vector<int> lengths;
+    EncodeOptions enc;
+    // 结束后不再修改，读取前先在锁内确认状态
+    ResultCache::resultPtr result;
+    int code;
+    std::string error;
+    size_t expire;
+    size_t lastSeen;
+    // 长轮询挂起的连接，任务结束或者超时后唤醒
+    reqPtr waiter;
+    size_t waitDeadline;
+
+    Job(): state(JOB_PENDING), cancelled(false), computing(false), code(0), expire(0), lastSeen(0), waitDeadline(0) {}
+};
+
+// 异步图片任务：提交后立即返回任务id，结果通过GET或长轮询获取。
+// 计算在compute lane上执行，和连接数解耦；任务数和内存有上限，过期任务由主线程定期清理。
+class JobStore
+{
+public:
+    typedef std::shared_ptr<Job> jobPtr;
+
+    struct Status
+    {
+        int state;
+        int code;
+        std::string error;
+    };
+
+private:
+    static MutexLock lock;
+    static std::unordered_map<std::string, jobPtr> jobs;
+    static size_t bytes;
+    static size_t nextSweep;
+    JobStore();
+    JobStore(const JobStore &j);
+
+    static std::string newId();
+    static void run(jobPtr job);
+    static void finish(jobPtr job, const ResultCache::resultPtr &result);
+    static void dropBody(Job &job);
+
+public:
+    static size_t now();
+    // 拷贝body并提交到compute lane，返回JOB_OK或错误码
+    static int submit(const char *body, size_t length, const std::vector<int> &lengths,
+        const EncodeOptions &enc, jobPtr &job);
+    // 找不到返回空指针，查询同时刷新任务的活跃时间
+    static jobPtr find(const std::string &id);
+    static Status status(const jobPtr &job);
+    // 取消并删除任务，挂起的长轮询立即返回
+    static bool cancel(const std::string &id);
+    // 挂起连接直到任务结束或者超时，挂起时拿走waiter的所有权；
+    // 任务已经结束时返回false，调用方直接响应
+    static bool wait(const jobPtr &job, reqPtr &waiter, int timeout);
+    // 清理过期任务，唤醒超时的长轮询，主线程在每轮epoll_wait之后调用
+    static void expire();
+};
@@ -0,0 +1,38 @@
+#include "KeepAlive.h"
+
+int KeepAlive::maxConns = MAX_CONNS_DEFAULT;
+int KeepAlive::maxTimeout = KEEPALIVE_TIMEOUT_MS;
+std::atomic<int> KeepAlive::conns(0);
+
+void KeepAlive::setLimits(int maxConns_, int maxTimeoutMs)
+{
+    maxConns = maxConns_;
+    maxTimeout = maxTimeoutMs < KEEPALIVE_TIMEOUT_MIN_MS ? KEEPALIVE_TIMEOUT_MIN_MS : maxTimeoutMs;
+}
+
+int KeepAlive::fdTableSize(int maxConns_)
+{
+    int reserve = maxConns_ / 100 * FD_RESERVE_PERCENT;
+    return maxConns_ + (reserve > FD_RESERVE_MIN ? reserve : FD_RESERVE_MIN);
+}
+
+int KeepAlive::timeoutMs()
+{
+    long long n = conns.load(std::memory_order_relaxed);
+    long long low = static_cast<long long>(maxConns) * KEEPALIVE_PRESSURE_LOW / 100;
+    long long high = static_cast<long long>(maxConns) * KEEPALIVE_PRESSURE_HIGH / 100;
+    long long timeout = maxTimeout;
+    if (n >= high)
+        timeout = KEEPALIVE_TIMEOUT_MIN_MS;
+    else if (n > low)
+        timeout = maxTimeout - (maxTimeout - KEEPALIVE_TIMEOUT_MIN_MS) * (n - low) / (high - low);
+    // 头部以秒为单位
+    return static_cast<int>(timeout / 1000 * 1000);
+}
+
+int KeepAlive::excess()
+{
+    long long n = conns.load(std::memory_order_relaxed);
+    long long limit = static_cast<long long>(maxConns) * KEEPALIVE_EVICT_AT / 100;
+    return n > limit ? static_cast<int>(n - limit) : 0;
+}
@@ -0,0 +1,51 @@
+#pragma once
+#include <atomic>
+
+// 默认的最大连接数
+const int MAX_CONNS_DEFAULT = 1000;
+// 描述符表在最大连接数之外给非客户端的描述符(监听、epoll、日志，以及发送中的文件和body临时文件)
+// 留的余量：最大连接数的这个百分比，至少FD_RESERVE_MIN个
+const int FD_RESERVE_PERCENT = 25;
+const int FD_RESERVE_MIN = 64;
+
+// 默认的keep-alive空闲超时
+const int KEEPALIVE_TIMEOUT_MS = 5 * 60 * 1000;
+// 压力最大时缩短到的空闲超时
+const int KEEPALIVE_TIMEOUT_MIN_MS = 1000;
+// 连接数占上限的百分比：超过LOW开始缩短空闲超时，到HIGH时降到最小
+const int KEEPALIVE_PRESSURE_LOW = 50;
+const int KEEPALIVE_PRESSURE_HIGH = 90;
+// 超过上限的这个百分比时关闭最久空闲的连接，给新连接留出余量
+const int KEEPALIVE_EVICT_AT = 95;
+// 请求还没读完或者响应还没发完时的超时
+const int REQUEST_TIMEOUT_MS = 2000;
+
+// keep-alive的空闲超时随连接压力自适应：连接数接近上限时超时逐渐缩短，
+// 超过驱逐水位时由主线程关闭最久空闲的连接，接受新连接不用拒绝
+class KeepAlive
+{
+private:
+    static int maxConns;
+    static int maxTimeout;
+    // 当前打开的客户端连接数，主线程接受时加，关闭的线程减
+    static std::atomic<int> conns;
+    KeepAlive();
+    KeepAlive(const KeepAlive &k);
+
+public:
+    static void setLimits(int maxConns_, int maxTimeoutMs);
+    // 描述符表的大小：最大连接数加上非客户端描述符的余量
+    static int fdTableSize(int maxConns_);
+    static void opened()
+    {
+        conns.fetch_add(1, std::memory_order_relaxed);
+    }
+    static void closed()
+    {
+        conns.fetch_sub(1, std::memory_order_relaxed);
+    }
+    // 当前的空闲超时，取整到秒，和Keep-Alive头部宣告的一致
+    static int timeoutMs();
+    // 超过驱逐水位的连接数
+    static int excess();
+};
@@ -0,0 +1,243 @@
+#include "Logger.h"
+#include <pthread.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <sys/syscall.h>
+
+// 后台线程每次攒起来一起write的最大字节数
+static const size_t LOG_FLUSH_BYTES = 1024 * 1024;
+
+struct Logger::Stage
+{
+    char data[LOG_STAGE_BYTES];
+    // 生产者和消费者各自的下标放在不同的缓存行
+    std::atomic<size_t> head;
+    char pad1[64];
+    std::atomic<size_t> tail;
+    char pad2[64];
+    int tid;
+    long second;
+    char timeBuf[32];
+    Stage *next;
+};
+
+std::atomic<int> Logger::level(LOG_LEVEL_INFO);
+std::atomic<bool> Logger::running(false);
+int Logger::fd = STDOUT_FILENO;
+std::atomic<unsigned long> Logger::dropped(0);
+std::atomic<Logger::Stage*> Logger::stages(NULL);
+
+namespace
+{
+const char *names[] = { "DEBUG", "INFO ", "WARN ", "ERROR" };
+const char *keys[] = { "debug", "info", "warn", "error" };
+pthread_t flusher;
+
+long coarseSeconds(struct timespec *ts)
+{
+    clock_gettime(CLOCK_REALTIME_COARSE, ts);
+    return ts->tv_sec;
+}
+
+void writeAll(int fd, const char *data, size_t len)
+{
+    while (len > 0)
+    {
+        ssize_t n = ::write(fd, data, len);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return;
+        }
+        data += n;
+        len -= n;
+    }
+}
+}
+
+Logger::Stage *Logger::stage()
+{
+    static thread_local Stage *s = NULL;
+    if (s == NULL)
+    {
+        // 每个线程第一次写日志时创建，之后不再加锁也不再申请内存
+        s = new Stage();
+        s->head.store(0, std::memory_order_relaxed);
+        s->tail.store(0, std::memory_order_relaxed);
+        s->tid = static_cast<int>(syscall(SYS_gettid));
+        s->second = -1;
+        s->timeBuf[0] = '\0';
+        Stage *old = stages.load(std::memory_order_relaxed);
+        do
+        {
+            s->next = old;
+        } while (!stages.compare_exchange_weak(old, s, std::memory_order_release, std::memory_order_relaxed));
+    }
+    return s;
+}
+
+int Logger::start(const char *path)
+{
+    if (path != NULL && path[0] != '\0')
+    {
+        int f = open(path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+        if (f < 0)
+            return -1;
+        fd = f;
+    }
+    running = true;
+    if (pthread_create(&flusher, NULL, threadRun, NULL) != 0)
+    {
+        running = false;
+        return -1;
+    }
+    return 0;
+}
+
+void Logger::stop()
+{
+    if (!running.exchange(false))
+        return;
+    pthread_join(flusher, NULL);
+}
+
+void Logger::setLevel(int level_)
+{
+    level = level_;
+}
+
+int Logger::levelOf(const char *name)
+{
+    for (int i = 0; i < 4; ++i)
+    {
+        if (strcasecmp(name, keys[i]) == 0)
+            return i;
+    }
+    return -1;
+}
+
+bool Logger::allow(LogSite &site)
+{
+    struct timespec ts;
+    long now = coarseSeconds(&ts);
+    if (site.second.load(std::memory_order_relaxed) != now)
+    {
+        site.second.store(now, std::memory_order_relaxed);
+        site.count.store(0, std::memory_order_relaxed);
+    }
+    if (site.count.fetch_add(1, std::memory_order_relaxed) < LOG_SITE_RATE)
+        return true;
+    site.suppressed.fetch_add(1, std::memory_order_relaxed);
+    return false;
+}
+
+void Logger::write(int level_, const char *file, int line, unsigned suppressed, const char *fmt, ...)
+{
+    // %m要用调用方的errno
+    int savedErrno = errno;
+    Stage *s = stage();
+    struct timespec ts;
+    long now = coarseSeconds(&ts);
+    if (now != s->second)
+    {
+        struct tm tm;
+        gmtime_r(&ts.tv_sec, &tm);
+        strftime(s->timeBuf, sizeof(s->timeBuf), "%Y-%m-%d %H:%M:%S", &tm);
+        s->second = now;
+    }
+    const char *base = strrchr(file, '/');
+    base = base ? base + 1 : file;
+    char buf[LOG_LINE_MAX];
+    int n = snprintf(buf, LOG_LINE_MAX, "%s.%03ld %s %d %s:%d ", s->timeBuf, ts.tv_nsec / 1000000,
+        names[level_], s->tid, base, line);
+    va_list ap;
+    va_start(ap, fmt);
+    errno = savedErrno;
+    if (n < LOG_LINE_MAX)
+        n += vsnprintf(buf + n, LOG_LINE_MAX - n, fmt, ap);
+    va_end(ap);
+    if (suppressed > 0 && n < LOG_LINE_MAX)
+        n += snprintf(buf + n, LOG_LINE_MAX - n, " (%u suppressed)", suppressed);
+    if (n > LOG_LINE_MAX - 1)
+        n = LOG_LINE_MAX - 1;
+    buf[n++] = '\n';
+    errno = savedErrno;
+    if (!running.load(std::memory_order_relaxed))
+    {
+        // 后台线程还没启动或者已经停止
+        writeAll(fd, buf, n);
+        return;
+    }
+    size_t h = s->head.load(std::memory_order_relaxed);
+    size_t t = s->tail.load(std::memory_order_acquire);
+    if (LOG_STAGE_BYTES - (h - t) < static_cast<size_t>(n))
+    {
+        dropped.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    size_t idx = h & (LOG_STAGE_BYTES - 1);
+    size_t first = LOG_STAGE_BYTES - idx < static_cast<size_t>(n) ? LOG_STAGE_BYTES - idx : n;
+    memcpy(s->data + idx, buf, first);
+    memcpy(s->data, buf + first, n - first);
+    s->head.store(h + n, std::memory_order_release);
+}
+
+size_t Logger::drain(char *out, size_t cap)
+{
+    size_t used = 0;
+    for (Stage *s = stages.load(std::memory_order_acquire); s; s = s->next)
+    {
+        size_t h = s->head.load(std::memory_order_acquire);
+        size_t t = s->tail.load(std::memory_order_relaxed);
+        size_t avail = h - t;
+        // 只整段取走，保证一行不会被拆开
+        if (avail == 0 || avail > cap - used)
+            continue;
+        size_t idx = t & (LOG_STAGE_BYTES - 1);
+        size_t first = LOG_STAGE_BYTES - idx < avail ? LOG_STAGE_BYTES - idx : avail;
+        memcpy(out + used, s->data + idx, first);
+        memcpy(out + used + first, s->data, avail - first);
+        used += avail;
+        s->tail.store(h, std::memory_order_release);
+    }
+    return used;
+}
+
+void *Logger::threadRun(void *args)
+{
+    char *buf = new char[LOG_FLUSH_BYTES];
+    unsigned long reported = 0;
+    bool last = false;
+    while (!last)
+    {
+        // 停止后再取一遍，把剩下的写完
+        last = !running.load();
+        if (!last)
+            usleep(LOG_FLUSH_INTERVAL_MS * 1000);
+        size_t n;
+        while ((n = drain(buf, LOG_FLUSH_BYTES)) > 0)
+            writeAll(fd, buf, n);
+        unsigned long d = dropped.load(std::memory_order_relaxed);
+        if (d != reported)
+        {
+            char note[64];
+            int len = snprintf(note, sizeof(note), "logger: %lu lines dropped\n", d - reported);
+            writeAll(fd, note, len);
+            reported = d;
+        }
+    }
+    delete[] buf;
+    return NULL;
+}
+
+unsigned long Logger::droppedLines()
+{
+    return dropped.load(std::memory_order_relaxed);
+}
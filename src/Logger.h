@@ -0,0 +1,84 @@
+#pragma once
+#include <atomic>
+#include <stddef.h>
+
+const int LOG_LEVEL_DEBUG = 0;
+const int LOG_LEVEL_INFO = 1;
+const int LOG_LEVEL_WARN = 2;
+const int LOG_LEVEL_ERROR = 3;
+
+// 低于这个级别的日志在编译期去掉，连参数都不求值，例如-DLOG_MIN_LEVEL=0打开DEBUG
+#ifndef LOG_MIN_LEVEL
+#define LOG_MIN_LEVEL 1
+#endif
+
+// 每个线程暂存区的大小(2的幂)，满了之后新的日志直接丢弃并计数
+const size_t LOG_STAGE_BYTES = 64 * 1024;
+// 单条日志的最大长度，超过的截断
+const int LOG_LINE_MAX = 1024;
+// 后台线程把暂存区写出去的间隔
+const int LOG_FLUSH_INTERVAL_MS = 100;
+// 同一个调用点每秒最多输出的条数
+const unsigned LOG_SITE_RATE = 100;
+
+// 每个日志调用点一个，按秒限流
+struct LogSite
+{
+    std::atomic<long> second;
+    std::atomic<unsigned> count;
+    std::atomic<unsigned> suppressed;
+};
+
+// 异步日志：调用线程只格式化并拷贝进自己的无锁暂存区(单生产者单消费者环形缓冲)，
+// 时间取自vDSO的粗粒度时钟，请求路径上没有系统调用也不加锁。
+// 后台线程定期把各线程暂存区攒成一块再一次write出去；暂存区和输出缓冲区构成双缓冲，
+// 写文件的同时各线程继续往暂存区写。同一线程的日志保持顺序，不同线程之间按批交错
+class Logger
+{
+private:
+    struct Stage;
+    static std::atomic<int> level;
+    static std::atomic<bool> running;
+    static int fd;
+    static std::atomic<unsigned long> dropped;
+    // 所有线程的暂存区，只增不删(线程都和进程同生命周期)
+    static std::atomic<Stage*> stages;
+    Logger();
+    Logger(const Logger &l);
+
+    static Stage *stage();
+    static void *threadRun(void *args);
+    static size_t drain(char *out, size_t cap);
+
+public:
+    // 启动后台线程，path为空时写到标准输出；启动之前的日志直接write
+    static int start(const char *path);
+    static void stop();
+    static void setLevel(int level_);
+    static bool enabled(int level_)
+    {
+        return level_ >= level.load(std::memory_order_relaxed);
+    }
+    // 级别名字转成级别，不认识的返回-1
+    static int levelOf(const char *name);
+    static bool allow(LogSite &site);
+    static void write(int level_, const char *file, int line, unsigned suppressed, const char *fmt, ...)
+        __attribute__((format(printf, 5, 6)));
+    static unsigned long droppedLines();
+};
+
+#define LOG_AT(level_, fmt, ...) \
+    do \
+    { \
+        if ((level_) >= LOG_MIN_LEVEL && Logger::enabled(level_)) \
+        { \
+            static LogSite logSite_; \
+            if (Logger::allow(logSite_)) \
+                Logger::write(level_, __FILE__, __LINE__, logSite_.suppressed.exchange(0, std::memory_order_relaxed), fmt, ##__VA_ARGS__); \
+        } \
+    } while (0)
+
+#define LOG_DEBUG(fmt, ...) LOG_AT(LOG_LEVEL_DEBUG, fmt, ##__VA_ARGS__)
+#define LOG_INFO(fmt, ...) LOG_AT(LOG_LEVEL_INFO, fmt, ##__VA_ARGS__)
+#define LOG_WARN(fmt, ...) LOG_AT(LOG_LEVEL_WARN, fmt, ##__VA_ARGS__)
+#define LOG_ERROR(fmt, ...) LOG_AT(LOG_LEVEL_ERROR, fmt, ##__VA_ARGS__)
@@ -0,0 +1,210 @@
+#include "Metrics.h"
+#include "ThreadPool.h"
+#include "ResultCache.h"
+#include "BodySpool.h"
+#include "Logger.h"
+#include "AccessLog.h"
+#include "RequestPool.h"
+#include "Epoll.h"
+#include <new>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdarg.h>
+#include <time.h>
+using namespace std;
+
+struct Metrics::Local
+{
+    std::atomic<uint64_t> counters[METRIC_COUNTERS];
+    std::atomic<uint64_t> buckets[HISTOGRAMS][HIST_BUCKETS];
+    std::atomic<uint64_t> sums[HISTOGRAMS];
+    Local *next;
+};
+
+std::atomic<Metrics::Local*> Metrics::locals(NULL);
+
+namespace
+{
+struct Info
+{
+    const char *name;
+    const char *help;
+};
+const Info counterInfo[METRIC_COUNTERS] = {
+    { "server_connections_accepted_total", "Accepted connections" },
+    { "server_connections_closed_total", "Closed connections" },
+    { "server_requests_total", "Parsed requests" },
+    { "server_bytes_in_total", "Bytes read from clients" },
+    { "server_bytes_out_total", "Bytes written to clients" },
+    { "server_timer_expirations_total", "Connections closed by the idle timer" },
+    { "server_http_4xx_total", "Error responses with a 4xx status" },
+    { "server_http_5xx_total", "Error responses with a 5xx status" },
+    { "server_io_errors_total", "Socket read/write failures" },
+    { "server_queue_rejected_total", "Events dropped because the thread pool queue was full" },
+    { "server_connections_evicted_total", "Idle connections closed early because open connections neared the limit" },
+};
+const Info histInfo[HISTOGRAMS] = {
+    { "server_queue_wait_seconds", "Time an event waited in the thread pool queue" },
+    { "server_parse_seconds", "Time spent parsing the request line and headers" },
+    { "server_handler_seconds", "Time spent producing the response" },
+};
+
+int bucketOf(uint64_t v)
+{
+    if (v < (1ULL << HIST_MIN_SHIFT))
+        return 0;
+    int e = 63 - __builtin_clzll(v);
+    if (e >= HIST_MAX_SHIFT)
+        return HIST_BUCKETS - 1;
+    int sub = static_cast<int>(v >> (e - HIST_SUB_BITS)) & ((1 << HIST_SUB_BITS) - 1);
+    return 1 + ((e - HIST_MIN_SHIFT) << HIST_SUB_BITS) + sub;
+}
+
+// 桶的上界(不含)，纳秒
+uint64_t bucketBound(int i)
+{
+    if (i == 0)
+        return 1ULL << HIST_MIN_SHIFT;
+    int e = HIST_MIN_SHIFT + ((i - 1) >> HIST_SUB_BITS);
+    int sub = (i - 1) & ((1 << HIST_SUB_BITS) - 1);
+    return static_cast<uint64_t>((1 << HIST_SUB_BITS) + sub + 1) << (e - HIST_SUB_BITS);
+}
+
+void line(string &out, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+void line(string &out, const char *fmt, ...)
+{
+    char buf[256];
+    va_list ap;
+    va_start(ap, fmt);
+    int n = vsnprintf(buf, sizeof(buf), fmt, ap);
+    va_end(ap);
+    out.append(buf, n < static_cast<int>(sizeof(buf)) ? n : sizeof(buf) - 1);
+}
+
+void header(string &out, const char *name, const char *help, const char *type)
+{
+    line(out, "# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+}
+}
+
+Metrics::Local *Metrics::local()
+{
+    static thread_local Local *l = NULL;
+    if (l == NULL)
+    {
+        // 按缓存行对齐，不同线程的计数不会落在同一行上
+        void *p = NULL;
+        if (posix_memalign(&p, 64, sizeof(Local)) != 0)
+            abort();
+        memset(p, 0, sizeof(Local));
+        l = new (p) Local();
+        for (int i = 0; i < METRIC_COUNTERS; ++i)
+            l->counters[i].store(0, std::memory_order_relaxed);
+        for (int h = 0; h < HISTOGRAMS; ++h)
+        {
+            for (int i = 0; i < HIST_BUCKETS; ++i)
+                l->buckets[h][i].store(0, std::memory_order_relaxed);
+            l->sums[h].store(0, std::memory_order_relaxed);
+        }
+        Local *old = locals.load(std::memory_order_relaxed);
+        do
+        {
+            l->next = old;
+        } while (!locals.compare_exchange_weak(old, l, std::memory_order_release, std::memory_order_relaxed));
+    }
+    return l;
+}
+
+// 只有本线程写，读-改-写不需要原子指令
+static inline void bump(std::atomic<uint64_t> &c, uint64_t n)
+{
+    c.store(c.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+}
+
+void Metrics::add(int counter, uint64_t n)
+{
+    bump(local()->counters[counter], n);
+}
+
+void Metrics::observe(int histogram, uint64_t nanos)
+{
+    Local *l = local();
+    bump(l->buckets[histogram][bucketOf(nanos)], 1);
+    bump(l->sums[histogram], nanos);
+}
+
+uint64_t Metrics::now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+string Metrics::render()
+{
+    uint64_t counters[METRIC_COUNTERS] = { 0 };
+    uint64_t buckets[HISTOGRAMS][HIST_BUCKETS];
+    uint64_t sums[HISTOGRAMS] = { 0 };
+    memset(buckets, 0, sizeof(buckets));
+    for (Local *l = locals.load(std::memory_order_acquire); l; l = l->next)
+    {
+        for (int i = 0; i < METRIC_COUNTERS; ++i)
+            counters[i] += l->counters[i].load(std::memory_order_relaxed);
+        for (int h = 0; h < HISTOGRAMS; ++h)
+        {
+            for (int i = 0; i < HIST_BUCKETS; ++i)
+                buckets[h][i] += l->buckets[h][i].load(std::memory_order_relaxed);
+            sums[h] += l->sums[h].load(std::memory_order_relaxed);
+        }
+    }
+    string out;
+    out.reserve(32 * 1024);
+    for (int i = 0; i < METRIC_COUNTERS; ++i)
+    {
+        header(out, counterInfo[i].name, counterInfo[i].help, "counter");
+        line(out, "%s %llu\n", counterInfo[i].name, static_cast<unsigned long long>(counters[i]));
+    }
+    // 各线程的值不是同一时刻读的，关闭数可能暂时比接受数多
+    long long active = static_cast<long long>(counters[METRIC_ACCEPTED] - counters[METRIC_CLOSED]);
+    header(out, "server_connections_active", "Open client connections", "gauge");
+    line(out, "server_connections_active %lld\n", active > 0 ? active : 0);
+    header(out, "server_connections_idle", "Idle connections held as compact records without a request object", "gauge");
+    line(out, "server_connections_idle %d\n", Epoll::idleConns());
+    header(out, "server_keepalive_timeout_seconds", "Idle keep-alive timeout currently advertised", "gauge");
+    line(out, "server_keepalive_timeout_seconds %d\n", KeepAlive::timeoutMs() / 1000);
+    header(out, "server_threadpool_queue_depth", "Events waiting in the thread pool queue", "gauge");
+    line(out, "server_threadpool_queue_depth %d\n", ThreadPool::queued());
+    ResultCache::Stats cs = ResultCache::stats();
+    header(out, "server_result_cache_bytes", "Bytes held by the result cache", "gauge");
+    line(out, "server_result_cache_bytes %zu\n", cs.bytes);
+    header(out, "server_result_cache_hits_total", "Result cache hits", "counter");
+    line(out, "server_result_cache_hits_total %lu\n", cs.hits);
+    header(out, "server_result_cache_misses_total", "Result cache misses", "counter");
+    line(out, "server_result_cache_misses_total %lu\n", cs.misses);
+    header(out, "server_body_budget_bytes", "Request body bytes charged to the memory budget", "gauge");
+    line(out, "server_body_budget_bytes %zu\n", BodyBudget::used());
+    header(out, "server_request_pool_cached", "Idle connection objects held in the shared pool depot", "gauge");
+    line(out, "server_request_pool_cached %zu\n", RequestPool::cached());
+    header(out, "server_log_dropped_total", "Log lines dropped because a staging buffer was full", "counter");
+    line(out, "server_log_dropped_total %lu\n", Logger::droppedLines());
+    header(out, "server_access_log_dropped_total", "Access log records dropped because a staging buffer was full", "counter");
+    line(out, "server_access_log_dropped_total %lu\n", AccessLog::droppedRecords());
+    for (int h = 0; h < HISTOGRAMS; ++h)
+    {
+        const char *name = histInfo[h].name;
+        header(out, name, histInfo[h].help, "histogram");
+        uint64_t cumulative = 0;
+        for (int i = 0; i < HIST_BUCKETS - 1; ++i)
+        {
+            cumulative += buckets[h][i];
+            line(out, "%s_bucket{le=\"%.9g\"} %llu\n", name, bucketBound(i) / 1e9,
+                static_cast<unsigned long long>(cumulative));
+        }
+        cumulative += buckets[h][HIST_BUCKETS - 1];
+        line(out, "%s_bucket{le=\"+Inf\"} %llu\n", name, static_cast<unsigned long long>(cumulative));
+        line(out, "%s_sum %.9f\n", name, sums[h] / 1e9);
+        line(out, "%s_count %llu\n", name, static_cast<unsigned long long>(cumulative));
+    }
+    return out;
+}
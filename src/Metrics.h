@@ -0,0 +1,52 @@
+#pragma once
+#include <atomic>
+#include <string>
+#include <stdint.h>
+
+// 计数器
+const int METRIC_ACCEPTED = 0;
+const int METRIC_CLOSED = 1;
+const int METRIC_REQUESTS = 2;
+const int METRIC_BYTES_IN = 3;
+const int METRIC_BYTES_OUT = 4;
+const int METRIC_TIMER_EXPIRED = 5;
+const int METRIC_ERRORS_4XX = 6;
+const int METRIC_ERRORS_5XX = 7;
+const int METRIC_IO_ERRORS = 8;
+const int METRIC_QUEUE_REJECTED = 9;
+const int METRIC_EVICTED = 10;
+const int METRIC_COUNTERS = 11;
+
+// 延迟直方图，单位纳秒
+const int HIST_QUEUE_WAIT = 0;
+const int HIST_PARSE = 1;
+const int HIST_HANDLER = 2;
+const int HISTOGRAMS = 3;
+// HDR式的对数线性分桶：每个2的幂再等分成2^HIST_SUB_BITS个桶，相对误差不超过1/4
+const int HIST_SUB_BITS = 2;
+// 小于2^HIST_MIN_SHIFT纳秒(约1us)的都在第一个桶
+const int HIST_MIN_SHIFT = 10;
+// 不小于2^HIST_MAX_SHIFT纳秒(约68.7s)的进最后一个桶
+const int HIST_MAX_SHIFT = 36;
+const int HIST_BUCKETS = 2 + ((HIST_MAX_SHIFT - HIST_MIN_SHIFT) << HIST_SUB_BITS);
+
+// 服务器内部指标。每个线程写自己的一份(按缓存行对齐，单写者只做普通的load+store，没有锁前缀指令)，
+// 只有抓取/metrics时才把所有线程的值加起来，输出Prometheus文本格式
+class Metrics
+{
+private:
+    struct Local;
+    // 所有线程的计数，只增不删
+    static std::atomic<Local*> locals;
+    Metrics();
+    Metrics(const Metrics &m);
+
+    static Local *local();
+
+public:
+    static void add(int counter, uint64_t n = 1);
+    static void observe(int histogram, uint64_t nanos);
+    // 单调时钟，纳秒
+    static uint64_t now();
+    static std::string render();
+};
@@ -0,0 +1,156 @@
+#include "MultipartParser.h"
+#include <string.h>
+using namespace std;
+
+MultipartParser::MultipartParser(const std::string &boundary, MultipartHandler *handler_):
+    delimiter("\r\n--" + boundary),
+    state(sPreamble),
+    handler(handler_)
+{
+}
+
+string MultipartParser::boundaryOf(const std::string &contentType)
+{
+    if (strncasecmp(contentType.c_str(), "multipart/", 10) != 0)
+        return string();
+    size_t pos = contentType.find("boundary=");
+    if (pos == string::npos)
+        return string();
+    string b = contentType.substr(pos + 9);
+    if (!b.empty() && b[0] == '"')
+    {
+        size_t end = b.find('"', 1);
+        b = end == string::npos ? string() : b.substr(1, end - 1);
+    }
+    else
+    {
+        size_t end = b.find_first_of("; \t");
+        if (end != string::npos)
+            b = b.substr(0, end);
+    }
+    // RFC 2046限制boundary最长70个字符
+    if (b.size() > 70)
+        return string();
+    return b;
+}
+
+int MultipartParser::parseHeaders(const char *data, size_t len)
+{
+    const char *end = static_cast<const char*>(memmem(data, len, "\r\n\r\n", 4));
+    if (end == NULL)
+        return len > MULTIPART_MAX_HEADER ? MULTIPART_ERROR : 0;
+    HeaderMap headers;
+    const char *p = data;
+    while (p < end)
+    {
+        const char *eol = static_cast<const char*>(memmem(p, end - p + 2, "\r\n", 2));
+        const char *colon = static_cast<const char*>(memchr(p, ':', eol - p));
+        if (colon == NULL)
+            return MULTIPART_ERROR;
+        const char *v = colon + 1;
+        while (v < eol && (*v == ' ' || *v == '\t'))
+            ++v;
+        headers[string(p, colon)] = string(v, eol);
+        p = eol + 2;
+    }
+    handler->onPartBegin(headers);
+    state = sData;
+    return end + 4 - data;
+}
+
+int MultipartParser::feed(const char *data, size_t len)
+{
+    size_t used = 0;
+    while (used < len)
+    {
+        const char *p = data + used;
+        size_t left = len - used;
+        switch (state)
+        {
+            case sPreamble:
+            {
+                // 第一个分隔符可以出现在body开头，没有前导CRLF
+                const char *dash = delimiter.c_str() + 2;
+                size_t dlen = delimiter.size() - 2;
+                const char *hit = static_cast<const char*>(memmem(p, left, dash, dlen));
+                if (hit == NULL)
+                {
+                    // 保留可能是分隔符前缀的尾部
+                    if (left >= dlen)
+                        used += left - dlen + 1;
+                    return used;
+                }
+                size_t off = hit - p + dlen;
+                if (left < off + 2)
+                {
+                    used += hit - p;
+                    return used;
+                }
+                if (p[off] == '-' && p[off + 1] == '-')
+                {
+                    state = sDone;
+                    used += off + 2;
+                }
+                else if (p[off] == '\r' && p[off + 1] == '\n')
+                {
+                    state = sHeaders;
+                    used += off + 2;
+                }
+                else
+                    used += off;
+                break;
+            }
+            case sHeaders:
+            {
+                int n = parseHeaders(p, left);
+                if (n < 0)
+                    return MULTIPART_ERROR;
+                if (n == 0)
+                    return used;
+                used += n;
+                break;
+            }
+            case sData:
+            {
+                const char *hit = static_cast<const char*>(memmem(p, left, delimiter.data(), delimiter.size()));
+                if (hit == NULL)
+                {
+                    // 除了可能是分隔符前缀的尾部，其余都是part的数据
+                    if (left >= delimiter.size())
+                    {
+                        size_t n = left - delimiter.size() + 1;
+                        handler->onPartData(p, n);
+                        used += n;
+                    }
+                    return used;
+                }
+                if (hit > p)
+                {
+                    handler->onPartData(p, hit - p);
+                    used += hit - p;
+                }
+                // 分隔符之后是CRLF(下一个part)或者"--"(结束)
+                size_t off = delimiter.size();
+                if (len - used < off + 2)
+                    return used;
+                const char *q = data + used;
+                if (q[off] == '-' && q[off + 1] == '-')
+                    state = sDone;
+                else if (q[off] == '\r' && q[off + 1] == '\n')
+                    state = sHeaders;
+                else
+                    return MULTIPART_ERROR;
+                handler->onPartEnd();
+                used += off + 2;
+                break;
+            }
+            case sDone:
+            {
+                // 结束分隔符之后的内容忽略
+                used = len;
+                break;
+            }
+        }
+    }
+    return used;
+}
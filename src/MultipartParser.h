@@ -0,0 +1,51 @@
+#pragma once
+#include "HeaderMap.h"
+#include <string>
+#include <stddef.h>
+
+// 单个part的头部最大长度
+const size_t MULTIPART_MAX_HEADER = 8 * 1024;
+
+const int MULTIPART_ERROR = -1;
+
+class MultipartHandler
+{
+public:
+    virtual ~MultipartHandler() {}
+    virtual void onPartBegin(const HeaderMap &headers) = 0;
+    // 一个part的数据可能分多次回调
+    virtual void onPartData(const char *data, size_t len) = 0;
+    virtual void onPartEnd() = 0;
+};
+
+// 流式multipart解析器：数据到多少解析多少，part的数据直接交给handler，
+// 不需要把整个body缓存下来。只有可能是分隔符前缀的尾部字节会留到下一次。
+class MultipartParser
+{
+private:
+    enum State
+    {
+        sPreamble = 0,
+        sHeaders,
+        sData,
+        sDone
+    };
+    // "\r\n--boundary"，第一个分隔符前面没有CRLF
+    std::string delimiter;
+    State state;
+    MultipartHandler *handler;
+
+    int parseHeaders(const char *data, size_t len);
+
+public:
+    MultipartParser(const std::string &boundary, MultipartHandler *handler_);
+    // 返回消费的字节数，没有消费的部分下次带上新数据再传进来；格式错误返回MULTIPART_ERROR
+    int feed(const char *data, size_t len);
+    // 读到了结束分隔符
+    bool done() const
+    {
+        return state == sDone;
+    }
+    // 从Content-Type中取boundary，失败返回空串
+    static std::string boundaryOf(const std::string &contentType);
+};
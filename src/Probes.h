@@ -0,0 +1,32 @@
+#pragma once
+
+// 静态跟踪点(USDT)，provider为myserver。有sys/sdt.h(systemtap-sdt-dev)时编进二进制，
+// 每个跟踪点只是一条nop加上ELF note，没有挂探针时没有开销；
+// bpftrace/perf可以直接挂到运行中的进程上，示例见scripts/usdt。-DSERVER_NO_USDT可以关闭。
+//
+//   conn_accept(fd, addr)                   addr为网络字节序IPv4
+//   request_parsed(fd, method, pathLen, parseNanos)
+//   request_handled(fd, result, handlerNanos)  result同parseRequest的返回值
+//   response_done(fd, status, bytes, latencyNanos)  latency从读到请求第一个字节算起
+//   task_enqueue(task, depth)               task为放进线程池的对象地址
+//   task_dequeue(task, waitNanos)
+//   timer_fire(fd)                          空闲超时
+//   conn_close(fd)
+#if !defined(SERVER_NO_USDT) && defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define SERVER_USDT 1
+#endif
+#endif
+
+#ifdef SERVER_USDT
+#define SERVER_PROBE1(name, a1) DTRACE_PROBE1(myserver, name, a1)
+#define SERVER_PROBE2(name, a1, a2) DTRACE_PROBE2(myserver, name, a1, a2)
+#define SERVER_PROBE3(name, a1, a2, a3) DTRACE_PROBE3(myserver, name, a1, a2, a3)
+#define SERVER_PROBE4(name, a1, a2, a3, a4) DTRACE_PROBE4(myserver, name, a1, a2, a3, a4)
+#else
+#define SERVER_PROBE1(name, a1) ((void)0)
+#define SERVER_PROBE2(name, a1, a2) ((void)0)
+#define SERVER_PROBE3(name, a1, a2, a3) ((void)0)
+#define SERVER_PROBE4(name, a1, a2, a3, a4) ((void)0)
+#endif
@@ -1,18 +1,29 @@
 #include "RequestData.h"
+#include "Logger.h"
+#include "Metrics.h"
+#include "Probes.h"
 #include "util.h"
 #include "Epoll.h"
+#include "RequestPool.h"
+#include "FileCache.h"
+#include "KeepAlive.h"
+#include "SocketOpt.h"
+#include "DiskIO.h"
+#include "ImageService.h"
 #include <unistd.h>
 #include <fcntl.h>
 #include <sys/stat.h>
 #include <sys/mman.h>
+#include <sys/socket.h>
 #include <queue>
 #include <cstdlib>
+#include <string.h>
+#include <errno.h>
 #include <opencv/cv.h>
 #include <opencv2/core/core.hpp>
 #include <opencv2/highgui/highgui.hpp>
 #include <opencv2/opencv.hpp>
 using namespace cv;
-#include <iostream>
 using namespace std;
 
 pthread_once_t MimeType::once_control = PTHREAD_ONCE_INIT;
@@ -32,59 +43,278 @@ void MimeType::init()
     mime[".ico"] = "application/x-ico";
     mime[".jpg"] = "image/jpeg";
     mime[".png"] = "image/png";
+    mime[".webp"] = "image/webp";
     mime[".txt"] = "text/plain";
     mime[".mp3"] = "audio/mp3";
     mime["default"] = "text/html";
 }
 
-std::string MimeType::getMime(const std::string &suffix)
+const std::string &MimeType::getMime(StrView suffix)
 {
     pthread_once(&once_control, MimeType::init);
-    if (mime.find(suffix) == mime.end())
-        return mime["default"];
-    else
-        return mime[suffix];
+    // 已知的后缀都很短，查找用的key在std::string的内联缓冲区里，不申请内存
+    if (suffix.size() <= MIME_SUFFIX_MAX)
+    {
+        auto it = mime.find(std::string(suffix.data(), suffix.size()));
+        if (it != mime.end())
+            return it->second;
+    }
+    return mime.find("default")->second;
+}
+
+void intrusivePtrAddRef(RequestData *req)
+{
+    req->refs.fetch_add(1, std::memory_order_relaxed);
+}
+
+void intrusivePtrRelease(RequestData *req)
+{
+    // 最后一个持有者放手，关闭连接并把对象还给池
+    if (req->refs.fetch_sub(1, std::memory_order_acq_rel) == 1)
+        RequestPool::put(req);
 }
 
 RequestData::RequestData(): 
+    refs(0),
+    poolNext(NULL),
+    fd(-1),
+    epollfd(-1),
+    bodyFd(-1),
+    bodyOffset(0),
+    bodyLeft(0),
+    corked(false),
+    warmEnd(0),
+    diskPending(false),
+    events(0),
+    error(false),
     readPos(0), 
     state(STATE_PARSE_URI), 
     hState(hStart), 
     keepAlive(false), 
+    idleTimeout(KEEPALIVE_TIMEOUT_MS),
+    parseNanos(0),
+    traced(false),
+    reqStart(0),
+    accessStart(0),
+    accessPending(false),
     isAbleRead(true),
     isAbleWrite(false),
-    events(0),
-    error(false)
+    isAbleReap(false),
+    waitTimeout(0),
+    bodyReceived(0),
+    bodyLength(0),
+    bodyCharge(0),
+    bodyWait(0),
+    chunked(false)
 {
-    cout << "RequestData constructor()" << endl;
+    memset(&access, 0, sizeof(access));
 }
 
 RequestData::RequestData(int _epollfd, int _fd, std::string _path):
+    refs(0),
+    poolNext(NULL),
+    path(_path), 
+    fd(_fd), 
+    epollfd(_epollfd),
+    bodyFd(-1),
+    bodyOffset(0),
+    bodyLeft(0),
+    corked(false),
+    warmEnd(0),
+    diskPending(false),
+    events(0),
+    error(false),
     readPos(0), 
     state(STATE_PARSE_URI), 
     hState(hStart), 
     keepAlive(false), 
-    path(_path), 
-    fd(_fd), 
-    epollfd(_epollfd),
+    idleTimeout(KEEPALIVE_TIMEOUT_MS),
+    parseNanos(0),
+    traced(false),
+    reqStart(0),
+    accessStart(0),
+    accessPending(false),
     isAbleRead(true),
     isAbleWrite(false),
-    events(0),
-    error(false)
+    isAbleReap(false),
+    waitTimeout(0),
+    bodyReceived(0),
+    bodyLength(0),
+    bodyCharge(0),
+    bodyWait(0),
+    chunked(false)
 {
-    cout << "RequestData constructor()" << endl;
+    memset(&access, 0, sizeof(access));
+    LOG_DEBUG("fd %d request created", fd);
 }
 
 RequestData::~RequestData()
 {
-    cout << "~RequestData()" << endl;
+    // 池中的空闲对象已经关闭过了
+    if (fd >= 0)
+        closeConn();
+}
+
+void RequestData::closeConn()
+{
+    LOG_DEBUG("fd %d request destroyed", fd);
+    Metrics::add(METRIC_CLOSED);
+    if (traced)
+        Tracer::submit(trace);
+    if (accessPending)
+        accessEnd();
+    SERVER_PROBE1(conn_close, fd);
+    KeepAlive::closed();
+    seperateTimer();
+    closeBody();
+    freeBody();
+    if (batch)
+        batch->cancel();
+    if (zc.waiting())
+    {
+        // 还有数据被内核引用，直接RST丢弃发送队列，避免释放后的内存被发出去。
+        // 对端还在确认数据时超时不会走到这里(见Epoll::expireConn)，只有出错或者对端停滞太久
+        struct linger lg = { 1, 0 };
+        setsockopt(fd, SOL_SOCKET, SO_LINGER, &lg, sizeof(lg));
+    }
     close(fd);
+    fd = -1;
+}
+
+void RequestData::recycle()
+{
+    // 降级成空闲记录的连接已经把描述符交给了epoll
+    if (fd >= 0)
+        closeConn();
+    // 恢复成刚构造时的状态，缓冲区的块回到线程的块池，字符串保留容量
+    reset();
+    outBuf.clear();
+    zc.reset();
+    accessUri.clear();
+    memset(&access, 0, sizeof(access));
+    accessStart = 0;
+    accessPending = false;
+    traced = false;
+    keepAlive = false;
+    isAbleRead = true;
+    isAbleWrite = false;
+    isAbleReap = false;
+    events = 0;
+    error = false;
+    corked = false;
+    diskPending = false;
+    waitJob.reset();
+    waitTimeout = 0;
+    batch.reset();
+    idleTimeout = KEEPALIVE_TIMEOUT_MS;
+}
+
+void RequestData::reuse(int _epollfd, int _fd, const std::string &_path)
+{
+    epollfd = _epollfd;
+    fd = _fd;
+    path = _path;
+    LOG_DEBUG("fd %d request created", fd);
+}
+
+void RequestData::closeBody()
+{
+    if (bodyFd >= 0)
+    {
+        close(bodyFd);
+        bodyFd = -1;
+    }
+    bodyOffset = 0;
+    bodyLeft = 0;
+    warmEnd = 0;
+}
+
+void RequestData::traceWake()
+{
+    // 上一个响应还没发完就来了新数据，先把上一个请求交出去
+    if (traced && trace.stamps[TRACE_HANDLER] != 0)
+        traceEnd();
+    if (!traced && state == STATE_PARSE_URI && inBuf.empty())
+    {
+        uint64_t id = Tracer::sample();
+        if (id != 0)
+        {
+            traced = true;
+            memset(&trace, 0, sizeof(trace));
+            trace.id = id;
+            trace.fd = fd;
+        }
+    }
+    traceMark(TRACE_WAKEUP);
+}
+
+void RequestData::traceEnd()
+{
+    Tracer::submit(trace);
+    traced = false;
+}
+
+// 响应状态行中的状态码，还没有状态行时返回0
+static uint16_t responseStatus(const Buffer &buf)
+{
+    if (buf.contiguousSize() < 12)
+        return 0;
+    const char *p = buf.peek();
+    if (memcmp(p, "HTTP/1.", 7) != 0 || p[8] != ' ')
+        return 0;
+    int status = 0;
+    for (int i = 9; i < 12; ++i)
+    {
+        if (p[i] < '0' || p[i] > '9')
+            return 0;
+        status = status * 10 + (p[i] - '0');
+    }
+    return static_cast<uint16_t>(status);
 }
 
-void RequestData::linkTimer(shared_ptr<Timer> timer_)
+void RequestData::setPeer(uint32_t addr)
 {
-    // 使用了weak_ptr
-    timer = timer_;
+    access.addr = addr;
+}
+
+void RequestData::accessBegin()
+{
+    // 上一个响应还没发完，先把它记下来
+    if (accessPending)
+        accessEnd();
+    access.status = 0;
+    access.bytes = 0;
+    access.method = static_cast<uint8_t>(method);
+    access.version = static_cast<uint8_t>(HTTPversion);
+    access.uriLen = 0;
+    if (AccessLog::enabled())
+    {
+        accessUri.assign(1, '/');
+        accessUri.append(fileName.data(), fileName.size());
+        if (!query.empty())
+        {
+            accessUri.push_back('?');
+            accessUri.append(query.data(), query.size());
+        }
+        access.uriLen = static_cast<uint16_t>(accessUri.size() < ACCESS_URI_MAX ? accessUri.size() : ACCESS_URI_MAX);
+    }
+    accessStart = reqStart;
+    accessPending = true;
+}
+
+void RequestData::accessEnd()
+{
+    accessPending = false;
+    uint64_t latency = Metrics::now() - accessStart;
+    SERVER_PROBE4(response_done, fd, access.status, access.bytes, latency);
+    if (!AccessLog::enabled())
+        return;
+    uint64_t duration = latency / 1000;
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME_COARSE, &ts);
+    access.time = ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000 - duration;
+    access.duration = static_cast<uint32_t>(duration < 0xffffffffULL ? duration : 0xffffffffULL);
+    AccessLog::append(access, accessUri.data());
 }
 
 int RequestData::getFd()
@@ -98,40 +328,40 @@ void RequestData::setFd(int _fd)
 
 void RequestData::reset()
 {
+    freeBody();
     inBuf.clear();
-    fileName.clear();
+    fileName = StrView();
+    query = StrView();
     path.clear();
     readPos = 0;
     state = STATE_PARSE_URI;
     hState = hStart;
+    // 请求结束，URI和头部所在的内存整体回收
     headers.clear();
-    if (timer.lock())
-    {
-        shared_ptr<Timer> my_timer(timer.lock());
-        my_timer->clearReq();
-        timer.reset();
-    }
+    arena.reset();
+    parseNanos = 0;
+    reqStart = 0;
+    seperateTimer();
 }
 
 void RequestData::seperateTimer()
 {
-    //cout << "seperateTimer" << endl;
-    if (timer.lock())
-    {
-        shared_ptr<Timer> my_timer(timer.lock());
-        my_timer->clearReq();
-        timer.reset();
-    }
+    Epoll::cancelTimer(fd);
 }
 
 void RequestData::handleRead()
 {
     do
     {
-        int read_num = readn(fd, inBuf);
+        int read_num;
+        if (spool.active())
+            read_num = spool.readFd(fd);
+        else
+            read_num = readn(fd, inBuf, readLimit());
         if (read_num < 0)
         {
-            perror("1");
+            LOG_DEBUG("fd %d read failed", fd);
+            Metrics::add(METRIC_IO_ERRORS);
             error = true;
             handleError(fd, 400, "Bad Request");
             break;
@@ -143,15 +373,22 @@ void RequestData::handleRead()
             error = true;
             break; 
         }
+        Metrics::add(METRIC_BYTES_IN, read_num);
 
+        uint64_t parseStart = Metrics::now();
+        if (reqStart == 0)
+            reqStart = parseStart;
         if (state == STATE_PARSE_URI)
         {
             int flag = this->parseURI();
             if (flag == PARSE_URI_AGAIN)
+            {
+                parseNanos += Metrics::now() - parseStart;
                 break;
+            }
             else if (flag == PARSE_URI_ERROR)
             {
-                perror("2");
+                LOG_DEBUG("fd %d bad request line", fd);
                 error = true;
                 handleError(fd, 400, "Bad Request");
                 break;
@@ -163,18 +400,75 @@ void RequestData::handleRead()
         {
             int flag = this->parseHeaders();
             if (flag == PARSE_HEADER_AGAIN)
+            {
+                parseNanos += Metrics::now() - parseStart;
                 break;
+            }
             else if (flag == PARSE_HEADER_ERROR)
             {
-                perror("3");
+                LOG_DEBUG("fd %d bad headers", fd);
                 error = true;
                 handleError(fd, 400, "Bad Request");
                 break;
             }
+            uint64_t parsed = parseNanos + Metrics::now() - parseStart;
+            Metrics::observe(HIST_PARSE, parsed);
+            traceMark(TRACE_PARSE);
+            SERVER_PROBE4(request_parsed, fd, method, fileName.size(), parsed);
             if(method == METHOD_POST)
             {
-                // POST方法准备
+                // POST方法准备，body之后直接读进一块连续内存，解码时不用再拷贝
                 state = STATE_RECV_BODY;
+                size_t content_length = 0;
+                StrView val;
+                // 同时出现时以Transfer-Encoding为准
+                if (headers.get("Transfer-Encoding", val))
+                    chunked = strcasestr(val.data(), "chunked") != NULL;
+                // 长度由客户端给出，预留内存之前先检查格式和上限，之后都用检查过的bodyLength
+                if (!chunked && headers.get("Content-length", val))
+                {
+                    if (!val.toSize(static_cast<size_t>(-1), content_length))
+                    {
+                        error = true;
+                        handleError(fd, 400, "Bad Request: Bad Content-length");
+                        break;
+                    }
+                    if (content_length > BodyBudget::getMaxBody())
+                    {
+                        error = true;
+                        handleError(fd, 413, "Payload Too Large");
+                        break;
+                    }
+                }
+                bodyLength = content_length;
+                if (fileName == "batch")
+                {
+                    // 批量上传流式处理，不缓存整个body
+                    if (startBatch() < 0)
+                    {
+                        error = true;
+                        break;
+                    }
+                    bodyHandler = batch;
+                }
+                else if (chunked)
+                {
+                    // 拼接需要整个body连续存放，事先不知道长度无法预留
+                    error = true;
+                    handleError(fd, 411, "Length Required");
+                    break;
+                }
+                else if (content_length > 0)
+                {
+                    if (startBody(content_length) < 0)
+                    {
+                        error = true;
+                        break;
+                    }
+                    // 内存预算不够，暂停读，由handleConn挂起
+                    if (bodyWait > 0)
+                        break;
+                }
             }
             else 
             {
@@ -183,24 +477,58 @@ void RequestData::handleRead()
         }
         if (state == STATE_RECV_BODY)
         {
-            int content_length = -1;
-            if (headers.find("Content-length") != headers.end())
+            if (bodyHandler)
             {
-                content_length = stoi(headers["Content-length"]);
+                int ret = feedBody();
+                if (ret < 0)
+                {
+                    error = true;
+                    break;
+                }
+                else if (ret == 0)
+                {
+                    // 批量上传的part边接收边计入预算，超过预算时和普通body一样停止读，排队等预算
+                    if (batch && BodyBudget::overBudget())
+                    {
+                        BodyBudget::release(bodyCharge);
+                        bodyCharge = 0;
+                        bodyWait = BODY_READ_SLICE;
+                    }
+                    break;
+                }
+                state = STATE_ANALYSIS;
             }
             else
             {
-                error = true;
-                handleError(fd, 400, "Bad Request: Lack of argument (Content-length)");
-                break;
+                if (!headers.has("Content-length"))
+                {
+                    error = true;
+                    handleError(fd, 400, "Bad Request: Lack of argument (Content-length)");
+                    break;
+                }
+                if (spool.active())
+                {
+                    if (!spool.full())
+                        break;
+                }
+                else if (inBuf.size() < bodyLength)
+                    break;
+                state = STATE_ANALYSIS;
             }
-            if (inBuf.size() < content_length)
-                break;
-            state = STATE_ANALYSIS;
         }
         if (state == STATE_ANALYSIS)
         {
+            traceMark(TRACE_READ);
+            uint64_t handlerStart = Metrics::now();
             int flag = this->parseRequest();
+            uint64_t handled = Metrics::now() - handlerStart;
+            Metrics::observe(HIST_HANDLER, handled);
+            traceMark(TRACE_HANDLER);
+            SERVER_PROBE3(request_handled, fd, flag, handled);
+            // 出错时handleError已经记过了
+            if (flag == ANALYSIS_SUCCESS)
+                accessBegin();
+            Metrics::add(METRIC_REQUESTS);
             if (flag == ANALYSIS_SUCCESS)
             {
                 state = STATE_FINISH;
@@ -216,11 +544,11 @@ void RequestData::handleRead()
 
     if (!error)
     {
-        if (outBuf.size() > 0)
+        if (outBuf.size() > 0 || bodyLeft > 0 || zc.sending())
             events |= EPOLLOUT;
         if (state == STATE_FINISH)
         {
-            cout << "keepAlive=" << keepAlive << endl;
+            LOG_DEBUG("fd %d request done, keepAlive=%d", fd, keepAlive);
             if (keepAlive)
             {
                 this->reset();
@@ -238,31 +566,185 @@ void RequestData::handleWrite()
 {
     if (!error)
     {
-        if (writen(fd, outBuf) < 0)
+        if (bodyLeft > 0 && !corked)
+        {
+            // 头部和文件内容合并成整报文发送
+            SocketOpt::cork(fd);
+            corked = true;
+        }
+        if (accessPending && access.status == 0)
+            access.status = responseStatus(outBuf);
+        ssize_t written = writen(fd, outBuf);
+        if (written > 0)
         {
-            perror("writen");
+            Metrics::add(METRIC_BYTES_OUT, written);
+            access.bytes += written;
+        }
+        if (written < 0)
+        {
+            LOG_DEBUG("fd %d write: %m", fd);
+            Metrics::add(METRIC_IO_ERRORS);
             events = 0;
             error = true;
         }
         else if (outBuf.size() > 0)
             events |= EPOLLOUT;
+        else if (bodyLeft > 0)
+        {
+            if (bodyOffset >= warmEnd)
+            {
+                size_t window = bodyLeft < DISK_WARM_WINDOW ? bodyLeft : DISK_WARM_WINDOW;
+                warmEnd = bodyOffset + window;
+                if (!DiskIO::resident(bodyFd, bodyOffset, window))
+                {
+                    // 冷文件不在工作线程上等磁盘，由handleConn交给磁盘线程
+                    diskPending = true;
+                    return;
+                }
+            }
+            size_t left = bodyLeft;
+            int ret = sendfilen(fd, bodyFd, bodyOffset, bodyLeft);
+            Metrics::add(METRIC_BYTES_OUT, left - bodyLeft);
+            access.bytes += left - bodyLeft;
+            if (ret < 0)
+            {
+                LOG_DEBUG("fd %d sendfile: %m", fd);
+                Metrics::add(METRIC_IO_ERRORS);
+                events = 0;
+                error = true;
+            }
+            else if (bodyLeft > 0)
+                events |= EPOLLOUT;
+            else
+                closeBody();
+        }
+        else if (zc.sending())
+        {
+            ssize_t sent = zc.send(fd);
+            if (sent > 0)
+            {
+                Metrics::add(METRIC_BYTES_OUT, sent);
+                access.bytes += sent;
+            }
+            if (sent < 0)
+            {
+                LOG_DEBUG("fd %d zerocopy send: %m", fd);
+                Metrics::add(METRIC_IO_ERRORS);
+                events = 0;
+                error = true;
+            }
+            else if (zc.sending())
+                events |= EPOLLOUT;
+        }
+        if (corked && bodyLeft == 0)
+        {
+            SocketOpt::uncork(fd);
+            corked = false;
+        }
+    }
+}
+
+void RequestData::handleErrQueue()
+{
+    isAbleReap = false;
+    if (!error)
+    {
+        if (zc.reap(fd) < 0)
+        {
+            LOG_WARN("fd %d zerocopy reap: %m", fd);
+            error = true;
+            return;
+        }
+        // 完成通知可能在响应还没发完时到达
+        if (outBuf.size() > 0 || bodyLeft > 0 || zc.sending())
+            events |= EPOLLOUT;
     }
 }
 
-void RequestData::handleConn()
+void RequestData::handleConn(reqPtr &self)
 {
     if (!error)
     {
+        if ((traced || accessPending) && outBuf.size() == 0 && bodyLeft == 0 && !zc.sending() && !batch && !waitJob)
+        {
+            // 响应已经发完
+            if (traced && trace.stamps[TRACE_HANDLER] != 0)
+            {
+                traceMark(TRACE_WRITE);
+                traceEnd();
+            }
+            if (accessPending)
+                accessEnd();
+        }
+        if (bodyWait > 0)
+        {
+            size_t bytes = bodyWait;
+            bodyWait = 0;
+            // 先清掉本线程的状态，挂起之后释放预算的线程随时可能唤醒连接
+            events = 0;
+            isAbleRead = false;
+            isAbleWrite = false;
+            // 接收到一半的part随连接一起挂起，排队时要告诉预算，避免挂起的连接互相等
+            if (!BodyBudget::acquire(bytes, self, batch ? batch->heldBudget() : 0))
+                return;
+            bodyCharge = bytes;
+            // 流式处理的body不需要连续存放
+            if (!bodyHandler)
+                inBuf.reserve(bytes);
+            events = EPOLLIN;
+        }
+        if (waitJob)
+        {
+            shared_ptr<Job> job;
+            job.swap(waitJob);
+            isAbleRead = false;
+            isAbleWrite = false;
+            // 挂起期间连接不在epoll中也没有定时器，由JobStore负责唤醒；挂起之后不能再访问连接
+            __uint32_t saved = events;
+            events = 0;
+            if (JobStore::wait(job, self, waitTimeout))
+                return;
+            appendJobResponse(job);
+            events = saved | EPOLLOUT;
+        }
+        if (batch && outBuf.size() == 0 && bodyLeft == 0 && !zc.sending() && batch->isResponding())
+        {
+            // 先清掉本线程的状态，挂起之后计算线程随时可能唤醒连接
+            __uint32_t saved = events;
+            events = 0;
+            isAbleRead = false;
+            isAbleWrite = false;
+            int ret = batch->take(outBuf, self);
+            if (ret == BATCH_PARKED)
+                return;
+            if (ret == BATCH_DONE)
+                batch.reset();
+            events = saved | EPOLLOUT;
+        }
+        if (diskPending)
+        {
+            diskPending = false;
+            isAbleRead = false;
+            isAbleWrite = false;
+            // 磁盘线程持有一份引用，冷路径上多一次计数无妨
+            reqPtr waker(self);
+            if (DiskIO::warm(bodyFd, bodyOffset, warmEnd - bodyOffset, [waker]() { resumeWrite(waker); }) == 0)
+            {
+                self.reset();
+                return;
+            }
+            // 没有磁盘线程或者队列已满，退回到在工作线程上直接发送
+            events |= EPOLLOUT;
+        }
         if (events != 0)
         {
             // 一定要先加时间信息，否则可能会出现double free错误。
             // 新增时间信息
-            int timeout = 2000;
-            if (keepAlive)
-                timeout = 5 * 60 * 1000;
+            int timeout = REQUEST_TIMEOUT_MS;
+            if (keepAlive && idleTimeout > timeout)
+                timeout = idleTimeout;
             isAbleRead = false;
             isAbleWrite = false;
-            Epoll::addTimer(shared_from_this(), timeout);
             if ((events & EPOLLIN) && (events & EPOLLOUT))
             {
                 events = __uint32_t(0);
@@ -271,113 +753,165 @@ void RequestData::handleConn()
             events |= (EPOLLET | EPOLLONESHOT);
             __uint32_t _events = events;
             events = 0;
-            if (Epoll::epollMod(fd, shared_from_this(), _events) < 0)
-            {
-                printf("Epoll::epoll_mod error\n");
-            }
+            rearm(self, timeout, _events);
         }
         else if (keepAlive)
         {
-            events |= (EPOLLIN | EPOLLET | EPOLLONESHOT);
-            int timeout = 5 * 60 * 1000;
+            // 和响应中宣告的一致
+            int timeout = idleTimeout;
             isAbleRead = false;
             isAbleWrite = false;
-            Epoll::addTimer(shared_from_this(), timeout);
-            __uint32_t _events = events;
-            events = 0;
-            if (Epoll::epollAdd(fd, shared_from_this(), _events) < 0)
+            if (isIdle())
             {
-                printf("Epoll::epoll_mod error\n");
+                park(self, timeout);
+                return;
             }
+            events |= (EPOLLIN | EPOLLET | EPOLLONESHOT);
+            __uint32_t _events = events;
+            events = 0;
+            // 描述符仍在epoll中(EPOLLONESHOT只是禁用)，重新激活要用MOD
+            rearm(self, timeout, _events);
+        }
+        else if (zc.waiting())
+        {
+            // 响应已发完，只等零拷贝的完成通知，EPOLLERR不需要注册也会报告。
+            // 定时器只是检查点，对端还在确认数据时到期后继续等
+            isAbleRead = false;
+            isAbleWrite = false;
+            rearm(self, REQUEST_TIMEOUT_MS, EPOLLET | EPOLLONESHOT);
         }
     }
 }
 
+void RequestData::rearm(reqPtr &self, int timeout, __uint32_t events_)
+{
+    int fd_ = self->fd;
+    // 一定要先加时间信息：注册之后连接随时可能被主线程交给别的线程
+    Epoll::addTimer(self.get(), timeout);
+    if (Epoll::epollMod(fd_, self, events_) < 0)
+    {
+        // 所有权还在self，调用方放手时关闭连接
+        LOG_ERROR("fd %d rearm failed", fd_);
+    }
+}
+
+bool RequestData::isIdle() const
+{
+    return state == STATE_PARSE_URI && inBuf.empty() && outBuf.empty() && bodyLeft == 0 && !zc.waiting() &&
+        !batch && !waitJob && !bodyHandler && bodyWait == 0 && !traced && !accessPending;
+}
+
+void RequestData::park(reqPtr &self, int timeout)
+{
+    int fd_ = self->fd;
+    Epoll::addTimer(self.get(), timeout);
+    // 激活之前先把描述符摘下来：激活后主线程随时可能为它重建新的对象
+    self->fd = -1;
+    if (Epoll::epollPark(fd_, self->access.addr, EPOLLIN | EPOLLET | EPOLLONESHOT) < 0)
+    {
+        // 所有权还在self，放手时关闭连接
+        self->fd = fd_;
+        return;
+    }
+    self.reset();
+}
+
+// 磁盘线程读完文件区间后调用，socket可写时EPOLLOUT会立即触发
+void RequestData::resumeWrite(reqPtr self)
+{
+    rearm(self, REQUEST_TIMEOUT_MS, EPOLLOUT | EPOLLET | EPOLLONESHOT);
+}
+
+// 在释放预算的线程上调用
+void RequestData::resumeBody(reqPtr self, size_t bytes)
+{
+    self->bodyCharge = bytes;
+    if (!self->bodyHandler)
+        self->inBuf.reserve(bytes);
+    rearm(self, REQUEST_TIMEOUT_MS, EPOLLIN | EPOLLET | EPOLLONESHOT);
+}
+
+// 可能在计算线程或者主线程上调用
+void RequestData::resumeJob(reqPtr self, shared_ptr<Job> job)
+{
+    self->appendJobResponse(job);
+    resumeWrite(std::move(self));
+}
+
 // 解析请求URI
 int RequestData::parseURI()
 {
-    string &str = inBuf;
     // 读到完整的请求行再开始解析请求
-    int pos = str.find('\r', readPos);
+    int pos = inBuf.find('\r', readPos);
     if (pos < 0)
     {
         return PARSE_URI_AGAIN;
     }
-    // 去掉请求行所占的空间，节省空间
-    string request_line = str.substr(0, pos);
-    if (str.size() > pos + 1)
-        str = str.substr(pos + 1);
-    else 
-        str.clear();
-    // Method
-    pos = request_line.find("GET");
-    if (pos < 0)
-    {
-        pos = request_line.find("POST");
-        if (pos < 0)
-            return PARSE_URI_ERROR;
-        else
-            method = METHOD_POST;
-    }
-    else
+    // 请求行拷贝到arena后从缓冲区去掉(只移动下标)，文件名和参数直接指向这份拷贝
+    char *line = static_cast<char*>(arena.alloc(pos + 1));
+    memcpy(line, inBuf.linearize(pos), pos);
+    line[pos] = '\0';
+    inBuf.retrieve(pos + 1);
+    StrView request_line(line, pos);
+    // Method，只匹配请求行开头
+    if (request_line.startsWith("GET "))
         method = METHOD_GET;
-    //printf("method = %d\n", method);
+    else if (request_line.startsWith("POST "))
+        method = METHOD_POST;
+    else if (request_line.startsWith("HEAD "))
+        method = METHOD_HEAD;
+    else if (request_line.startsWith("DELETE "))
+        method = METHOD_DELETE;
+    else
+        return PARSE_URI_ERROR;
     // filename
-    pos = request_line.find("/", pos);
-    if (pos < 0)
+    size_t start = request_line.find('/');
+    if (start == StrView::npos)
         return PARSE_URI_ERROR;
-    else
+    size_t end = request_line.find(' ', start);
+    if (end == StrView::npos)
+        return PARSE_URI_ERROR;
+    if (end - start > 1)
     {
-        int _pos = request_line.find(' ', pos);
-        if (_pos < 0)
-            return PARSE_URI_ERROR;
-        else
+        // 文件名和参数原地以'\0'结尾，可以直接传给stat/open
+        line[end] = '\0';
+        fileName = StrView(line + start + 1, end - start - 1);
+        size_t q = fileName.find('?');
+        if (q != StrView::npos)
         {
-            if (_pos - pos > 1)
-            {
-                fileName = request_line.substr(pos + 1, _pos - pos - 1);
-                int __pos = fileName.find('?');
-                if (__pos >= 0)
-                {
-                    fileName = fileName.substr(0, __pos);
-                }
-            }
-                
-            else
-                fileName = "index.html";
+            line[start + 1 + q] = '\0';
+            query = fileName.substr(q + 1);
+            fileName = fileName.substr(0, q);
         }
-        pos = _pos;
     }
+    else
+        fileName = "index.html";
     // HTTP 版本号
-    pos = request_line.find("/", pos);
-    if (pos < 0)
+    size_t ver = request_line.find('/', end);
+    if (ver == StrView::npos)
+        return PARSE_URI_ERROR;
+    if (request_line.size() - ver <= 3)
         return PARSE_URI_ERROR;
+    StrView version = request_line.substr(ver + 1, 3);
+    if (version == "1.0")
+        HTTPversion = HTTP_10;
+    else if (version == "1.1")
+        HTTPversion = HTTP_11;
     else
-    {
-        if (request_line.size() - pos <= 3)
-            return PARSE_URI_ERROR;
-        else
-        {
-            string ver = request_line.substr(pos + 1, 3);
-            if (ver == "1.0")
-                HTTPversion = HTTP_10;
-            else if (ver == "1.1")
-                HTTPversion = HTTP_11;
-            else
-                return PARSE_URI_ERROR;
-        }
-    }
+        return PARSE_URI_ERROR;
     return PARSE_URI_SUCCESS;
 }
 
 // 解析请求头部
 int RequestData::parseHeaders()
 {
-    string &str = inBuf;
+    // 头部在一个缓冲块内解析，超过一个块的头部行按错误处理
+    int len = inBuf.size() < BUFFER_CHUNK_SIZE ? inBuf.size() : BUFFER_CHUNK_SIZE;
+    const char *str = inBuf.linearize(len);
     int key_start = -1, key_end = -1, value_start = -1, value_end = -1;
     int now_read_line_begin = 0;
     bool notFinish = true;
-    for (int i = 0; i < str.size() && notFinish; ++i)
+    for (int i = 0; i < len && notFinish; ++i)
     {
         switch(hState)
         {
@@ -437,10 +971,9 @@ int RequestData::parseHeaders()
                 if (str[i] == '\n')
                 {
                     hState = hLF;
-                    string key(str.begin() + key_start, str.begin() + key_end);
-                    string value(str.begin() + value_start, str.begin() + value_end);
-                    headers[key] = value;
-                    now_read_line_begin = i;
+                    headers.set(arena, StrView(str + key_start, key_end - key_start),
+                        StrView(str + value_start, value_end - value_start));
+                    now_read_line_begin = i + 1;
                 }
                 else
                     return PARSE_HEADER_ERROR;
@@ -463,7 +996,10 @@ int RequestData::parseHeaders()
             {
                 if (str[i] == '\n')
                 {
+                    // 空行结束，body从下一个字节开始
                     hState = hEndLF;
+                    notFinish = false;
+                    now_read_line_begin = i + 1;
                 }
                 else
                     return PARSE_HEADER_ERROR;
@@ -480,86 +1016,594 @@ int RequestData::parseHeaders()
     }
     if (hState == hEndLF)
     {
-        str = str.substr(now_read_line_begin);
+        inBuf.retrieve(now_read_line_begin);
         return PARSE_HEADER_SUCCESS;
     }
-    str = str.substr(now_read_line_begin);
+    if (now_read_line_begin == 0 && len == static_cast<int>(BUFFER_CHUNK_SIZE))
+        return PARSE_HEADER_ERROR;
+    // 只保留未解析完的行，下次从行首重新解析
+    inBuf.retrieve(now_read_line_begin);
+    if (hState != hStart)
+        hState = hLF;
     return PARSE_HEADER_AGAIN;
 }
 
 // 解析请求
 int RequestData::parseRequest()
 {
+    StrView connection;
+    if (headers.get("Connection", connection) && connection == "keep-alive")
+        keepAlive = true;
+    if (fileName.startsWith("jobs/"))
+        return parseJobRequest();
+    if (fileName == "stats/encode" && (method == METHOD_GET || method == METHOD_HEAD))
+    {
+        string json = ImageEncoder::statsJson();
+        appendStatus("HTTP/1.1 200 OK");
+        appendHeader("Content-type", "application/json");
+        appendHeader("Cache-Control", "no-store");
+        appendHeader("Content-length", json.size());
+        outBuf.append("\r\n");
+        if (method == METHOD_GET)
+            outBuf.append(json);
+        return ANALYSIS_SUCCESS;
+    }
+    if (fileName == "metrics" && (method == METHOD_GET || method == METHOD_HEAD))
+    {
+        // 各线程的计数在这里才汇总
+        string text = Metrics::render();
+        appendStatus("HTTP/1.1 200 OK");
+        appendHeader("Content-type", "text/plain; version=0.0.4");
+        appendHeader("Cache-Control", "no-store");
+        appendHeader("Content-length", text.size());
+        outBuf.append("\r\n");
+        if (method == METHOD_GET)
+            outBuf.append(text);
+        return ANALYSIS_SUCCESS;
+    }
+    if (fileName == "trace" && (method == METHOD_GET || method == METHOD_HEAD))
+    {
+        // 只读，采样率用-t和SIGUSR1控制
+        string json = Tracer::json();
+        appendStatus("HTTP/1.1 200 OK");
+        appendHeader("Content-type", "application/json");
+        appendHeader("Cache-Control", "no-store");
+        appendHeader("Content-length", json.size());
+        outBuf.append("\r\n");
+        if (method == METHOD_GET)
+            outBuf.append(json);
+        return ANALYSIS_SUCCESS;
+    }
     // POST请求
-    if (method == METHOD_POST)
-    {
-        //get inBuffer
-        string header;
-        header += string("HTTP/1.1 200 OK\r\n");
-        if(headers.find("Connection") != headers.end() && headers["Connection"] == "keep-alive")
-        {
-            keepAlive = true;
-            header += string("Connection: keep-alive\r\n") + "Keep-Alive: timeout=" + to_string(5 * 60 * 1000) + "\r\n";
-        }
-        int length = stoi(headers["Content-length"]);
-        vector<char> data(inBuf.begin(), inBuf.begin() + length);
-        cout << " data.size()=" << data.size() << endl;
-        Mat src = imdecode(data, CV_LOAD_IMAGE_ANYDEPTH|CV_LOAD_IMAGE_ANYCOLOR);
-        imwrite("receive.bmp", src);
-        cout << "1" << endl;
-        Mat res = stitch(src);
-        cout << "2" << endl;
-        vector<uchar> data_encode;
-        imencode(".png", res, data_encode);
-        cout << "3" << endl;
-        header += string("Content-length: ") + to_string(data_encode.size()) + "\r\n\r\n";
-        cout << "4" << endl;
-        outBuf += header + string(data_encode.begin(), data_encode.end());
-        cout << "5" << endl;
-        inBuf = inBuf.substr(length);
+    if (method == METHOD_POST && batch)
+    {
+        appendStatus("HTTP/1.1 200 OK");
+        appendHeader("Content-type", batch->respond());
+        appendHeader("Transfer-Encoding", "chunked");
+        outBuf.append("\r\n");
         return ANALYSIS_SUCCESS;
     }
-    // GET请求
-    else if (method == METHOD_GET)
+    else if (method == METHOD_POST)
     {
-        string header;
-        header += "HTTP/1.1 200 OK\r\n";
-        if(headers.find("Connection") != headers.end() && headers["Connection"] == "keep-alive")
+        // 长度在解析头部时已经检查过，不超过body上限，所以在int范围内
+        int length = static_cast<int>(bodyLength);
+        // body在接收时已经连续存放，直接在接收缓冲区上解码
+        const char *body = bodyData(length);
+        vector<int> lengths;
+        StrView lengthList;
+        headers.get("X-Image-Lengths", lengthList);
+        if (!ImageService::parseLengths(lengthList.str(), length, lengths))
         {
-            keepAlive = true;
-            header += string("Connection: keep-alive\r\n") + "Keep-Alive: timeout=" + to_string(5 * 60 * 1000) + "\r\n";
+            releaseBody(length);
+            handleError(fd, 400, "Bad Request: Bad image data");
+            return ANALYSIS_ERROR;
         }
-        int dot_pos = fileName.find('.');
-        string filetype;
-        if (dot_pos < 0) 
-            filetype = MimeType::getMime("default");
-        else
-            filetype = MimeType::getMime(fileName.substr(dot_pos));
+        // 输出格式：查询参数format/quality优先，其次是Accept
+        StrView format, quality, accept;
+        getQuery("format", format);
+        getQuery("quality", quality);
+        headers.get("Accept", accept);
+        EncodeOptions enc;
+        if (!ImageEncoder::negotiate(accept.str(), format.str(), quality.str(), enc))
+        {
+            releaseBody(length);
+            handleError(fd, 406, "Not Acceptable");
+            return ANALYSIS_ERROR;
+        }
+        StrView async;
+        if (getQuery("async", async) && async == "1")
+        {
+            // 异步任务：拷贝body后立即返回任务id，计算不占用连接
+            shared_ptr<Job> job;
+            int ret = JobStore::submit(body, length, lengths, enc, job);
+            releaseBody(length);
+            if (ret != JOB_OK)
+            {
+                handleError(fd, 503, "Service Unavailable: Too many jobs");
+                return ANALYSIS_ERROR;
+            }
+            string json = "{\"id\":\"" + job->id + "\",\"status\":\"pending\"}\n";
+            appendStatus("HTTP/1.1 202 Accepted");
+            appendHeader("Location", "/jobs/" + job->id);
+            appendHeader("Content-type", "application/json");
+            appendHeader("Content-length", json.size());
+            outBuf.append("\r\n");
+            outBuf.append(json);
+            return ANALYSIS_SUCCESS;
+        }
+        ResultCache::resultPtr r = ImageService::process(body, lengths, enc, [this]() { return peerGone(); });
+        releaseBody(length);
+        if (r->code == HTTP_CLIENT_CLOSED)
+            return ANALYSIS_ERROR;
+        else if (r->code != 200)
+        {
+            handleError(fd, r->code, r->msg);
+            return ANALYSIS_ERROR;
+        }
+        appendStatus("HTTP/1.1 200 OK");
+        appendHeader("Content-type", ImageEncoder::mime(enc.format));
+        appendHeader("Vary", "Accept");
+        appendHeader("Content-length", r->data.size());
+        outBuf.append("\r\n");
+        // 编码结果不拷贝：足够大的交给零拷贝发送，其余挂到outBuf上，发完之前持有r
+        if (!zc.take(fd, r, r->data.data(), r->data.size()))
+            outBuf.appendRef(r, reinterpret_cast<const char*>(r->data.data()), r->data.size());
+        return ANALYSIS_SUCCESS;
+    }
+    // GET/HEAD请求
+    else if (method == METHOD_GET || method == METHOD_HEAD)
+    {
+        if (fileName.startsWith("img/"))
+        {
+            int ret = parseImageRequest();
+            if (ret != PARSE_IMAGE_ORIGINAL)
+                return ret;
+            fileName = fileName.substr(4);
+        }
+        size_t dot_pos = fileName.find('.');
+        const string &filetype = MimeType::getMime(dot_pos == StrView::npos ? StrView("default") : fileName.substr(dot_pos));
         struct stat sbuf;
-        if (stat(fileName.c_str(), &sbuf) < 0)
+        if (stat(fileName.data(), &sbuf) < 0)
         {
-            header.clear();
             handleError(fd, 404, "Not Found!");
             return ANALYSIS_ERROR;
         }
-        header += "Content-type: " + filetype + "\r\n";
-        header += "Content-length: " + to_string(sbuf.st_size) + "\r\n";
+        FileInfo info;
+        FileCache::getInfo(sbuf, info);
+        // 状态行取决于条件请求和Range，先判断完再写头部
+        const char *status = "HTTP/1.1 200 OK";
+        off_t start = 0, length = sbuf.st_size;
+        int range = RANGE_NONE;
+        StrView rangeSpec;
+        // 客户端缓存仍然有效，只回送头部
+        bool notModified = FileCache::notModified(info, headers);
+        if (notModified)
+            status = "HTTP/1.1 304 Not Modified";
+        else if (headers.get("Range", rangeSpec) && FileCache::rangeApplies(info, headers))
+        {
+            range = FileCache::parseRange(rangeSpec, sbuf.st_size, start, length);
+            if (range == RANGE_UNSATISFIABLE)
+                status = "HTTP/1.1 416 Range Not Satisfiable";
+            else if (range == RANGE_OK)
+                status = "HTTP/1.1 206 Partial Content";
+        }
+        int src_fd = -1;
+        if (!notModified && range != RANGE_UNSATISFIABLE && method == METHOD_GET && length > 0)
+        {
+            src_fd = open(fileName.data(), O_RDONLY, 0);
+            if (src_fd < 0)
+            {
+                handleError(fd, 404, "Not Found!");
+                return ANALYSIS_ERROR;
+            }
+        }
+        appendStatus(status);
+        appendHeader("ETag", info.etag);
+        appendHeader("Last-Modified", info.lastModified);
+        appendHeader("Accept-Ranges", "bytes");
+        if (notModified)
+        {
+            outBuf.append("\r\n");
+            return ANALYSIS_SUCCESS;
+        }
+        char contentRange[80];
+        if (range == RANGE_UNSATISFIABLE)
+        {
+            int n = snprintf(contentRange, sizeof(contentRange), "bytes */%lld", static_cast<long long>(sbuf.st_size));
+            appendHeader("Content-Range", StrView(contentRange, n));
+            appendHeader("Content-length", 0ULL);
+            outBuf.append("\r\n");
+            return ANALYSIS_SUCCESS;
+        }
+        if (range == RANGE_OK)
+        {
+            int n = snprintf(contentRange, sizeof(contentRange), "bytes %lld-%lld/%lld", static_cast<long long>(start),
+                static_cast<long long>(start + length - 1), static_cast<long long>(sbuf.st_size));
+            appendHeader("Content-Range", StrView(contentRange, n));
+        }
+        appendHeader("Content-type", filetype);
+        appendHeader("Content-length", static_cast<unsigned long long>(length));
         // 头部结束
-        header += "\r\n";
-        outBuf += header;
-        int src_fd = open(fileName.c_str(), O_RDONLY, 0);
-        char *src_addr = static_cast<char*>(mmap(NULL, sbuf.st_size, PROT_READ, MAP_PRIVATE, src_fd, 0));
-        close(src_fd);
-        outBuf += src_addr;
-        munmap(src_addr, sbuf.st_size);
+        outBuf.append("\r\n");
+        if (src_fd < 0)
+            return ANALYSIS_SUCCESS;
+        // 文件内容在头部之后由handleWrite通过sendfile发送
+        closeBody();
+        bodyFd = src_fd;
+        bodyOffset = start;
+        bodyLeft = length;
         return ANALYSIS_SUCCESS;
     }
     else
+    {
+        handleError(fd, 405, "Method Not Allowed");
         return ANALYSIS_ERROR;
+    }
+}
+
+int RequestData::parseJobRequest()
+{
+    string id = fileName.substr(5).str();
+    if (method == METHOD_DELETE)
+    {
+        if (!JobStore::cancel(id))
+        {
+            handleError(fd, 404, "Not Found!");
+            return ANALYSIS_ERROR;
+        }
+        appendStatus("HTTP/1.1 204 No Content");
+        outBuf.append("\r\n");
+        return ANALYSIS_SUCCESS;
+    }
+    if (method != METHOD_GET && method != METHOD_HEAD)
+    {
+        handleError(fd, 405, "Method Not Allowed");
+        return ANALYSIS_ERROR;
+    }
+    shared_ptr<Job> job = JobStore::find(id);
+    if (!job)
+    {
+        handleError(fd, 404, "Not Found!");
+        return ANALYSIS_ERROR;
+    }
+    StrView wait;
+    if (getQuery("wait", wait))
+    {
+        long timeout = wait.toLong();
+        if (timeout > JOB_WAIT_MAX)
+            timeout = JOB_WAIT_MAX;
+        if (timeout > 0)
+        {
+            // 响应在任务结束或者超时后生成
+            waitJob = job;
+            waitTimeout = timeout;
+            return ANALYSIS_SUCCESS;
+        }
+    }
+    appendJobResponse(job);
+    return ANALYSIS_SUCCESS;
+}
+
+int RequestData::startBatch()
+{
+    string boundary;
+    StrView type;
+    if (headers.get("Content-Type", type))
+        boundary = MultipartParser::boundaryOf(type.str());
+    if (boundary.empty())
+    {
+        handleError(fd, 400, "Bad Request: Expect multipart/form-data");
+        return -1;
+    }
+    StrView w, h, format, quality, accept;
+    getQuery("w", w);
+    getQuery("h", h);
+    getQuery("format", format);
+    getQuery("quality", quality);
+    headers.get("Accept", accept);
+    long wantW = w.toLong(), wantH = h.toLong();
+    int width = wantW < 0 ? 0 : (wantW > RESIZE_MAX_DIM ? RESIZE_MAX_DIM : wantW);
+    int height = wantH < 0 ? 0 : (wantH > RESIZE_MAX_DIM ? RESIZE_MAX_DIM : wantH);
+    EncodeOptions enc;
+    // 每个part的结果都是一张图片，Accept里的multipart/mixed不参与选择
+    if (!ImageEncoder::negotiate(accept.find("image/") == StrView::npos ? string() : accept.str(), format.str(), quality.str(), enc))
+    {
+        handleError(fd, 406, "Not Acceptable");
+        return -1;
+    }
+    batch.reset(new BatchRequest(boundary, enc, width, height));
+    bodyReceived = 0;
+    return 0;
+}
+
+int RequestData::feedBody()
+{
+    Buffer *src = &inBuf;
+    if (chunked)
+    {
+        // 先去掉块框架，数据搬到bodyBuf，handler看不到分块
+        if (decoder.decode(inBuf, bodyBuf) < 0)
+        {
+            handleError(fd, 400, "Bad Request: Bad chunked body");
+            return -1;
+        }
+        if (bodyReceived + bodyBuf.size() > BodyBudget::getMaxBody())
+        {
+            handleError(fd, 413, "Payload Too Large");
+            return -1;
+        }
+        src = &bodyBuf;
+    }
+    while (!src->empty())
+    {
+        size_t n = src->size() < BUFFER_CHUNK_SIZE ? src->size() : BUFFER_CHUNK_SIZE;
+        if (!chunked && n > bodyLength - bodyReceived)
+            n = bodyLength - bodyReceived;
+        if (n == 0)
+            break;
+        int used = bodyHandler->onBody(src->linearize(n), n);
+        if (used == 0)
+        {
+            // 一个缓冲块放不下handler要一起解析的数据，或者body已经结束但是不完整
+            bool last = chunked ? decoder.done() && n == src->size() : bodyReceived + n == bodyLength;
+            if (n == BUFFER_CHUNK_SIZE || last)
+                used = BODY_ERROR;
+            else
+                break;
+        }
+        if (used < 0)
+        {
+            handleError(fd, 400, "Bad Request: Bad body");
+            return -1;
+        }
+        src->retrieve(used);
+        bodyReceived += used;
+    }
+    bool complete = chunked ? decoder.done() && bodyBuf.empty() : bodyReceived == bodyLength;
+    if (!complete)
+        return 0;
+    int ret = bodyHandler->onBodyEnd();
+    bodyHandler.reset();
+    if (ret < 0)
+    {
+        handleError(fd, 400, "Bad Request: Bad body");
+        return -1;
+    }
+    return 1;
+}
+
+int RequestData::startBody(size_t length)
+{
+    bodyLength = length;
+    if (length >= BodyBudget::spoolThreshold())
+    {
+        // 大body写临时文件，已经读进inBuf的部分先搬过去
+        if (spool.open(length) < 0)
+        {
+            handleError(fd, 503, "Service Unavailable");
+            return -1;
+        }
+        while (!inBuf.empty() && !spool.full())
+        {
+            size_t n = inBuf.contiguousSize();
+            spool.append(inBuf.peek(), n);
+            inBuf.retrieve(n);
+        }
+        return 0;
+    }
+    // 整个body已经到了就不用再等预算
+    if (inBuf.size() < length)
+        bodyWait = length;
+    return 0;
+}
+
+size_t RequestData::readLimit() const
+{
+    // 只读到body结束，不多占内存
+    if (state == STATE_RECV_BODY && !bodyHandler && bodyLength > inBuf.size())
+        return bodyLength - inBuf.size();
+    return BODY_READ_SLICE;
+}
+
+const char *RequestData::bodyData(size_t length)
+{
+    if (spool.active())
+        return spool.data();
+    return inBuf.linearize(length);
+}
+
+void RequestData::releaseBody(size_t length)
+{
+    if (!spool.active())
+        inBuf.retrieve(length);
+    freeBody();
+}
+
+void RequestData::freeBody()
+{
+    spool.close();
+    BodyBudget::release(bodyCharge);
+    bodyCharge = 0;
+    bodyLength = 0;
+    bodyWait = 0;
+    bodyHandler.reset();
+    bodyBuf.clear();
+    bodyReceived = 0;
+    chunked = false;
+    decoder.reset();
+}
+
+int RequestData::parseImageRequest()
+{
+    StrView path = fileName.substr(4);
+    StrView w, h;
+    getQuery("w", w);
+    getQuery("h", h);
+    // 先按long截到上限再存进int
+    long wantW = w.toLong(), wantH = h.toLong();
+    if (wantW <= 0 && wantH <= 0)
+        return PARSE_IMAGE_ORIGINAL;
+    int width = wantW < 0 ? 0 : (wantW > RESIZE_MAX_DIM ? RESIZE_MAX_DIM : wantW);
+    int height = wantH < 0 ? 0 : (wantH > RESIZE_MAX_DIM ? RESIZE_MAX_DIM : wantH);
+    struct stat sbuf;
+    if (path.empty() || path.find("..") != StrView::npos || stat(path.data(), &sbuf) < 0 || !S_ISREG(sbuf.st_mode))
+    {
+        handleError(fd, 404, "Not Found!");
+        return ANALYSIS_ERROR;
+    }
+    FileInfo info;
+    FileCache::getInfo(sbuf, info);
+    StrView format, quality, accept;
+    getQuery("format", format);
+    getQuery("quality", quality);
+    headers.get("Accept", accept);
+    // 客户端没有明确要求时保持源文件的格式
+    int fallback = ENCODE_PNG;
+    size_t dot_pos = path.rfind('.');
+    if (dot_pos != StrView::npos && ImageEncoder::formatOf(path.substr(dot_pos + 1).str()) >= 0)
+        fallback = ImageEncoder::formatOf(path.substr(dot_pos + 1).str());
+    EncodeOptions enc;
+    if (!ImageEncoder::negotiate(accept.str(), format.str(), quality.str(), enc, fallback))
+    {
+        handleError(fd, 406, "Not Acceptable");
+        return ANALYSIS_ERROR;
+    }
+    // 变体的ETag由源文件版本和参数组成，条件请求和静态文件走同样的判断
+    FileInfo variant = info;
+    snprintf(variant.etag, sizeof(variant.etag), "%.*s-%dx%d-%s\"", static_cast<int>(strlen(info.etag)) - 1, info.etag,
+        width, height, ImageEncoder::describe(enc).c_str());
+    bool notModified = FileCache::notModified(variant, headers);
+    ResultCache::resultPtr r;
+    if (!notModified)
+    {
+        r = ImageService::resize(path.str(), info.etag, width, height, enc);
+        if (r->code != 200)
+        {
+            handleError(fd, r->code, r->msg);
+            return ANALYSIS_ERROR;
+        }
+    }
+    appendStatus(notModified ? "HTTP/1.1 304 Not Modified" : "HTTP/1.1 200 OK");
+    appendHeader("ETag", variant.etag);
+    appendHeader("Last-Modified", variant.lastModified);
+    appendHeader("Vary", "Accept");
+    if (notModified)
+    {
+        outBuf.append("\r\n");
+        return ANALYSIS_SUCCESS;
+    }
+    appendHeader("Content-type", ImageEncoder::mime(enc.format));
+    appendHeader("Content-length", r->data.size());
+    outBuf.append("\r\n");
+    if (method == METHOD_GET)
+        outBuf.appendRef(r, reinterpret_cast<const char*>(r->data.data()), r->data.size());
+    return ANALYSIS_SUCCESS;
+}
+
+void RequestData::appendJobResponse(const shared_ptr<Job> &job)
+{
+    JobStore::Status s = JobStore::status(job);
+    if (s.state == JOB_DONE)
+    {
+        // 结果可以重复获取，直到任务过期
+        const vector<unsigned char> &data = job->result->data;
+        appendStatus("HTTP/1.1 200 OK");
+        appendHeader("Content-type", ImageEncoder::mime(job->enc.format));
+        appendHeader("Content-length", data.size());
+        outBuf.append("\r\n");
+        if (method != METHOD_HEAD)
+            outBuf.appendRef(job->result, reinterpret_cast<const char*>(data.data()), data.size());
+        return;
+    }
+    const char *status;
+    if (s.state == JOB_PENDING || s.state == JOB_RUNNING)
+        status = "HTTP/1.1 202 Accepted";
+    else if (s.state == JOB_CANCELLED)
+        status = "HTTP/1.1 410 Gone";
+    else if (s.code == 400)
+        status = "HTTP/1.1 400 Bad Request";
+    else if (s.code == 413)
+        status = "HTTP/1.1 413 Payload Too Large";
+    else if (s.code == 422)
+        status = "HTTP/1.1 422 Unprocessable Entity";
+    else
+        status = "HTTP/1.1 500 Internal Server Error";
+    static const char *names[] = { "pending", "running", "done", "failed", "cancelled" };
+    string json = "{\"id\":\"" + job->id + "\",\"status\":\"" + names[s.state] + "\"";
+    if (!s.error.empty())
+        json += ",\"error\":\"" + s.error + "\"";
+    json += "}\n";
+    appendStatus(status);
+    if (s.state == JOB_PENDING || s.state == JOB_RUNNING)
+        appendHeader("Retry-After", "1");
+    appendHeader("Content-type", "application/json");
+    appendHeader("Content-length", json.size());
+    outBuf.append("\r\n");
+    if (method != METHOD_HEAD)
+        outBuf.append(json);
+}
+
+bool RequestData::getQuery(const char *key, StrView &value) const
+{
+    StrView name(key);
+    size_t pos = 0;
+    while (pos < query.size())
+    {
+        size_t end = query.find('&', pos);
+        if (end == StrView::npos)
+            end = query.size();
+        size_t eq = query.find('=', pos);
+        if (eq != StrView::npos && eq < end && query.substr(pos, eq - pos) == name)
+        {
+            value = query.substr(eq + 1, end - eq - 1);
+            return true;
+        }
+        pos = end + 1;
+    }
+    return false;
+}
+
+void RequestData::appendStatus(const char *status)
+{
+    outBuf.append(status);
+    outBuf.append("\r\n", 2);
+    if (keepAlive)
+    {
+        // 空闲超时随连接压力变化，响应发完后按这里宣告的值(秒)等下一个请求
+        idleTimeout = KeepAlive::timeoutMs();
+        char line[64];
+        int n = snprintf(line, sizeof(line), "Connection: keep-alive\r\nKeep-Alive: timeout=%d\r\n", idleTimeout / 1000);
+        outBuf.append(line, n);
+    }
+}
+
+void RequestData::appendHeader(const char *name, StrView value)
+{
+    outBuf.append(name);
+    outBuf.append(": ", 2);
+    outBuf.append(value.data(), value.size());
+    outBuf.append("\r\n", 2);
+}
+
+void RequestData::appendHeader(const char *name, unsigned long long value)
+{
+    char digits[24];
+    int n = snprintf(digits, sizeof(digits), "%llu", value);
+    appendHeader(name, StrView(digits, n));
+}
+
+bool RequestData::peerGone() const
+{
+    char c;
+    ssize_t n = recv(fd, &c, 1, MSG_PEEK | MSG_DONTWAIT);
+    if (n == 0)
+        return true;
+    return n < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR;
 }
 
 void RequestData::handleError(int fd, int err_num, string short_msg)
 {
+    Metrics::add(err_num >= 500 ? METRIC_ERRORS_5XX : METRIC_ERRORS_4XX);
     short_msg = " " + short_msg;
     char send_buff[MAX_BUF_SIZE];
     string body_buff, header_buff;
@@ -578,6 +1622,18 @@ void RequestData::handleError(int fd, int err_num, string short_msg)
     writen(fd, send_buff, strlen(send_buff));
     sprintf(send_buff, "%s", body_buff.c_str());
     writen(fd, send_buff, strlen(send_buff));
+    // 出错的连接随后关闭，直接记下来
+    accessBegin();
+    if (fileName.empty() && state == STATE_PARSE_URI)
+    {
+        // 请求行都没有解析出来
+        access.method = 0;
+        access.version = 0;
+        access.uriLen = 0;
+    }
+    access.status = err_num;
+    access.bytes = header_buff.size() + body_buff.size();
+    accessEnd();
 }
 
 
@@ -601,4 +1657,20 @@ bool RequestData::isCanRead()
 bool RequestData::isCanWrite()
 {
     return isAbleWrite;
+}
+void RequestData::enableReap()
+{
+    isAbleReap = true;
+}
+bool RequestData::isCanReap()
+{
+    return isAbleReap;
+}
+bool RequestData::isZeroCopyWaiting()
+{
+    return zc.waiting();
+}
+bool RequestData::isZeroCopyStalled()
+{
+    return zc.stalled(fd);
 }
\ No newline at end of file
@@ -1,9 +1,23 @@
 #pragma once
 
-#include "Timer.h"
+#include "RequestPtr.h"
+#include "Buffer.h"
+#include "Arena.h"
+#include "StrView.h"
+#include "ZeroCopy.h"
+#include "JobStore.h"
+#include "HeaderMap.h"
+#include "BatchRequest.h"
+#include "BodySpool.h"
+#include "BodyHandler.h"
+#include "ChunkedDecoder.h"
+#include "Trace.h"
+#include "AccessLog.h"
 #include <string>
 #include <unordered_map>
 #include <memory>
+#include <vector>
+#include <atomic>
 #include <sys/epoll.h>
 
 
@@ -25,6 +39,8 @@ const int STATE_ANALYSIS = 4;
 const int STATE_FINISH = 5;
 
 const int MAX_BUF_SIZE = 4096;
+// 还不知道body大小和去向时，每次最多读这么多，剩下的留在socket里
+const size_t BODY_READ_SLICE = 256 * 1024;
 
 // 重复请求的次数
 const int AGAIN_MAX_TIMES = 200;
@@ -39,13 +55,19 @@ const int PARSE_HEADER_SUCCESS = 0;
 
 const int ANALYSIS_ERROR = -2;
 const int ANALYSIS_SUCCESS = 0;
+// img/请求没有缩放参数，按静态文件回送原图
+const int PARSE_IMAGE_ORIGINAL = 1;
 
 const int METHOD_POST = 1;
 const int METHOD_GET = 2;
+const int METHOD_HEAD = 3;
+const int METHOD_DELETE = 4;
 const int HTTP_10 = 1;
 const int HTTP_11 = 2;
 
 const int EPOLL_WAIT_TIME = 500;
+// 已知类型的后缀最长只有几个字符，更长的直接按默认类型处理
+const size_t MIME_SUFFIX_MAX = 8;
 
 class MimeType
 {
@@ -56,7 +78,7 @@ private:
     MimeType(const MimeType &m);
 
 public:
-    static std::string getMime(const std::string &suffix);
+    static const std::string &getMime(StrView suffix);
 
 private:
     static pthread_once_t once_control;
@@ -75,17 +97,34 @@ enum HeadersState
     hEndLF
 };
 
-class Timer;
-
-class RequestData : public std::enable_shared_from_this<RequestData>
+// 连接的所有权见RequestPtr.h，引用计数只在接受连接和少数冷路径上改动
+class RequestData
 {
 private:
+    std::atomic<int> refs;
+    friend void intrusivePtrAddRef(RequestData *req);
+    friend void intrusivePtrRelease(RequestData *req);
+    // 空闲时在RequestPool的链表中
+    RequestData *poolNext;
+    friend class RequestPool;
+
     std::string path;
     int fd;
     int epollfd;
 
-    std::string inBuf;
-    std::string outBuf;
+    Buffer inBuf;
+    Buffer outBuf;
+    // 响应的文件内容，outBuf中的头部发送完后用sendfile零拷贝发送
+    int bodyFd;
+    off_t bodyOffset;
+    size_t bodyLeft;
+    bool corked;
+    // 已确认驻留在page cache中的文件区间终点，超过后重新检查
+    off_t warmEnd;
+    // 文件区间不在page cache中，handleConn把连接交给磁盘线程
+    bool diskPending;
+    // 大的动态body(编码后的图片)走MSG_ZEROCOPY
+    ZeroCopySender zc;
     __uint32_t events;
     bool error;
 
@@ -93,42 +132,120 @@ private:
     int method;
     // http版本
     int HTTPversion;
-    std::string fileName;
+    // 请求的临时数据(URI、头部)，请求结束时整体回收
+    Arena arena;
+    // 以下片段指向arena，末尾都有'\0'
+    StrView fileName;
+    // URI中'?'之后的部分
+    StrView query;
     int readPos;
     int state;
     int hState;
     bool isFinish;
     bool keepAlive;
-    std::unordered_map<std::string, std::string> headers;
-    std::weak_ptr<Timer> timer;
+    // 最近一次响应宣告的keep-alive空闲超时，毫秒
+    int idleTimeout;
+    HeaderList headers;
+    // 解析请求行和头部累计用的时间(可能分多次读完)，纳秒
+    uint64_t parseNanos;
+    // 被采样跟踪时请求各阶段的时间戳，响应发完后交给Tracer
+    TraceRecord trace;
+    bool traced;
+    // 请求开始(读到第一个字节)的时间，Metrics::now()，0表示还没开始
+    uint64_t reqStart;
+    // 访问日志：响应生成完时填好请求信息(keep-alive的reset会清掉请求状态)，发完后写出
+    AccessRecord access;
+    std::string accessUri;
+    uint64_t accessStart;
+    bool accessPending;
 
     bool isAbleRead;
     bool isAbleWrite;
+    bool isAbleReap;
+    // 长轮询的任务，handleConn把连接挂到任务上等待结果
+    std::shared_ptr<Job> waitJob;
+    int waitTimeout;
+    // POST /batch：body边收边交给batch解析(batch也是bodyHandler)，响应按结果完成顺序流式发送
+    std::shared_ptr<BatchRequest> batch;
+    size_t bodyReceived;
+    // 普通POST的body：小的读进inBuf并计入BodyBudget，大的读进spool
+    BodySpool spool;
+    size_t bodyLength;
+    // 已经计入BodyBudget的字节数
+    size_t bodyCharge;
+    // 需要等预算的字节数，handleConn把连接挂到BodyBudget上
+    size_t bodyWait;
+    // 流式接收body的handler，收完后释放；没有时body整个缓存下来再处理
+    std::shared_ptr<BodyHandler> bodyHandler;
+    bool chunked;
+    ChunkedDecoder decoder;
+    // chunked body去掉块框架后的数据
+    Buffer bodyBuf;
 
 private:
     int parseURI();
     int parseHeaders();
     int parseRequest();
-
-    Mat stitch(Mat &src)
-    {
-        return src;
-    }
+    void closeBody();
+    void traceEnd();
+    void accessBegin();
+    void accessEnd();
+    // value指向arena，不以'\0'结尾
+    bool getQuery(const char *key, StrView &value) const;
+    // 响应头部直接写进outBuf，不拼接临时字符串。状态行之后跟着keep-alive的头部
+    void appendStatus(const char *status);
+    void appendHeader(const char *name, StrView value);
+    void appendHeader(const char *name, unsigned long long value);
+    // 对端已经关闭连接，同步计算可以提前放弃
+    bool peerGone() const;
+    // jobs/<id>：GET查询状态或取结果(?wait=ms长轮询)，DELETE取消
+    int parseJobRequest();
+    void appendJobResponse(const std::shared_ptr<Job> &job);
+    // img/<path>?w=&h=：静态图片的缩放变体，没有w和h时回送原图
+    int parseImageRequest();
+    int startBatch();
+    // 把收到的body交给bodyHandler，返回1表示body结束，0表示还要继续读，出错返回-1
+    int feedBody();
+    // 头部解析完后决定body放在哪里，超过上限返回-1
+    int startBody(size_t length);
+    size_t readLimit() const;
+    const char *bodyData(size_t length);
+    // body处理完，归还内存预算
+    void releaseBody(size_t length);
+    void freeBody();
+    // 连接结束：关闭描述符，释放body和定时器
+    void closeConn();
+    // 放回池之前关闭连接并恢复初始状态，取出时再绑定新的描述符
+    void recycle();
+    void reuse(int _epollfd, int _fd, const std::string &_path);
+    // 加定时器后重新注册到epoll，成功后所有权归epoll
+    static void rearm(reqPtr &self, int timeout, __uint32_t events_);
+    // 响应已经发完，没有未读完的请求，也没有挂起的工作
+    bool isIdle() const;
+    // 空闲的keep-alive连接降级成Epoll中的空闲记录，对象还给池，下次可读时再重建
+    static void park(reqPtr &self, int timeout);
 
 public:
 
     RequestData();
     RequestData(int epollfd_, int fd_, std::string path_);
     ~RequestData();
-    void linkTimer(std::shared_ptr<Timer> timer_);
     void reset();
     void seperateTimer();
     int getFd();
     void setFd(int _fd);
     void handleRead();
     void handleWrite();
+    void handleErrQueue();
     void handleError(int fd, int err_num, std::string msg);
-    void handleConn();
+    // self持有当前连接；重新注册或者挂起时所有权从self移走，之后不能再访问连接
+    void handleConn(reqPtr &self);
+    // 以下在唤醒挂起连接的线程上调用，这时连接不会被其他线程处理
+    static void resumeWrite(reqPtr self);
+    // 长轮询的任务结束或者超时，生成响应后重新注册EPOLLOUT
+    static void resumeJob(reqPtr self, std::shared_ptr<Job> job);
+    // 轮到这个连接的body预算，重新注册EPOLLIN继续读body
+    static void resumeBody(reqPtr self, size_t bytes);
 
     void disableWR();
 
@@ -139,5 +256,25 @@ public:
     bool isCanRead();
 
     bool isCanWrite();
+
+    void enableReap();
+
+    bool isCanReap();
+
+    bool isZeroCopyWaiting();
+
+    // 只等零拷贝完成通知的连接超时时调用，对端长时间没有确认数据时返回true
+    bool isZeroCopyStalled();
+
+    // 客户端IPv4地址，网络字节序
+    void setPeer(uint32_t addr);
+
+    // 主线程收到可读事件时调用，决定是否跟踪新的请求
+    void traceWake();
+    void traceMark(int stage)
+    {
+        if (traced && trace.stamps[stage] == 0)
+            trace.stamps[stage] = Tracer::ticks();
+    }
 };
 
@@ -0,0 +1,87 @@
+#include "RequestPool.h"
+#include "RequestData.h"
+
+thread_local RequestData *RequestPool::freeList = NULL;
+thread_local size_t RequestPool::freeCount = 0;
+MutexLock RequestPool::lock;
+RequestData *RequestPool::depot = NULL;
+size_t RequestPool::depotCount = 0;
+size_t RequestPool::highWater = REQUEST_POOL_HIGH_WATER;
+
+void RequestPool::setHighWater(size_t n)
+{
+    highWater = n;
+}
+
+RequestData *RequestPool::get(int epollfd, int fd, const std::string &path)
+{
+    if (freeList == NULL)
+    {
+        // 从仓库整批取回，一次加锁
+        MutexLockGuard guard(lock);
+        for (size_t i = 0; i < REQUEST_POOL_BATCH && depot; ++i)
+        {
+            RequestData *req = depot;
+            depot = req->poolNext;
+            --depotCount;
+            req->poolNext = freeList;
+            freeList = req;
+            ++freeCount;
+        }
+    }
+    if (freeList == NULL)
+        return new RequestData(epollfd, fd, path);
+    RequestData *req = freeList;
+    freeList = req->poolNext;
+    --freeCount;
+    req->poolNext = NULL;
+    req->reuse(epollfd, fd, path);
+    return req;
+}
+
+void RequestPool::put(RequestData *req)
+{
+    if (highWater == 0)
+    {
+        delete req;
+        return;
+    }
+    req->recycle();
+    req->poolNext = freeList;
+    freeList = req;
+    if (++freeCount < 2 * REQUEST_POOL_BATCH)
+        return;
+    // 攒满两批，把一批交给仓库，仓库满了就释放
+    RequestData *batch = NULL;
+    for (size_t i = 0; i < REQUEST_POOL_BATCH; ++i)
+    {
+        RequestData *r = freeList;
+        freeList = r->poolNext;
+        --freeCount;
+        r->poolNext = batch;
+        batch = r;
+    }
+    {
+        MutexLockGuard guard(lock);
+        while (batch && depotCount < highWater)
+        {
+            RequestData *r = batch;
+            batch = r->poolNext;
+            r->poolNext = depot;
+            depot = r;
+            ++depotCount;
+        }
+    }
+    while (batch)
+    {
+        RequestData *r = batch;
+        batch = r->poolNext;
+        delete r;
+    }
+}
+
+size_t RequestPool::cached()
+{
+    MutexLockGuard guard(lock);
+    return depotCount;
+}
@@ -0,0 +1,35 @@
+#pragma once
+#include "MutexLock.h"
+#include <string>
+#include <stddef.h>
+
+class RequestData;
+
+// 默认全局仓库中最多缓存的空闲连接对象数，超过的直接释放
+const size_t REQUEST_POOL_HIGH_WATER = 1024;
+// 线程和仓库之间按批转移的对象数，每个线程自己最多缓存两批
+const size_t REQUEST_POOL_BATCH = 32;
+
+// 连接对象池。连接关闭时对象不释放，关掉描述符、清空状态后放回当前线程的空闲链表，
+// 缓冲区和字符串保留容量；连接只在主线程上接受，工作线程攒满一批就交给全局仓库，主线程的链表空了再整批取回
+class RequestPool
+{
+private:
+    static thread_local RequestData *freeList;
+    static thread_local size_t freeCount;
+    static MutexLock lock;
+    static RequestData *depot;
+    static size_t depotCount;
+    static size_t highWater;
+    RequestPool();
+    RequestPool(const RequestPool &r);
+
+public:
+    // 0表示不缓存，关闭的连接直接释放
+    static void setHighWater(size_t n);
+    static RequestData *get(int epollfd, int fd, const std::string &path);
+    // 引用计数归零时调用
+    static void put(RequestData *req);
+    // 仓库中的空闲对象数
+    static size_t cached();
+};
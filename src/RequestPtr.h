@@ -0,0 +1,12 @@
+#pragma once
+#include "IntrusivePtr.h"
+
+class RequestData;
+// 定义在RequestData.cpp
+void intrusivePtrAddRef(RequestData *req);
+void intrusivePtrRelease(RequestData *req);
+
+// 连接的所有权。任一时刻只有一处持有：注册在epoll中时是Epoll::requests，排队和处理时是线程池任务，
+// 挂起时是挂起的地方(JobStore、BatchRequest、BodyBudget、磁盘线程)。交接都用移动，
+// 正常处理一个请求不改引用计数；最后一个持有者放手时析构并关闭连接
+typedef IntrusivePtr<RequestData> reqPtr;
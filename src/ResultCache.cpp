@@ -0,0 +1,159 @@
+#include "ResultCache.h"
+#include "Hash.h"
+#include "ImagePool.h"
+#include <stdio.h>
+#include <random>
+using namespace std;
+
+namespace
+{
+uint64_t randomSeed()
+{
+    random_device rd;
+    return (static_cast<uint64_t>(rd()) << 32) ^ rd();
+}
+
+// 进程启动时随机生成，不公开。两个种子得到两个独立的哈希，客户端无法离线构造碰撞的body
+const uint64_t keySeeds[2] = { randomSeed(), randomSeed() };
+}
+
+MutexLock ResultCache::lock;
+Condition ResultCache::cond(ResultCache::lock);
+std::unordered_map<std::string, ResultCache::Entry> ResultCache::entries;
+std::list<std::string> ResultCache::lru;
+std::unordered_map<std::string, std::shared_ptr<ResultCache::Flight> > ResultCache::flights;
+size_t ResultCache::capacity = RESULT_CACHE_BYTES;
+size_t ResultCache::bytes = 0;
+std::atomic<unsigned long> ResultCache::hits(0);
+std::atomic<unsigned long> ResultCache::misses(0);
+std::atomic<unsigned long> ResultCache::coalesced(0);
+
+CachedResult::~CachedResult()
+{
+    EncodePool::put(data);
+}
+
+void ResultCache::setCapacity(size_t bytes_)
+{
+    MutexLockGuard guard(lock);
+    capacity = bytes_;
+    while (bytes > capacity && !lru.empty())
+    {
+        auto it = entries.find(lru.back());
+        bytes -= it->second.bytes;
+        entries.erase(it);
+        lru.pop_back();
+    }
+}
+
+string ResultCache::key(const std::string &op, const char *body, size_t length)
+{
+    // key只比较哈希不比较body，哈希要用秘密的种子：固定的种子下碰撞的body可以离线构造，
+    // 用来污染缓存或者拿到别人的结果。参数的哈希混进种子，再带上长度
+    uint64_t opHash = Hash::hash64(op.data(), op.size());
+    uint64_t h1 = Hash::hash64(body, length, keySeeds[0] ^ opHash);
+    uint64_t h2 = Hash::hash64(body, length, keySeeds[1] ^ opHash);
+    char buf[64];
+    snprintf(buf, sizeof(buf), "#%016llx%016llx#%zu", static_cast<unsigned long long>(h1),
+        static_cast<unsigned long long>(h2), length);
+    return op + buf;
+}
+
+// 请求本身有问题的结果和成功结果一样是确定的，可以复用
+bool ResultCache::cacheable(const CachedResult &r)
+{
+    return r.code == 200 || r.code == 400 || r.code == 422;
+}
+
+// 调用方持有lock
+void ResultCache::insert(const std::string &key, const resultPtr &r)
+{
+    // 编码缓冲区来自池，带有预留空间，按capacity计算
+    size_t size = r->data.capacity() + r->msg.size() + key.size() * 2 + sizeof(Entry);
+    if (size > capacity || entries.find(key) != entries.end())
+        return;
+    while (bytes + size > capacity && !lru.empty())
+    {
+        auto it = entries.find(lru.back());
+        bytes -= it->second.bytes;
+        entries.erase(it);
+        lru.pop_back();
+    }
+    lru.push_front(key);
+    Entry e;
+    e.result = r;
+    e.bytes = size;
+    e.pos = lru.begin();
+    entries[key] = e;
+    bytes += size;
+}
+
+ResultCache::resultPtr ResultCache::get(const std::string &key, const ComputeFn &compute)
+{
+    shared_ptr<Flight> flight;
+    {
+        MutexLockGuard guard(lock);
+        while (true)
+        {
+            auto it = entries.find(key);
+            if (it != entries.end())
+            {
+                lru.splice(lru.begin(), lru, it->second.pos);
+                ++hits;
+                return it->second.result;
+            }
+            auto fit = flights.find(key);
+            if (fit == flights.end())
+                break;
+            // 相同的计算正在进行，等它发布结果
+            ++coalesced;
+            shared_ptr<Flight> other(fit->second);
+            while (!other->done)
+                cond.wait();
+            if (other->result && cacheable(*other->result))
+                return other->result;
+            // 前一次计算被取消，重新检查后自己计算
+        }
+        ++misses;
+        flight.reset(new Flight());
+        flights[key] = flight;
+    }
+    resultPtr r;
+    try
+    {
+        r = compute();
+    }
+    catch (...)
+    {
+        // OpenCV可能抛异常，等待的请求不能一直挂着
+        publish(key, flight, resultPtr());
+        throw;
+    }
+    publish(key, flight, r);
+    return r;
+}
+
+void ResultCache::publish(const std::string &key, const std::shared_ptr<Flight> &flight, const resultPtr &r)
+{
+    {
+        MutexLockGuard guard(lock);
+        flight->done = true;
+        flight->result = r;
+        flights.erase(key);
+        if (r && cacheable(*r))
+            insert(key, r);
+    }
+    cond.notifyAll();
+}
+
+ResultCache::Stats ResultCache::stats()
+{
+    MutexLockGuard guard(lock);
+    Stats s;
+    s.hits = hits;
+    s.misses = misses;
+    s.coalesced = coalesced;
+    s.bytes = bytes;
+    s.entries = entries.size();
+    return s;
+}
@@ -0,0 +1,83 @@
+#pragma once
+#include "MutexLock.h"
+#include "Condition.h"
+#include <string>
+#include <vector>
+#include <list>
+#include <memory>
+#include <atomic>
+#include <functional>
+#include <unordered_map>
+
+// 默认缓存的编码结果总大小
+const size_t RESULT_CACHE_BYTES = 64 * 1024 * 1024;
+
+struct CachedResult
+{
+    // HTTP状态码，成功时data为编码后的图片
+    int code;
+    std::string msg;
+    std::vector<unsigned char> data;
+    // 编码缓冲区还给当前线程的EncodePool
+    ~CachedResult();
+};
+
+// 按内容寻址的处理结果缓存：key由操作参数和请求body的哈希组成，
+// 按LRU淘汰，总大小有上限。相同key的并发请求合并成一次计算，其余请求等待结果。
+class ResultCache
+{
+public:
+    typedef std::shared_ptr<const CachedResult> resultPtr;
+    typedef std::function<resultPtr()> ComputeFn;
+
+    struct Stats
+    {
+        unsigned long hits;
+        unsigned long misses;
+        // 等待其他线程正在进行的相同计算
+        unsigned long coalesced;
+        size_t bytes;
+        size_t entries;
+    };
+
+private:
+    struct Entry
+    {
+        resultPtr result;
+        size_t bytes;
+        std::list<std::string>::iterator pos;
+    };
+    struct Flight
+    {
+        bool done;
+        resultPtr result;
+        Flight(): done(false) {}
+    };
+    static MutexLock lock;
+    static Condition cond;
+    static std::unordered_map<std::string, Entry> entries;
+    // 最近使用的在前
+    static std::list<std::string> lru;
+    static std::unordered_map<std::string, std::shared_ptr<Flight> > flights;
+    static size_t capacity;
+    static size_t bytes;
+    static std::atomic<unsigned long> hits;
+    static std::atomic<unsigned long> misses;
+    static std::atomic<unsigned long> coalesced;
+    ResultCache();
+    ResultCache(const ResultCache &r);
+
+    static bool cacheable(const CachedResult &r);
+    static void insert(const std::string &key, const resultPtr &r);
+    static void publish(const std::string &key, const std::shared_ptr<Flight> &flight, const resultPtr &r);
+
+public:
+    // 0表示不缓存，相同请求仍然合并
+    static void setCapacity(size_t bytes_);
+    // op描述操作和参数，不同参数的相同body得到不同的key
+    static std::string key(const std::string &op, const char *body, size_t length);
+    // 命中直接返回；相同key正在计算时等待；否则在当前线程上调用compute并发布结果。
+    // 取消等不能复用的结果不进缓存，等待的请求各自重新计算
+    static resultPtr get(const std::string &key, const ComputeFn &compute);
+    static Stats stats();
+};
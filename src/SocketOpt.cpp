@@ -0,0 +1,110 @@
+#include "SocketOpt.h"
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <stdio.h>
+
+// 默认同时开启所有优化
+SocketOptions SocketOpt::options = { 5, 256, true, true, 0, 0 };
+
+int SocketOpt::setProfile(const std::string &name)
+{
+    if (name == "none")
+    {
+        // 和最初的实现一致，只设置SO_REUSEADDR和O_NONBLOCK
+        options.deferAcceptSecs = 0;
+        options.fastOpenQueue = 0;
+        options.noDelay = false;
+        options.cork = false;
+    }
+    else if (name == "latency")
+    {
+        options.deferAcceptSecs = 5;
+        options.fastOpenQueue = 256;
+        options.noDelay = true;
+        options.cork = false;
+    }
+    else if (name == "throughput")
+    {
+        options.deferAcceptSecs = 5;
+        options.fastOpenQueue = 256;
+        options.noDelay = false;
+        options.cork = true;
+    }
+    else if (name == "default")
+    {
+        options.deferAcceptSecs = 5;
+        options.fastOpenQueue = 256;
+        options.noDelay = true;
+        options.cork = true;
+    }
+    else
+        return -1;
+    return 0;
+}
+
+void SocketOpt::setBufferSize(int sndBuf, int rcvBuf)
+{
+    options.sndBuf = sndBuf;
+    options.rcvBuf = rcvBuf;
+}
+
+const SocketOptions &SocketOpt::get()
+{
+    return options;
+}
+
+int SocketOpt::tuneListen(int listen_fd)
+{
+    int ret = 0;
+    if (options.deferAcceptSecs > 0 &&
+        setsockopt(listen_fd, IPPROTO_TCP, TCP_DEFER_ACCEPT, &options.deferAcceptSecs, sizeof(options.deferAcceptSecs)) == -1)
+    {
+        perror("setsockopt TCP_DEFER_ACCEPT");
+        ret = -1;
+    }
+    if (options.fastOpenQueue > 0 &&
+        setsockopt(listen_fd, IPPROTO_TCP, TCP_FASTOPEN, &options.fastOpenQueue, sizeof(options.fastOpenQueue)) == -1)
+    {
+        perror("setsockopt TCP_FASTOPEN");
+        ret = -1;
+    }
+    // 接收缓冲区要在listen之前设置才能协商窗口扩大选项
+    if (options.sndBuf > 0 &&
+        setsockopt(listen_fd, SOL_SOCKET, SO_SNDBUF, &options.sndBuf, sizeof(options.sndBuf)) == -1)
+    {
+        perror("setsockopt SO_SNDBUF");
+        ret = -1;
+    }
+    if (options.rcvBuf > 0 &&
+        setsockopt(listen_fd, SOL_SOCKET, SO_RCVBUF, &options.rcvBuf, sizeof(options.rcvBuf)) == -1)
+    {
+        perror("setsockopt SO_RCVBUF");
+        ret = -1;
+    }
+    return ret;
+}
+
+int SocketOpt::tuneConn(int fd)
+{
+    int optval = 1;
+    if (options.noDelay &&
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &optval, sizeof(optval)) == -1)
+        return -1;
+    return 0;
+}
+
+void SocketOpt::cork(int fd)
+{
+    int optval = 1;
+    if (options.cork)
+        setsockopt(fd, IPPROTO_TCP, TCP_CORK, &optval, sizeof(optval));
+}
+
+void SocketOpt::uncork(int fd)
+{
+    // 取消cork时内核立即发出剩余的不满一个MSS的数据
+    int optval = 0;
+    if (options.cork)
+        setsockopt(fd, IPPROTO_TCP, TCP_CORK, &optval, sizeof(optval));
+}
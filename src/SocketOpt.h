@@ -0,0 +1,38 @@
+#pragma once
+#include <string>
+
+// socket调优参数，由启动参数选择的profile决定，可单独覆盖缓冲区大小
+struct SocketOptions
+{
+    // 监听socket：TCP_DEFER_ACCEPT，数据到达后才唤醒accept，单位秒
+    int deferAcceptSecs;
+    // 监听socket：TCP_FASTOPEN 的队列长度，0表示不开启
+    int fastOpenQueue;
+    // 连接socket：TCP_NODELAY
+    bool noDelay;
+    // 连接socket：头部和文件内容之间用TCP_CORK合并发送
+    bool cork;
+    // SO_SNDBUF / SO_RCVBUF，0表示使用系统默认值
+    int sndBuf;
+    int rcvBuf;
+};
+
+class SocketOpt
+{
+private:
+    static SocketOptions options;
+    SocketOpt();
+    SocketOpt(const SocketOpt &s);
+
+public:
+    // profile: none / latency / throughput / default
+    static int setProfile(const std::string &name);
+    static void setBufferSize(int sndBuf, int rcvBuf);
+    static const SocketOptions &get();
+
+    // 在bind/listen之前调用，缓冲区大小会被accept出来的连接继承
+    static int tuneListen(int listen_fd);
+    static int tuneConn(int fd);
+    static void cork(int fd);
+    static void uncork(int fd);
+};
@@ -0,0 +1,147 @@
+#pragma once
+#include <string>
+#include <string.h>
+#include <stddef.h>
+#include <ctype.h>
+#include <limits.h>
+
+// 不持有数据的字符串片段(C++11还没有string_view)。请求中的片段指向请求的Arena，请求结束后失效
+class StrView
+{
+private:
+    const char *ptr;
+    size_t len;
+
+public:
+    static const size_t npos = static_cast<size_t>(-1);
+
+    StrView(): ptr(""), len(0) {}
+    StrView(const char *p, size_t n): ptr(p), len(n) {}
+    StrView(const char *s): ptr(s), len(strlen(s)) {}
+    StrView(const std::string &s): ptr(s.data()), len(s.size()) {}
+
+    const char *data() const
+    {
+        return ptr;
+    }
+    size_t size() const
+    {
+        return len;
+    }
+    bool empty() const
+    {
+        return len == 0;
+    }
+    char operator[](size_t i) const
+    {
+        return ptr[i];
+    }
+    size_t find(char c, size_t from = 0) const
+    {
+        if (from >= len)
+            return npos;
+        const void *p = memchr(ptr + from, c, len - from);
+        return p ? static_cast<const char*>(p) - ptr : npos;
+    }
+    size_t find(StrView s, size_t from = 0) const
+    {
+        for (size_t i = from; i + s.len <= len; ++i)
+        {
+            if (memcmp(ptr + i, s.ptr, s.len) == 0)
+                return i;
+        }
+        return npos;
+    }
+    size_t rfind(char c) const
+    {
+        for (size_t i = len; i > 0; --i)
+        {
+            if (ptr[i - 1] == c)
+                return i - 1;
+        }
+        return npos;
+    }
+    StrView substr(size_t pos, size_t n = npos) const
+    {
+        if (pos > len)
+            pos = len;
+        if (n > len - pos)
+            n = len - pos;
+        return StrView(ptr + pos, n);
+    }
+    bool startsWith(StrView prefix) const
+    {
+        return len >= prefix.len && memcmp(ptr, prefix.ptr, prefix.len) == 0;
+    }
+    bool operator==(StrView other) const
+    {
+        return len == other.len && memcmp(ptr, other.ptr, len) == 0;
+    }
+    bool operator!=(StrView other) const
+    {
+        return !(*this == other);
+    }
+    // 不区分大小写，用于HTTP头部的名字
+    bool caseEqual(StrView other) const
+    {
+        if (len != other.len)
+            return false;
+        for (size_t i = 0; i < len; ++i)
+        {
+            if (tolower(static_cast<unsigned char>(ptr[i])) != tolower(static_cast<unsigned char>(other.ptr[i])))
+                return false;
+        }
+        return true;
+    }
+    // 开头的十进制数，同atol，遇到非数字停止；没有数字时是0，超出long的范围时取±LONG_MAX
+    long toLong() const
+    {
+        size_t i = 0;
+        while (i < len && ptr[i] == ' ')
+            ++i;
+        bool neg = i < len && ptr[i] == '-';
+        if (i < len && (ptr[i] == '-' || ptr[i] == '+'))
+            ++i;
+        long n = 0;
+        for (; i < len && ptr[i] >= '0' && ptr[i] <= '9'; ++i)
+        {
+            long d = ptr[i] - '0';
+            if (n > (LONG_MAX - d) / 10)
+            {
+                n = LONG_MAX;
+                break;
+            }
+            n = n * 10 + d;
+        }
+        return neg ? -n : n;
+    }
+    // 整个片段是不带符号的十进制数(前后可以有空格)，超过limit或者格式不对返回false。
+    // 用于客户端给出的长度，不会溢出
+    bool toSize(size_t limit, size_t &out) const
+    {
+        size_t i = 0, end = len;
+        while (i < end && ptr[i] == ' ')
+            ++i;
+        while (end > i && ptr[end - 1] == ' ')
+            --end;
+        if (i == end)
+            return false;
+        size_t n = 0;
+        for (; i < end; ++i)
+        {
+            if (ptr[i] < '0' || ptr[i] > '9')
+                return false;
+            size_t d = ptr[i] - '0';
+            if (d > limit || n > (limit - d) / 10)
+                return false;
+            n = n * 10 + d;
+        }
+        out = n;
+        return true;
+    }
+    // 需要std::string的接口(图像处理等冷路径)才拷贝
+    std::string str() const
+    {
+        return std::string(ptr, len);
+    }
+};
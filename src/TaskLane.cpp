@@ -0,0 +1,95 @@
+#include "TaskLane.h"
+#include "Logger.h"
+#include <stdio.h>
+
+TaskLane::TaskLane(const std::string &name_):
+    name(name_),
+    cond(lock),
+    queue_size(0),
+    shutdown(false)
+{
+}
+
+TaskLane::~TaskLane()
+{
+    stop();
+}
+
+int TaskLane::start(int thread_count_, int queue_size_)
+{
+    if (thread_count_ <= 0 || queue_size_ <= 0)
+        return -1;
+    queue_size = queue_size_;
+    threads.resize(thread_count_);
+    for (int i = 0; i < thread_count_; ++i)
+    {
+        if (pthread_create(&threads[i], NULL, threadRun, this) != 0)
+        {
+            threads.resize(i);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+int TaskLane::add(const Task &task)
+{
+    MutexLockGuard locker(lock);
+    if (threads.empty())
+        return LANE_NOT_STARTED;
+    if (shutdown)
+        return LANE_SHUTDOWN;
+    if (tasks.size() >= queue_size)
+        return LANE_QUEUE_FULL;
+    tasks.push_back(task);
+    cond.notify();
+    return 0;
+}
+
+void TaskLane::stop()
+{
+    {
+        MutexLockGuard locker(lock);
+        if (shutdown)
+            return;
+        shutdown = true;
+        cond.notifyAll();
+    }
+    for (size_t i = 0; i < threads.size(); ++i)
+        pthread_join(threads[i], NULL);
+    threads.clear();
+}
+
+bool TaskLane::started()
+{
+    MutexLockGuard locker(lock);
+    return !threads.empty() && !shutdown;
+}
+
+size_t TaskLane::queued()
+{
+    MutexLockGuard locker(lock);
+    return tasks.size();
+}
+
+void *TaskLane::threadRun(void *args)
+{
+    TaskLane *lane = static_cast<TaskLane*>(args);
+    while (true)
+    {
+        Task task;
+        {
+            MutexLockGuard locker(lane->lock);
+            while (lane->tasks.empty() && !lane->shutdown)
+                lane->cond.wait();
+            // 关闭时先把队列中剩余的任务做完
+            if (lane->tasks.empty())
+                break;
+            task.swap(lane->tasks.front());
+            lane->tasks.pop_front();
+        }
+        task();
+    }
+    LOG_INFO("TaskLane %s thread finishs", lane->name.c_str());
+    return NULL;
+}
@@ -0,0 +1,40 @@
+#pragma once
+#include "nocopyable.h"
+#include "MutexLock.h"
+#include "Condition.h"
+#include <pthread.h>
+#include <functional>
+#include <deque>
+#include <vector>
+#include <string>
+
+const int LANE_QUEUE_FULL = -1;
+const int LANE_SHUTDOWN = -2;
+const int LANE_NOT_STARTED = -3;
+
+// 和ThreadPool分开的小线程池，用来承担会阻塞或者很耗时的工作(磁盘读、图像计算)，
+// 避免占住处理连接的工作线程
+class TaskLane: noncopyable
+{
+public:
+    typedef std::function<void()> Task;
+
+    explicit TaskLane(const std::string &name_);
+    ~TaskLane();
+    int start(int thread_count_, int queue_size_);
+    int add(const Task &task);
+    void stop();
+    bool started();
+    size_t queued();
+
+private:
+    static void *threadRun(void *args);
+
+    std::string name;
+    MutexLock lock;
+    Condition cond;
+    std::deque<Task> tasks;
+    std::vector<pthread_t> threads;
+    size_t queue_size;
+    bool shutdown;
+};
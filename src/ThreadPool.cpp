@@ -1,4 +1,7 @@
 #include "ThreadPool.h"
+#include "Logger.h"
+#include "Metrics.h"
+#include "Probes.h"
 
 
 pthread_mutex_t ThreadPool::lock = PTHREAD_MUTEX_INITIALIZER;
@@ -51,17 +54,21 @@ int ThreadPool::ThreadPoolCreate(int _thread_count, int _queue_size)
     return 0;
 }
 
-void Handler(std::shared_ptr<void> req)
+void Handler(reqPtr &req)
 {
-    std::shared_ptr<RequestData> request = std::static_pointer_cast<RequestData>(req);
-    if (request->isCanWrite())
+    RequestData *request = req.get();
+    request->traceMark(TRACE_DEQUEUE);
+    if (request->isCanReap())
+        request->handleErrQueue();
+    else if (request->isCanWrite())
         request->handleWrite();
     else if (request->isCanRead())
         request->handleRead();
-    request->handleConn();
+    // 重新注册或者挂起时连接的所有权从req移走
+    request->handleConn(req);
 }
 
-int ThreadPool::ThreadPoolAdd(std::shared_ptr<void> args, std::function<void(std::shared_ptr<void>)> fun)
+int ThreadPool::ThreadPoolAdd(reqPtr &conn)
 {
     int next, err = 0;
     if(pthread_mutex_lock(&lock) != 0)
@@ -81,8 +88,9 @@ int ThreadPool::ThreadPoolAdd(std::shared_ptr<void> args, std::function<void(std
             err = THREADPOOL_SHUTDOWN;
             break;
         }
-        taskQueue[tail].fun = fun;
-        taskQueue[tail].args = args;
+        SERVER_PROBE2(task_enqueue, conn.get(), count + 1);
+        taskQueue[tail].conn = std::move(conn);
+        taskQueue[tail].enqueued = Metrics::now();
         tail = next;
         ++count;
         
@@ -97,13 +105,15 @@ int ThreadPool::ThreadPoolAdd(std::shared_ptr<void> args, std::function<void(std
 
     if(pthread_mutex_unlock(&lock) != 0)
         err = THREADPOOL_LOCK_FAILURE;
+    if (err == THREADPOOL_QUEUE_FULL)
+        Metrics::add(METRIC_QUEUE_REJECTED);
     return err;
 }
 
 
 int ThreadPool::ThreadPoolDestroy(ShutDownOption shutdown_option)
 {
-    printf("Thread pool destroy !\n");
+    LOG_INFO("Thread pool destroy");
     int i, err = 0;
 
     if(pthread_mutex_lock(&lock) != 0) 
@@ -170,18 +180,27 @@ void *ThreadPool::threadRun(void *args)
         {
             break;
         }
-        task.fun = taskQueue[head].fun;
-        task.args = taskQueue[head].args;
-        taskQueue[head].fun = NULL;
-        taskQueue[head].args.reset();
+        task.conn = std::move(taskQueue[head].conn);
+        task.enqueued = taskQueue[head].enqueued;
         head = (head + 1) % queue_size;
         --count;
         pthread_mutex_unlock(&lock);
-        (task.fun)(task.args);
+        uint64_t waited = Metrics::now() - task.enqueued;
+        Metrics::observe(HIST_QUEUE_WAIT, waited);
+        SERVER_PROBE2(task_dequeue, task.conn.get(), waited);
+        // 没有重新注册也没有挂起的连接在这里析构
+        Handler(task.conn);
     }
     --started;
     pthread_mutex_unlock(&lock);
-    printf("This threadpool thread finishs!\n");
+    LOG_INFO("This threadpool thread finishs");
     pthread_exit(NULL);
     return(NULL);
+}
+int ThreadPool::queued()
+{
+    pthread_mutex_lock(&lock);
+    int n = count;
+    pthread_mutex_unlock(&lock);
+    return n;
 }
\ No newline at end of file
@@ -1,10 +1,11 @@
 #pragma once
 #include "RequestData.h"
+#include "RequestPtr.h"
 //#include "condition.hpp"
 #include <pthread.h>
-#include <functional>
 #include <memory>
 #include <vector>
+#include <stdint.h>
 
 const int THREADPOOL_INVALID = -1;
 const int THREADPOOL_LOCK_FAILURE = -2;
@@ -22,13 +23,15 @@ typedef enum
     graceful_shutdown  = 2
 } ShutDownOption;
 
+// 任务就是一个有事件的连接，入队和出队都是移动
 struct ThreadTask
 {
-    std::function<void(std::shared_ptr<void>)> fun;
-    std::shared_ptr<void> args;
+    reqPtr conn;
+    // 入队时刻，统计排队时间
+    uint64_t enqueued;
 };
 
-void Handler(std::shared_ptr<void> req);
+void Handler(reqPtr &req);
 
 class ThreadPool
 {
@@ -47,8 +50,11 @@ private:
     static int started;
 public:
     static int ThreadPoolCreate(int thread_count_, int queue_size_);
-    static int ThreadPoolAdd(std::shared_ptr<void> args, std::function<void(std::shared_ptr<void>)> fun = Handler);
+    // 成功时conn的所有权转给任务队列
+    static int ThreadPoolAdd(reqPtr &conn);
     static int ThreadPoolDestroy(ShutDownOption shutdown_option = graceful_shutdown);
     static int ThreadPoolFree();
     static void *threadRun(void *args);
+    // 当前排队的任务数
+    static int queued();
 };
\ No newline at end of file
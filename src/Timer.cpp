@@ -1,123 +1,125 @@
 #include "Timer.h"
 #include "Epoll.h"
-#include <unordered_map>
-#include <string>
+#include "Metrics.h"
+#include "Probes.h"
 #include <sys/time.h>
 #include <unistd.h>
-#include <deque>
-#include <queue>
 
-#include <iostream>
-using namespace std;
-
-Timer::Timer(reqPtr _request_data, int timeout): 
-    deleted(false), 
-    request_data(_request_data)
+namespace
+{
+size_t nowMs()
 {
     struct timeval now;
     gettimeofday(&now, NULL);
     // 以毫秒计
-    expired_time = ((now.tv_sec * 1000) + (now.tv_usec / 1000)) + timeout;
-}
-
-Timer::~Timer()
-{
-    if (request_data)
-    {
-        Epoll::epollDel(request_data->getFd());
-    }
+    return (now.tv_sec * 1000) + (now.tv_usec / 1000);
 }
-
-void Timer::update(int timeout)
-{
-    struct timeval now;
-    gettimeofday(&now, NULL);
-    expired_time = ((now.tv_sec * 1000) + (now.tv_usec / 1000)) + timeout;
 }
 
-bool Timer::isValid()
+TimerManager::TimerManager(int maxFds_): 
+    nodes(new TimerNode[maxFds_ + TIMER_WHEEL_SLOTS]),
+    maxFds(maxFds_),
+    base(nowMs()),
+    lastTick(0)
 {
-    struct timeval now;
-    gettimeofday(&now, NULL);
-    size_t temp = ((now.tv_sec * 1000) + (now.tv_usec / 1000));
-    if (temp < expired_time)
+    for (int i = 0; i < maxFds; ++i)
     {
-        return true;
+        nodes[i].prev = nodes[i].next = -1;
+        nodes[i].expire.store(0, std::memory_order_relaxed);
     }
-    else
+    for (uint32_t s = 0; s < TIMER_WHEEL_SLOTS; ++s)
     {
-        this->setDeleted();
-        return false;
+        int head = maxFds + s;
+        nodes[head].prev = nodes[head].next = head;
+        nodes[head].expire.store(0, std::memory_order_relaxed);
     }
 }
 
-void Timer::clearReq()
-{
-    request_data.reset();
-    this->setDeleted();
-}
-
-void Timer::setDeleted()
-{
-    deleted = true;
-}
-
-bool Timer::isDeleted() const
+TimerManager::~TimerManager()
 {
-    return deleted;
+    delete[] nodes;
 }
 
-size_t Timer::getExpTime() const
+void TimerManager::link(int idx, int head)
 {
-    return expired_time;
+    nodes[idx].prev = nodes[head].prev;
+    nodes[idx].next = head;
+    nodes[nodes[head].prev].next = idx;
+    nodes[head].prev = idx;
 }
 
-TimerManager::TimerManager()
+void TimerManager::unlink(int idx)
 {
+    nodes[nodes[idx].prev].next = nodes[idx].next;
+    nodes[nodes[idx].next].prev = nodes[idx].prev;
+    nodes[idx].prev = nodes[idx].next = -1;
 }
 
-TimerManager::~TimerManager()
+void TimerManager::addTimer(int fd, int timeout)
 {
+    if (fd < 0 || fd >= maxFds)
+        return;
+    // 向上取整到tick，不会早于设定的时间到期
+    uint32_t expire = (nowMs() + timeout - base + TIMER_TICK_MS - 1) / TIMER_TICK_MS;
+    MutexLockGuard locker(lock);
+    // 已经处理过的槽要转一圈才会再看，至少放到下一个tick
+    if (expire <= lastTick)
+        expire = lastTick + 1;
+    if (nodes[fd].prev >= 0)
+        unlink(fd);
+    nodes[fd].expire.store(expire, std::memory_order_relaxed);
+    link(fd, maxFds + (expire & (TIMER_WHEEL_SLOTS - 1)));
 }
 
-void TimerManager::addTimer(reqPtr request_data_, int timeout)
+// 只有持有连接的线程会改自己描述符的节点，不需要加锁
+void TimerManager::cancelTimer(int fd)
 {
-    timerPtr newTimer(new Timer(request_data_, timeout));
-    {
-        MutexLockGuard locker(lock);
-        timerQueue.push(newTimer);
-    }
-    request_data_->linkTimer(newTimer);
+    if (fd >= 0 && fd < maxFds)
+        nodes[fd].expire.store(0, std::memory_order_relaxed);
 }
 
-void TimerManager::addTimer(timerPtr timer_node) {}
-
 /* 
-对于被置为deleted的时间节点，会延迟到它(1)超时 或 (2)它前面的节点都被删除时，它才会被删除。
-一个点被置为deleted,它最迟会在TIMER_TIME_OUT时间后被删除。
-这样做有两个好处：
-(1) 第一个好处是不需要遍历优先队列，省时。
-(2) 第二个好处是给超时时间一个容忍的时间，就是设定的超时时间是删除的下限(并不是一到超时时间就立即删除)，如果监听的请求在超时后的下一次请求中又一次出现了，
-就不用再重新申请RequestData节点了，这样可以继续重复利用前面的RequestData，减少了一次delete和一次new的时间。
+连接分离定时器时只把到期tick清零，节点留在槽里，转到这个槽或者重新加定时器时才摘下来，
+这样分离定时器不用加锁。每个tick只看一个槽，还没到期的(超时超过一圈)留在原地。
+到期的节点先在锁内取出来，关闭连接放在锁外：连接析构时可能释放body预算，唤醒别的连接，进而重新加定时器。
 */
 
 void TimerManager::handleEvent()
 {
-    MutexLockGuard locker(lock);
-    while (!timerQueue.empty())
+    expired.clear();
     {
-        timerPtr ptimer_now = timerQueue.top();
-        if (ptimer_now->isDeleted())
-        {
-            timerQueue.pop();
-        }
-        else if (ptimer_now->isValid() == false)
+        uint32_t now = (nowMs() - base) / TIMER_TICK_MS;
+        MutexLockGuard locker(lock);
+        // 主线程停顿太久时最多补一圈，每个槽仍然都会看到
+        if (now - lastTick > TIMER_WHEEL_SLOTS)
+            lastTick = now - TIMER_WHEEL_SLOTS;
+        while (lastTick < now)
         {
-            timerQueue.pop();
+            ++lastTick;
+            int head = maxFds + (lastTick & (TIMER_WHEEL_SLOTS - 1));
+            for (int i = nodes[head].next; i != head;)
+            {
+                int next = nodes[i].next;
+                uint32_t expire = nodes[i].expire.load(std::memory_order_relaxed);
+                if (expire == 0)
+                    unlink(i);
+                else if (expire <= lastTick)
+                {
+                    unlink(i);
+                    nodes[i].expire.store(0, std::memory_order_relaxed);
+                    expired.push_back(i);
+                }
+                i = next;
+            }
         }
-        else
+    }
+    for (size_t i = 0; i < expired.size(); ++i)
+    {
+        // 连接已经被工作线程接手时什么都不做
+        if (Epoll::expireConn(expired[i]))
         {
-            break;
+            Metrics::add(METRIC_TIMER_EXPIRED);
+            SERVER_PROBE1(timer_fire, expired[i]);
         }
     }
 }
\ No newline at end of file
@@ -1,52 +1,47 @@
 #pragma once
 
-#include "RequestData.h"
 #include "nocopyable.h"
 #include "MutexLock.h"
 #include <unistd.h>
-#include <memory>
-#include <queue>
-#include <deque>
+#include <stdint.h>
+#include <atomic>
+#include <vector>
 
-class RequestData;
+// 时间轮的精度和槽数：4096个100ms的槽转一圈约7分钟，覆盖keep-alive的超时，更长的超时多转几圈
+const int TIMER_TICK_MS = 100;
+const uint32_t TIMER_WHEEL_SLOTS = 4096;
 
-class Timer
+// 定时器不持有连接，每个描述符固定一个节点，挂在到期tick所在槽的双向链表上。
+// 链表用下标连接，不申请内存；槽头是放在描述符节点后面的哨兵
+struct TimerNode
 {
-    typedef std::shared_ptr<RequestData> reqPtr;
-private:
-    bool deleted;
-    size_t expired_time;
-    reqPtr request_data;
-public:
-    Timer(reqPtr request_data_, int timeout);
-    ~Timer();
-    void update(int timeout);
-    bool isValid();
-    void clearReq();
-    void setDeleted();
-    bool isDeleted() const;
-    size_t getExpTime() const;
-};
-
-struct timerCmp
-{
-    bool operator()(std::shared_ptr<Timer> &lhs, std::shared_ptr<Timer> &rhs) const
-    {
-        return lhs->getExpTime() > rhs->getExpTime();
-    }
+    int prev;
+    int next;
+    // 到期的tick，0表示没有定时器
+    std::atomic<uint32_t> expire;
 };
 
-class TimerManager
+class TimerManager: noncopyable
 {
-    typedef std::shared_ptr<RequestData> reqPtr;
-    typedef std::shared_ptr<Timer> timerPtr;
 private:
-    std::priority_queue<timerPtr, std::deque<timerPtr>, timerCmp> timerQueue;
+    // maxFds个描述符节点，后面是TIMER_WHEEL_SLOTS个槽头
+    TimerNode *nodes;
+    int maxFds;
+    size_t base;
+    // 已经处理完的tick
+    uint32_t lastTick;
+    // 每轮到期的描述符，只在主线程上用，复用同一个数组
+    std::vector<int> expired;
     MutexLock lock;
+
+    void link(int idx, int head);
+    void unlink(int idx);
 public:
-    TimerManager();
+    explicit TimerManager(int maxFds_);
     ~TimerManager();
-    void addTimer(reqPtr request_data_, int timeout);
-    void addTimer(timerPtr timer_);
+    // 调用方此时持有连接(连接不在epoll中)
+    void addTimer(int fd, int timeout);
+    void cancelTimer(int fd);
+    // 主线程上调用，到期的连接通过Epoll::expireConn关闭
     void handleEvent();
 };
\ No newline at end of file
@@ -0,0 +1,184 @@
+#include "Trace.h"
+#include "Logger.h"
+#include <stdio.h>
+#include <string.h>
+using namespace std;
+
+std::atomic<unsigned long> Tracer::every(0);
+unsigned long Tracer::rate = TRACE_EVERY_DEFAULT;
+unsigned long Tracer::counter = 0;
+std::string Tracer::file = "trace.json";
+Tracer::Slot Tracer::ring[TRACE_RING_SIZE];
+std::atomic<uint64_t> Tracer::head(0);
+uint64_t Tracer::baseTicks = 0;
+uint64_t Tracer::baseNanos = 0;
+volatile sig_atomic_t Tracer::dumpRequested = 0;
+volatile sig_atomic_t Tracer::toggleRequested = 0;
+
+namespace
+{
+// 相邻两个阶段之间的区间
+struct Span
+{
+    const char *name;
+    int from;
+    int to;
+};
+const Span spans[] = {
+    { "dispatch", TRACE_WAKEUP, TRACE_ENQUEUE },
+    { "queue", TRACE_ENQUEUE, TRACE_DEQUEUE },
+    { "parse", TRACE_DEQUEUE, TRACE_PARSE },
+    { "body", TRACE_PARSE, TRACE_READ },
+    { "handler", TRACE_READ, TRACE_HANDLER },
+    { "write", TRACE_HANDLER, TRACE_WRITE },
+};
+}
+
+uint64_t Tracer::monoNanos()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+void Tracer::onSignal(int sig)
+{
+    if (sig == SIGUSR1)
+        toggleRequested = 1;
+    else
+        dumpRequested = 1;
+}
+
+void Tracer::init(unsigned long every_, const std::string &file_)
+{
+    every.store(every_, std::memory_order_relaxed);
+    if (every_ != 0)
+        rate = every_;
+    if (!file_.empty())
+        file = file_;
+    baseTicks = ticks();
+    baseNanos = monoNanos();
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = onSignal;
+    sa.sa_flags = SA_RESTART;
+    sigaction(SIGUSR1, &sa, NULL);
+    sigaction(SIGUSR2, &sa, NULL);
+}
+
+unsigned long Tracer::getEvery()
+{
+    return every.load(std::memory_order_relaxed);
+}
+
+void Tracer::submit(const TraceRecord &record)
+{
+    uint64_t pos = head.fetch_add(1, std::memory_order_relaxed);
+    Slot &slot = ring[pos & (TRACE_RING_SIZE - 1)];
+    // seqlock：先标记正在写，导出时发现序号变了就跳过这一项
+    slot.seq.store(pos * 2 + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    for (int i = 0; i < TRACE_STAGES; ++i)
+        slot.words[i].store(record.stamps[i], std::memory_order_relaxed);
+    slot.words[TRACE_STAGES].store(record.id, std::memory_order_relaxed);
+    slot.words[TRACE_STAGES + 1].store(record.fd, std::memory_order_relaxed);
+    slot.seq.store(pos * 2 + 2, std::memory_order_release);
+}
+
+string Tracer::json()
+{
+    // 用启动以来的整段时间换算ticks，比启动时短暂校准准确
+    uint64_t nowTicks = ticks();
+    uint64_t nowNanos = monoNanos();
+    double nsPerTick = 1.0;
+    if (nowTicks > baseTicks)
+        nsPerTick = static_cast<double>(nowNanos - baseNanos) / (nowTicks - baseTicks);
+
+    uint64_t end = head.load(std::memory_order_acquire);
+    uint64_t begin = end > TRACE_RING_SIZE ? end - TRACE_RING_SIZE : 0;
+    string out = "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[";
+    bool first = true;
+    char buf[512];
+    for (uint64_t pos = begin; pos < end; ++pos)
+    {
+        Slot &slot = ring[pos & (TRACE_RING_SIZE - 1)];
+        uint64_t seq = slot.seq.load(std::memory_order_acquire);
+        if (seq != pos * 2 + 2)
+            continue;
+        uint64_t words[WORDS];
+        for (int i = 0; i < WORDS; ++i)
+            words[i] = slot.words[i].load(std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (slot.seq.load(std::memory_order_relaxed) != seq)
+            continue;
+
+        uint64_t start = 0, last = 0;
+        for (int i = 0; i < TRACE_STAGES; ++i)
+        {
+            if (words[i] == 0)
+                continue;
+            if (start == 0 || words[i] < start)
+                start = words[i];
+            if (words[i] > last)
+                last = words[i];
+        }
+        if (start == 0)
+            continue;
+        unsigned long long id = words[TRACE_STAGES];
+        int fd = static_cast<int>(words[TRACE_STAGES + 1]);
+        // 整个请求一个区间，各阶段的区间嵌套在里面
+        int n = snprintf(buf, sizeof(buf),
+            "%s{\"name\":\"request\",\"cat\":\"http\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f,\"args\":{\"id\":%llu,\"complete\":%s}}",
+            first ? "" : ",", fd, (start - baseTicks) * nsPerTick / 1000, (last - start) * nsPerTick / 1000, id,
+            words[TRACE_WRITE] ? "true" : "false");
+        out.append(buf, n);
+        first = false;
+        for (size_t i = 0; i < sizeof(spans) / sizeof(spans[0]); ++i)
+        {
+            uint64_t from = words[spans[i].from], to = words[spans[i].to];
+            if (from == 0 || to == 0 || to < from)
+                continue;
+            n = snprintf(buf, sizeof(buf),
+                ",{\"name\":\"%s\",\"cat\":\"http\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f,\"args\":{\"id\":%llu}}",
+                spans[i].name, fd, (from - baseTicks) * nsPerTick / 1000, (to - from) * nsPerTick / 1000, id);
+            out.append(buf, n);
+        }
+    }
+    out += "]}\n";
+    return out;
+}
+
+int Tracer::dump(const std::string &path)
+{
+    string text = json();
+    FILE *fp = fopen(path.c_str(), "w");
+    if (fp == NULL)
+    {
+        LOG_ERROR("trace dump %s: %m", path.c_str());
+        return -1;
+    }
+    size_t n = fwrite(text.data(), 1, text.size(), fp);
+    if (fclose(fp) != 0 || n != text.size())
+    {
+        LOG_ERROR("trace dump %s: %m", path.c_str());
+        return -1;
+    }
+    LOG_INFO("trace dumped to %s", path.c_str());
+    return 0;
+}
+
+void Tracer::poll()
+{
+    if (toggleRequested)
+    {
+        toggleRequested = 0;
+        unsigned long n = every.load(std::memory_order_relaxed) == 0 ? rate : 0;
+        every.store(n, std::memory_order_relaxed);
+        LOG_INFO("request tracing %s (every %lu)", n ? "on" : "off", rate);
+    }
+    if (dumpRequested)
+    {
+        dumpRequested = 0;
+        dump(file);
+    }
+}
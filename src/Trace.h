@@ -0,0 +1,91 @@
+#pragma once
+#include <atomic>
+#include <string>
+#include <stdint.h>
+#include <time.h>
+#include <signal.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+// 请求经过的阶段，按时间先后
+const int TRACE_WAKEUP = 0;   // epoll返回
+const int TRACE_ENQUEUE = 1;  // 放进线程池队列
+const int TRACE_DEQUEUE = 2;  // 工作线程取出
+const int TRACE_PARSE = 3;    // 请求行和头部解析完
+const int TRACE_READ = 4;     // 整个请求(包括body)读完
+const int TRACE_HANDLER = 5;  // 响应生成完
+const int TRACE_WRITE = 6;    // 最后一个字节写出
+const int TRACE_STAGES = 7;
+// 环形缓冲区保留最近这么多个请求，必须是2的幂
+const size_t TRACE_RING_SIZE = 8192;
+// 启动时没有用-t打开采样，收到SIGUSR1时按这个采样率打开
+const unsigned long TRACE_EVERY_DEFAULT = 100;
+
+// 一个被采样请求的各阶段时间戳(Tracer::ticks())，0表示没有经过
+struct TraceRecord
+{
+    uint64_t stamps[TRACE_STAGES];
+    uint64_t id;
+    uint64_t fd;
+};
+
+// 按采样记录请求的阶段时间戳，写进无锁环形缓冲区，可以导出成Chrome trace(Perfetto也能打开)的JSON。
+// 没有打开采样时请求路径上只多一次判断。
+class Tracer
+{
+private:
+    static const int WORDS = TRACE_STAGES + 2;
+    struct Slot
+    {
+        // 奇数表示正在写，偶数是写完时的(序号+1)*2
+        std::atomic<uint64_t> seq;
+        std::atomic<uint64_t> words[WORDS];
+    };
+    // 每N个请求采样一个，0表示关闭，SIGUSR1在0和rate之间切换
+    static std::atomic<unsigned long> every;
+    static unsigned long rate;
+    // 只在主线程(getEvents)上采样，不需要原子操作
+    static unsigned long counter;
+    static std::string file;
+    static Slot ring[TRACE_RING_SIZE];
+    static std::atomic<uint64_t> head;
+    // 换算ticks和纳秒的基准点
+    static uint64_t baseTicks;
+    static uint64_t baseNanos;
+    static volatile sig_atomic_t dumpRequested;
+    static volatile sig_atomic_t toggleRequested;
+    Tracer();
+    Tracer(const Tracer &t);
+
+    static uint64_t monoNanos();
+    static void onSignal(int sig);
+
+public:
+    // file为收到SIGUSR2时导出的文件
+    static void init(unsigned long every_, const std::string &file_);
+    static unsigned long getEvery();
+    // 新请求开始时调用，返回非0的请求序号表示跟踪这个请求
+    static uint64_t sample()
+    {
+        unsigned long n = every.load(std::memory_order_relaxed);
+        if (n == 0)
+            return 0;
+        return ++counter % n == 0 ? counter : 0;
+    }
+    // x86上是TSC(constant_tsc，各核同步)，其他平台退回单调时钟
+    static uint64_t ticks()
+    {
+#if defined(__x86_64__) || defined(__i386__)
+        return __rdtsc();
+#else
+        return monoNanos();
+#endif
+    }
+    static void submit(const TraceRecord &record);
+    // 环形缓冲区中的请求，Chrome trace JSON
+    static std::string json();
+    static int dump(const std::string &path);
+    // 主循环中调用，处理SIGUSR1的开关和SIGUSR2请求的导出
+    static void poll();
+};
@@ -0,0 +1,227 @@
+#include "ZeroCopy.h"
+#include "Logger.h"
+#include <sys/socket.h>
+#include <sys/ioctl.h>
+#include <linux/sockios.h>
+#include <netinet/in.h>
+#include <linux/errqueue.h>
+#include <errno.h>
+#include <string.h>
+#include <stdio.h>
+#include <limits.h>
+#include <time.h>
+
+#ifndef SO_ZEROCOPY
+#define SO_ZEROCOPY 60
+#endif
+#ifndef MSG_ZEROCOPY
+#define MSG_ZEROCOPY 0x4000000
+#endif
+#ifndef SO_EE_ORIGIN_ZEROCOPY
+#define SO_EE_ORIGIN_ZEROCOPY 5
+#endif
+#ifndef SO_EE_CODE_ZEROCOPY_COPIED
+#define SO_EE_CODE_ZEROCOPY_COPIED 1
+#endif
+
+size_t ZeroCopySender::threshold = 0;
+
+void ZeroCopySender::setThreshold(size_t bytes)
+{
+    threshold = bytes;
+}
+
+size_t ZeroCopySender::getThreshold()
+{
+    return threshold;
+}
+
+ZeroCopySender::ZeroCopySender():
+    body(NULL),
+    length(0),
+    offset(0),
+    seq(0),
+    done(0),
+    bodySeq(0),
+    enabled(false),
+    copied(false),
+    lastQueued(INT_MAX),
+    lastDone(0),
+    lastProgress(0)
+{
+}
+
+bool ZeroCopySender::take(int fd, const std::shared_ptr<const void> &owner_, const unsigned char *data, size_t len)
+{
+    if (threshold == 0 || copied || len < threshold || sending())
+        return false;
+    if (!enabled)
+    {
+        int optval = 1;
+        if (setsockopt(fd, SOL_SOCKET, SO_ZEROCOPY, &optval, sizeof(optval)) < 0)
+        {
+            // 内核不支持，这个连接以后都走拷贝路径
+            LOG_WARN("fd %d SO_ZEROCOPY: %m", fd);
+            copied = true;
+            return false;
+        }
+        enabled = true;
+    }
+    owner = owner_;
+    body = data;
+    length = len;
+    offset = 0;
+    bodySeq = seq;
+    return true;
+}
+
+bool ZeroCopySender::sending() const
+{
+    return body != NULL;
+}
+
+bool ZeroCopySender::waiting() const
+{
+    // body还没发完时前面的send也可能已经在等通知，通知随时会以EPOLLERR到达
+    return !pending.empty() || done != seq;
+}
+
+// 序号会回绕，按差值比较
+static bool seqBefore(uint32_t a, uint32_t b)
+{
+    return static_cast<int32_t>(a - b) < 0;
+}
+
+void ZeroCopySender::release()
+{
+    while (!pending.empty() && seqBefore(pending.front().lastSeq, done))
+        pending.pop_front();
+}
+
+void ZeroCopySender::reset()
+{
+    owner.reset();
+    pending.clear();
+    body = NULL;
+    length = 0;
+    offset = 0;
+    seq = 0;
+    done = 0;
+    bodySeq = 0;
+    enabled = false;
+    copied = false;
+    lastQueued = INT_MAX;
+    lastDone = 0;
+    lastProgress = 0;
+}
+
+ssize_t ZeroCopySender::send(int fd)
+{
+    ssize_t sendSum = 0;
+    while (offset < length)
+    {
+        const unsigned char *ptr = body + offset;
+        size_t nleft = length - offset;
+        ssize_t n = ::send(fd, ptr, nleft, MSG_ZEROCOPY);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            else if (errno == EAGAIN)
+                break;
+            else if (errno == ENOBUFS)
+            {
+                // 超过optmem限制，这一段改用普通拷贝发送
+                n = ::send(fd, ptr, nleft, 0);
+                if (n < 0)
+                {
+                    if (errno == EINTR)
+                        continue;
+                    else if (errno == EAGAIN)
+                        break;
+                    return -1;
+                }
+            }
+            else
+                return -1;
+        }
+        else
+        {
+            // 每次成功的零拷贝send占用一个通知序号
+            ++seq;
+        }
+        offset += n;
+        sendSum += n;
+    }
+    if (body != NULL && offset == length)
+    {
+        // 全部回退成普通发送时没有完成通知，可以直接释放
+        if (seq != bodySeq)
+        {
+            Pending p;
+            p.lastSeq = seq - 1;
+            p.owner.swap(owner);
+            pending.push_back(std::move(p));
+        }
+        owner.reset();
+        body = NULL;
+        length = 0;
+        offset = 0;
+        // 从这里开始计算等待完成通知的进展
+        lastQueued = INT_MAX;
+        lastProgress = 0;
+        release();
+    }
+    return sendSum;
+}
+
+int ZeroCopySender::reap(int fd)
+{
+    while (true)
+    {
+        char control[128];
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        if (recvmsg(fd, &msg, MSG_ERRQUEUE) < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            else if (errno == EAGAIN)
+                break;
+            return -1;
+        }
+        for (struct cmsghdr *cm = CMSG_FIRSTHDR(&msg); cm != NULL; cm = CMSG_NXTHDR(&msg, cm))
+        {
+            if (!(cm->cmsg_level == SOL_IP && cm->cmsg_type == IP_RECVERR) &&
+                !(cm->cmsg_level == SOL_IPV6 && cm->cmsg_type == IPV6_RECVERR))
+                continue;
+            struct sock_extended_err *serr = reinterpret_cast<struct sock_extended_err*>(CMSG_DATA(cm));
+            if (serr->ee_errno != 0 || serr->ee_origin != SO_EE_ORIGIN_ZEROCOPY)
+                continue;
+            // TCP的完成通知按序到达，[ee_info, ee_data]区间内的send已完成
+            done = serr->ee_data + 1;
+            if (serr->ee_code & SO_EE_CODE_ZEROCOPY_COPIED)
+                copied = true;
+        }
+    }
+    release();
+    return 0;
+}
+
+bool ZeroCopySender::stalled(int fd)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    long long now = ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+    // 完成通知要等对端确认整段send，慢速的客户端上要看发送队列是否还在往外走
+    int queued = 0;
+    if (ioctl(fd, SIOCOUTQ, &queued) < 0)
+        return true;
+    if (lastProgress == 0 || queued < lastQueued || done != lastDone)
+        lastProgress = now;
+    lastQueued = queued;
+    lastDone = done;
+    return now - lastProgress >= ZEROCOPY_STALL_MS;
+}
@@ -0,0 +1,68 @@
+#pragma once
+#include "nocopyable.h"
+#include <deque>
+#include <memory>
+#include <stdint.h>
+#include <sys/types.h>
+
+// 等完成通知时对端一直没有确认任何数据的最长时间，超过后才放弃连接
+const int ZEROCOPY_STALL_MS = 30 * 1000;
+
+// 用MSG_ZEROCOPY发送大块动态生成的body(例如编码后的图片)。
+// 内核直接引用用户态内存，所以数据要一直保留到从错误队列收到完成通知为止。
+class ZeroCopySender: noncopyable
+{
+private:
+    struct Pending
+    {
+        // 发送这段数据的最后一次send对应的通知序号
+        uint32_t lastSeq;
+        std::shared_ptr<const void> owner;
+    };
+    // 超过这个大小才走零拷贝，0表示关闭
+    static size_t threshold;
+
+    // 正在发送的数据，由owner保证有效
+    std::shared_ptr<const void> owner;
+    const unsigned char *body;
+    size_t length;
+    size_t offset;
+    std::deque<Pending> pending;
+    // 下一次零拷贝send的序号，内核对每个socket从0开始计数
+    uint32_t seq;
+    // 序号小于done的send都已完成
+    uint32_t done;
+    // 当前body第一次send的序号
+    uint32_t bodySeq;
+    bool enabled;
+    // 内核回退成了拷贝(例如回环网卡)，之后的响应不再走零拷贝
+    bool copied;
+    // 上次检查时发送队列中的字节数、已完成的序号，以及最近一次有进展的时间(毫秒)
+    int lastQueued;
+    uint32_t lastDone;
+    long long lastProgress;
+
+    void release();
+
+public:
+    static void setThreshold(size_t bytes);
+    static size_t getThreshold();
+
+    ZeroCopySender();
+    // 数据足够大时引用data(不拷贝，持有owner直到收到完成通知)并返回true，
+    // 否则调用方走普通发送路径
+    bool take(int fd, const std::shared_ptr<const void> &owner_, const unsigned char *data, size_t len);
+    // body还没有发完
+    bool sending() const;
+    // 有已发出但未收到完成通知的数据(包括body还在发送时已经发出的部分)
+    bool waiting() const;
+    // 发送剩余的body，返回-1表示出错
+    ssize_t send(int fd);
+    // 读取错误队列中的完成通知，释放已完成的数据，返回-1表示出错
+    int reap(int fd);
+    // 等完成通知期间定期调用：发送队列在缩短或者有新的完成通知就算有进展，
+    // 超过ZEROCOPY_STALL_MS没有进展返回true
+    bool stalled(int fd);
+    // socket关闭后恢复初始状态，序号对新的socket重新从0开始
+    void reset();
+};
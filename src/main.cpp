@@ -2,6 +2,18 @@
 #include "Epoll.h"
 #include "ThreadPool.h"
 #include "util.h"
+#include "SocketOpt.h"
+#include "ZeroCopy.h"
+#include "DiskIO.h"
+#include "ImageDump.h"
+#include "Compute.h"
+#include "ResultCache.h"
+#include "BodySpool.h"
+#include "Logger.h"
+#include "Trace.h"
+#include "AccessLog.h"
+#include "RequestPool.h"
+#include "KeepAlive.h"
 #include <sys/epoll.h>
 #include <queue>
 #include <sys/time.h>
@@ -9,11 +21,15 @@
 #include <netinet/in.h>
 #include <stdio.h>
 #include <string.h>
+#include <ctype.h>
+#include <stdint.h>
 #include <cstdlib>
 #include <iostream>
 #include <vector>
 #include <unistd.h>
 #include <memory>
+#include <getopt.h>
+#include <sys/resource.h>
 
 using namespace std;
 
@@ -21,6 +37,8 @@ static const int MAX_EVENTS = 5000;
 static const int LISTEN_SIZE = 1024;
 const int THREADPOOL_THREAD_NUM = 4;
 const int QUEUE_SIZE = 65535;
+const int DISK_THREAD_NUM = 2;
+const int COMPUTE_THREAD_NUM = 4;
 
 const int PORT = 8888;
 const int ASK_STATIC_FILE = 1;
@@ -44,6 +62,9 @@ int bind_and_listen(int port)
     if(setsockopt(listen_fd, SOL_SOCKET,  SO_REUSEADDR, &optval, sizeof(optval)) == -1)
         return -1;
 
+    // TCP_DEFER_ACCEPT、TCP_FASTOPEN和缓冲区大小
+    SocketOpt::tuneListen(listen_fd);
+
     // 设置服务器IP和Port，和监听描述副绑定
     struct sockaddr_in server_addr;
     bzero((char*)&server_addr, sizeof(server_addr));
@@ -67,14 +88,192 @@ int bind_and_listen(int port)
 }
 
 
-int main()
+// 打开文件数的软限制不够描述符表时调到硬限制为止
+void raiseFdLimit(int maxFds)
+{
+    struct rlimit rl;
+    if (getrlimit(RLIMIT_NOFILE, &rl) < 0 || rl.rlim_cur >= static_cast<rlim_t>(maxFds))
+        return;
+    rl.rlim_cur = static_cast<rlim_t>(maxFds) < rl.rlim_max ? maxFds : rl.rlim_max;
+    if (setrlimit(RLIMIT_NOFILE, &rl) < 0 || rl.rlim_cur < static_cast<rlim_t>(maxFds))
+        LOG_WARN("open file limit %lu is below the descriptor table size %d", static_cast<unsigned long>(rl.rlim_cur), maxFds);
+}
+
+// 以MB为单位的选项：只接受数字，换算成字节后不超过limit
+bool parseMegabytes(const char *arg, size_t limit, size_t &bytes)
+{
+    size_t mb;
+    if (!StrView(arg).toSize(limit / (1024 * 1024), mb))
+        return false;
+    bytes = mb * 1024 * 1024;
+    return true;
+}
+
+void usage(const char *prog)
+{
+    printf("Usage: %s [-s none|latency|throughput|default] [-S sndbuf] [-R rcvbuf] [-z zerocopy_threshold] [-d disk_threads] [-c compute_threads] [-D dump_every] [-o dump_dir] [-C result_cache_mb] [-b max_body_mb] [-m body_budget_mb] [-l debug|info|warn|error] [-L log_file] [-t trace_every] [-T trace_file] [-A access_log] [-F clf|binary] [-r rotate_mb] [-P pooled_conns] [-n max_conns] [-k keepalive_sec]\n", prog);
+}
+
+int main(int argc, char *argv[])
 {
     #ifndef _PTHREADS
         printf("_PTHREADS is not defined !\n");
     #endif
+    int opt;
+    int sndBuf = 0, rcvBuf = 0;
+    int diskThreads = DISK_THREAD_NUM;
+    int computeThreads = COMPUTE_THREAD_NUM;
+    unsigned long dumpEvery = 0;
+    string dumpDir = "dump";
+    size_t maxBody = BODY_MAX_BYTES;
+    size_t bodyBudget = BODY_BUDGET_BYTES;
+    string logFile;
+    unsigned long traceEvery = 0;
+    string traceFile;
+    string accessFile;
+    int accessFormat = ACCESS_LOG_CLF;
+    size_t accessRotate = 0;
+    int maxConns = MAX_CONNS_DEFAULT;
+    int keepAliveSec = KEEPALIVE_TIMEOUT_MS / 1000;
+    while ((opt = getopt(argc, argv, "s:S:R:z:d:c:D:o:C:b:m:l:L:t:T:A:F:r:P:n:k:h")) != -1)
+    {
+        switch (opt)
+        {
+            case 's':
+            {
+                if (SocketOpt::setProfile(optarg) < 0)
+                {
+                    usage(argv[0]);
+                    return 1;
+                }
+                break;
+            }
+            case 'S':
+                sndBuf = atoi(optarg);
+                break;
+            case 'R':
+                rcvBuf = atoi(optarg);
+                break;
+            case 'd':
+                diskThreads = atoi(optarg);
+                break;
+            case 'c':
+                computeThreads = atoi(optarg);
+                break;
+            case 'D':
+                dumpEvery = strtoul(optarg, NULL, 10);
+                break;
+            case 'o':
+                dumpDir = optarg;
+                break;
+            case 'C':
+                ResultCache::setCapacity(strtoul(optarg, NULL, 10) * 1024 * 1024);
+                break;
+            case 'b':
+                if (!parseMegabytes(optarg, BODY_MAX_LIMIT, maxBody))
+                {
+                    usage(argv[0]);
+                    return 1;
+                }
+                break;
+            case 'm':
+                if (!parseMegabytes(optarg, SIZE_MAX, bodyBudget))
+                {
+                    usage(argv[0]);
+                    return 1;
+                }
+                break;
+            case 'l':
+            {
+                int level = Logger::levelOf(optarg);
+                if (level < 0)
+                {
+                    usage(argv[0]);
+                    return 1;
+                }
+                Logger::setLevel(level);
+                break;
+            }
+            case 'L':
+                logFile = optarg;
+                break;
+            case 't':
+            {
+                // strtoul会把负数转成很大的正数，这里只接受数字
+                char *end;
+                traceEvery = strtoul(optarg, &end, 10);
+                if (!isdigit(static_cast<unsigned char>(optarg[0])) || *end != '\0')
+                {
+                    usage(argv[0]);
+                    return 1;
+                }
+                break;
+            }
+            case 'T':
+                traceFile = optarg;
+                break;
+            case 'A':
+                accessFile = optarg;
+                break;
+            case 'F':
+                accessFormat = AccessLog::formatOf(optarg);
+                if (accessFormat < 0)
+                {
+                    usage(argv[0]);
+                    return 1;
+                }
+                break;
+            case 'r':
+                accessRotate = strtoul(optarg, NULL, 10) * 1024 * 1024;
+                break;
+            case 'P':
+                RequestPool::setHighWater(strtoul(optarg, NULL, 10));
+                break;
+            case 'n':
+                maxConns = atoi(optarg);
+                if (maxConns < 64)
+                {
+                    usage(argv[0]);
+                    return 1;
+                }
+                break;
+            case 'k':
+                keepAliveSec = atoi(optarg);
+                if (keepAliveSec < KEEPALIVE_TIMEOUT_MIN_MS / 1000)
+                {
+                    usage(argv[0]);
+                    return 1;
+                }
+                break;
+            case 'z':
+                ZeroCopySender::setThreshold(strtoul(optarg, NULL, 10));
+                break;
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+    if (Logger::start(logFile.c_str()) < 0)
+    {
+        perror("logger start failed");
+        return 1;
+    }
+    SocketOpt::setBufferSize(sndBuf, rcvBuf);
+    ImageDump::setSampling(dumpEvery, dumpDir);
+    BodyBudget::setLimits(maxBody, bodyBudget);
+    Tracer::init(traceEvery, traceFile);
+    if (AccessLog::start(accessFile, accessFormat, accessRotate) < 0)
+    {
+        perror("access log start failed");
+        return 1;
+    }
     handleSigpipe();
+    // 描述符表除了客户端连接还要容纳服务器自己打开的描述符
+    int maxFds = KeepAlive::fdTableSize(maxConns);
+    raiseFdLimit(maxFds);
+    KeepAlive::setLimits(maxConns, keepAliveSec * 1000);
     // 主线程初始化epollfd
-    if (Epoll::epollInit(MAX_EVENTS, LISTEN_SIZE) < 0)
+    if (Epoll::epollInit(MAX_EVENTS, LISTEN_SIZE, maxFds) < 0)
     {
         perror("epoll init failed");
         return 1;
@@ -85,6 +284,18 @@ int main()
         printf("Threadpool create failed\n");
         return 1;
     }
+    // 冷文件预读线程，0表示不使用
+    if (diskThreads > 0 && DiskIO::init(diskThreads) < 0)
+    {
+        printf("Disk io threads create failed\n");
+        return 1;
+    }
+    // 图像计算线程，0表示在工作线程上直接计算
+    if (computeThreads > 0 && Compute::init(computeThreads) < 0)
+    {
+        printf("Compute threads create failed\n");
+        return 1;
+    }
     int listen_fd = bind_and_listen(PORT);
     if (listen_fd < 0) 
     {
@@ -96,7 +307,7 @@ int main()
         perror("set socket non block failed");
         return 1;
     }
-    shared_ptr<RequestData> request(new RequestData());
+    reqPtr request(new RequestData());
     request->setFd(listen_fd);
     if (Epoll::epollAdd(listen_fd, request, EPOLLIN | EPOLLET) < 0)
     {
@@ -107,7 +318,8 @@ int main()
     // 主线程负责监听端口
     while (true)
     {
-        Epoll::epollWait(listen_fd, MAX_EVENTS, -1);
+        // 定时返回，空闲时也能清理过期的异步任务
+        Epoll::epollWait(listen_fd, MAX_EVENTS, EPOLL_WAIT_TIME);
     }
     return 0;
 }
\ No newline at end of file
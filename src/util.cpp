@@ -1,11 +1,12 @@
 #include "util.h"
+#include "Logger.h"
 #include <unistd.h>
 #include <fcntl.h>
 #include <signal.h>
 #include <errno.h>
 #include <string.h>
+#include <sys/sendfile.h>
 
-const int MAX_BUF_SIZE = 4096;
 ssize_t readn(int fd, void *buf, size_t n)
 {
     size_t nleft = n;
@@ -36,32 +37,31 @@ ssize_t readn(int fd, void *buf, size_t n)
     return readSum;
 }
 
-ssize_t readn(int fd, std::string &inBuf)
+ssize_t readn(int fd, Buffer &inBuf, size_t limit)
 {
     ssize_t nread = 0;
     ssize_t readSum = 0;
-    while (true)
+    int savedErrno = 0;
+    while (static_cast<size_t>(readSum) < limit)
     {
-        char buf[MAX_BUF_SIZE];
-        if ((nread = read(fd, buf, MAX_BUF_SIZE)) < 0)
+        if ((nread = inBuf.readFd(fd, &savedErrno)) < 0)
         {
-            if (errno == EINTR)
+            if (savedErrno == EINTR)
                 continue;
-            else if (errno == EAGAIN)
+            else if (savedErrno == EAGAIN)
             {
-                
                 return readSum;
-            }  
+            }
             else
             {
-                perror("read error");
+                errno = savedErrno;
+                LOG_DEBUG("fd %d read: %m", fd);
                 return -1;
             }
         }
         else if (nread == 0)
             break;
         readSum += nread;
-        inBuf += std::string(buf, buf + nread);
     }
     return readSum;
 }
@@ -98,38 +98,52 @@ ssize_t writen(int fd, void *buf, size_t n)
     return writeSum;
 }
 
-ssize_t writen(int fd, std::string &outBuf)
+ssize_t writen(int fd, Buffer &outBuf)
 {
-    size_t nleft = outBuf.size();
     ssize_t nwritten = 0;
     ssize_t writeSum = 0;
-    const char *ptr = outBuf.c_str();
-    while (nleft > 0)
+    int savedErrno = 0;
+    while (!outBuf.empty())
     {
-        if ((nwritten = write(fd, ptr, nleft)) <= 0)
+        if ((nwritten = outBuf.writeFd(fd, &savedErrno)) < 0)
         {
-            if (nwritten < 0)
+            if (savedErrno == EINTR)
+                continue;
+            else if (savedErrno == EAGAIN)
+                break;
+            else
+                return -1;
+        }
+        writeSum += nwritten;
+    }
+    return writeSum;
+}
+
+// 零拷贝发送文件内容，offset和left随发送进度更新
+ssize_t sendfilen(int fd, int file_fd, off_t &offset, size_t &left)
+{
+    ssize_t nsent = 0;
+    ssize_t sendSum = 0;
+    while (left > 0)
+    {
+        if ((nsent = sendfile(fd, file_fd, &offset, left)) <= 0)
+        {
+            if (nsent < 0)
             {
                 if (errno == EINTR)
-                {
-                    nwritten = 0;
                     continue;
-                }
                 else if (errno == EAGAIN)
                     break;
                 else
                     return -1;
             }
+            // 文件被截断
+            return -1;
         }
-        writeSum += nwritten;
-        nleft -= nwritten;
-        ptr += nwritten;
+        sendSum += nsent;
+        left -= nsent;
     }
-    if (writeSum == outBuf.size())
-        outBuf.clear();
-    else
-        outBuf = outBuf.substr(writeSum);
-    return writeSum;
+    return sendSum;
 }
 
 void handleSigpipe()
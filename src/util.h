@@ -1,10 +1,15 @@
 #pragma once
+#include "Buffer.h"
 #include <cstdlib>
 #include <string>
+#include <sys/types.h>
 
 ssize_t readn(int fd, void *buf, size_t n);
-ssize_t readn(int fd, std::string &inBuf);
+// 读到EAGAIN或者读够limit个字节为止(可能多读一个缓冲块)，
+// 没读完时socket仍然可读，EPOLLONESHOT重新注册后会再次触发
+ssize_t readn(int fd, Buffer &inBuf, size_t limit);
 ssize_t writen(int fd, void *buf, size_t n);
-ssize_t writen(int fd, std::string &outBuf);
+ssize_t writen(int fd, Buffer &outBuf);
+ssize_t sendfilen(int fd, int file_fd, off_t &offset, size_t &left);
 void handleSigpipe();
 int setNonBlocking(int fd);
\ No newline at end of file
@@ -0,0 +1,77 @@
+// 把二进制访问日志(-F binary)转换成CLF文本，输出到标准输出
+// 用法: ./alog2text [-v] access.log [access.log.1 ...]
+// 加-v时每行末尾再加上处理耗时(微秒)
+#include "../src/AccessLog.h"
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+
+static int convert(const char *path, bool verbose)
+{
+    FILE *fp = fopen(path, "rb");
+    if (fp == NULL)
+    {
+        perror(path);
+        return -1;
+    }
+    char magic[sizeof(ACCESS_LOG_MAGIC)];
+    if (fread(magic, 1, sizeof(magic), fp) != sizeof(magic) || memcmp(magic, ACCESS_LOG_MAGIC, sizeof(magic)) != 0)
+    {
+        fprintf(stderr, "%s: not a binary access log\n", path);
+        fclose(fp);
+        return -1;
+    }
+    std::vector<char> uri(ACCESS_URI_MAX);
+    std::vector<char> line(ACCESS_LINE_MAX);
+    AccessRecord r;
+    int ret = 0;
+    while (fread(&r, 1, sizeof(r), fp) == sizeof(r))
+    {
+        if (r.size != sizeof(r) + r.uriLen || r.uriLen > ACCESS_URI_MAX)
+        {
+            fprintf(stderr, "%s: corrupt record at offset %ld\n", path, ftell(fp) - static_cast<long>(sizeof(r)));
+            ret = -1;
+            break;
+        }
+        if (fread(uri.data(), 1, r.uriLen, fp) != r.uriLen)
+        {
+            // 服务器还在写的文件末尾可能有半条记录
+            fprintf(stderr, "%s: truncated record\n", path);
+            break;
+        }
+        int n = AccessLog::formatClf(r, uri.data(), line.data(), line.size());
+        if (verbose && n > 0)
+        {
+            // 去掉换行再追加耗时
+            fwrite(line.data(), 1, n - 1, stdout);
+            printf(" %u\n", r.duration);
+        }
+        else
+            fwrite(line.data(), 1, n, stdout);
+    }
+    fclose(fp);
+    return ret;
+}
+
+int main(int argc, char *argv[])
+{
+    bool verbose = false;
+    int first = 1;
+    if (argc > 1 && strcmp(argv[1], "-v") == 0)
+    {
+        verbose = true;
+        first = 2;
+    }
+    if (first >= argc)
+    {
+        fprintf(stderr, "Usage: %s [-v] access.log [access.log.1 ...]\n", argv[0]);
+        return 1;
+    }
+    int ret = 0;
+    for (int i = first; i < argc; ++i)
+    {
+        if (convert(argv[i], verbose) < 0)
+            ret = 1;
+    }
+    return ret;
+}